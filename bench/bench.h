@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Shared helpers of the Pallene Tracer benchmarks. Include before anything
+   else, it needs POSIX clocks. */
+
+#ifndef PT_BENCH_H
+#define PT_BENCH_H
+
+#if !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* How many times every benchmark is measured. The first run is a warm-up and
+   does not count. */
+#ifndef BENCH_RUNS
+#define BENCH_RUNS 15
+#endif
+
+/* Keeps the compiler from optimizing away the loop around the measured code,
+   even if that code compiles to nothing (e.g. without `PT_DEBUG`). */
+#define BENCH_BARRIER()    __asm__ volatile("" ::: "memory")
+
+#ifdef PT_DEBUG
+#define BENCH_MODE "PT_DEBUG"
+#else
+#define BENCH_MODE "release"
+#endif // PT_DEBUG
+
+typedef struct bench_stats {
+    double mean;
+    double stddev;
+    double min;
+    double max;
+    int runs;
+} bench_stats_t;
+
+/* Something to measure: does `n` operations. */
+typedef void (*bench_fn_t)(void *ud, long n);
+
+static inline double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static inline bench_stats_t bench_stats(const double *samples, int runs) {
+    bench_stats_t stats = { 0.0, 0.0, samples[0], samples[0], runs };
+
+    for(int i = 0; i < runs; i++) {
+        stats.mean += samples[i];
+        if(samples[i] < stats.min) stats.min = samples[i];
+        if(samples[i] > stats.max) stats.max = samples[i];
+    }
+    stats.mean /= runs;
+
+    for(int i = 0; i < runs; i++)
+        stats.stddev += (samples[i] - stats.mean) * (samples[i] - stats.mean);
+    stats.stddev = runs > 1 ? sqrt(stats.stddev / (runs - 1)) : 0.0;
+
+    return stats;
+}
+
+/* The suite of the last `bench_header`. */
+static const char *bench_suite = "";
+
+static inline void bench_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for(; *s != '\0'; s++) {
+        if(*s == '"' || *s == '\\' || (unsigned char) *s < 0x20)
+            fprintf(f, "\\u%04x", (unsigned char) *s);
+        else
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+/* Appends a result to the file named by the `BENCH_JSON` environment variable,
+   if any, in the format of bench/record.lua. `better` is "lower" or "higher". */
+static inline void bench_record(const char *suite, const char *name, const char *unit,
+        const char *better, bench_stats_t stats) {
+    const char *path = getenv("BENCH_JSON");
+    if(path == NULL || *path == '\0')
+        return;
+
+    FILE *f = fopen(path, "a");
+    if(f == NULL) {
+        perror(path);
+        return;
+    }
+
+    const char *commit = getenv("BENCH_COMMIT");
+    const char *flags = getenv("BENCH_FLAGS");
+    const char *fields[][2] = {
+        { "suite", suite }, { "name", name }, { "mode", BENCH_MODE },
+        { "commit", commit != NULL ? commit : "unknown" },
+        { "flags", flags != NULL ? flags : "" },
+        { "unit", unit }, { "better", better },
+    };
+
+    fputc('{', f);
+    for(size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        bench_json_string(f, fields[i][0]);
+        fputc(':', f);
+        bench_json_string(f, fields[i][1]);
+        fputc(',', f);
+    }
+    fprintf(f, "\"mean\":%.17g,\"stddev\":%.17g,\"min\":%.17g,\"max\":%.17g,\"runs\":%d}\n",
+        stats.mean, stats.stddev, stats.min, stats.max, stats.runs);
+    fclose(f);
+}
+
+static inline void bench_header(const char *suite) {
+    bench_suite = suite;
+    printf("# %s (%s, %d runs)\n", suite, BENCH_MODE, BENCH_RUNS);
+    printf("%-44s %12s %10s %10s\n", "benchmark", "ns/op", "stddev", "min");
+}
+
+static inline void bench_report(const char *name, bench_stats_t stats) {
+    printf("%-44s %12.2f %10.2f %10.2f\n", name, stats.mean, stats.stddev, stats.min);
+    fflush(stdout);
+    bench_record(bench_suite, name, "ns/op", "lower", stats);
+}
+
+/* Measures `fn` doing `n` operations per run and reports the time per operation. */
+static inline bench_stats_t bench_run(const char *name, bench_fn_t fn, void *ud, long n) {
+    double samples[BENCH_RUNS];
+
+    fn(ud, n);
+    for(int i = 0; i < BENCH_RUNS; i++) {
+        double start = bench_now();
+        fn(ud, n);
+        samples[i] = (bench_now() - start) / (double) n;
+    }
+
+    bench_stats_t stats = bench_stats(samples, BENCH_RUNS);
+    bench_report(name, stats);
+    return stats;
+}
+
+#endif // PT_BENCH_H
@@ -0,0 +1,232 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Compares two files of benchmark results written with `BENCH_JSON` (see
+-- bench/record.lua). Usage, from the repository root:
+--     lua bench/compare.lua <base.json> <new.json> [confidence=0.95] [threshold=0]
+--
+-- For every result in both files, prints the change of the mean and its
+-- confidence interval, from Welch's t-test over the repetitions. A change is
+-- only called a regression or an improvement when the whole interval is beyond
+-- `threshold` percent of the base mean, on one side. Results recorded more than
+-- once in a file, e.g. from several `make bench` runs, are pooled. Exits with 1
+-- if anything regressed.
+
+local record = require "bench.record"
+
+-- ---- Student's t distribution ----
+
+-- Lanczos approximation of log(Gamma(x)), for x > 0.
+local function lgamma(x)
+    local g = 7
+    local c = {
+        0.99999999999980993, 676.5203681218851, -1259.1392167224028,
+        771.32342877765313, -176.61502916214059, 12.507343278686905,
+        -0.13857109526572012, 9.9843695780195716e-6, 1.5056327351493116e-7,
+    }
+    x = x - 1
+    local a = c[1]
+    local t = x + g + 0.5
+    for i = 1, g + 1 do
+        a = a + c[i + 1] / (x + i)
+    end
+    return 0.5 * math.log(2 * math.pi) + (x + 0.5) * math.log(t) - t + math.log(a)
+end
+
+-- Continued fraction of the incomplete beta function (modified Lentz).
+local function betacf(a, b, x)
+    local tiny = 1e-300
+    local c, d = 1, 1 - (a + b) * x / (a + 1)
+    if math.abs(d) < tiny then d = tiny end
+    d = 1 / d
+    local h = d
+    for m = 1, 300 do
+        local m2 = 2 * m
+        local aa = m * (b - m) * x / ((a + m2 - 1) * (a + m2))
+        d = 1 + aa * d
+        if math.abs(d) < tiny then d = tiny end
+        c = 1 + aa / c
+        if math.abs(c) < tiny then c = tiny end
+        d = 1 / d
+        h = h * d * c
+        aa = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1))
+        d = 1 + aa * d
+        if math.abs(d) < tiny then d = tiny end
+        c = 1 + aa / c
+        if math.abs(c) < tiny then c = tiny end
+        d = 1 / d
+        local del = d * c
+        h = h * del
+        if math.abs(del - 1) < 1e-12 then
+            break
+        end
+    end
+    return h
+end
+
+-- Regularized incomplete beta function I_x(a, b).
+local function ibeta(a, b, x)
+    if x <= 0 then return 0 end
+    if x >= 1 then return 1 end
+    local front = math.exp(lgamma(a + b) - lgamma(a) - lgamma(b)
+        + a * math.log(x) + b * math.log(1 - x))
+    if x < (a + 1) / (a + b + 2) then
+        return front * betacf(a, b, x) / a
+    end
+    return 1 - front * betacf(b, a, 1 - x) / b
+end
+
+-- The t such that P(|T| <= t) = confidence, with `df` degrees of freedom.
+local function t_critical(confidence, df)
+    local function two_sided(t)
+        return 1 - ibeta(df / 2, 0.5, df / (df + t * t))
+    end
+    local lo, hi = 0, 1
+    while two_sided(hi) < confidence do
+        hi = hi * 2
+    end
+    for _ = 1, 100 do
+        local mid = (lo + hi) / 2
+        if two_sided(mid) < confidence then lo = mid else hi = mid end
+    end
+    return (lo + hi) / 2
+end
+
+-- ---- Results ----
+
+local function key(result)
+    return table.concat({ result.suite or "", result.name or "", result.mode or "" }, "\0")
+end
+
+-- Pools repeated results of the same benchmark into one, keeping the order in
+-- which they first appeared.
+local function pool(results)
+    local pooled, order = {}, {}
+    for _, r in ipairs(results) do
+        local k = key(r)
+        local p = pooled[k]
+        local n = r.runs or 1
+        local sd = r.stddev or 0
+        if not p then
+            p = { result = r, n = n, mean = r.mean, ss = (n - 1) * sd * sd,
+                  commits = { [r.commit or "unknown"] = true } }
+            pooled[k] = p
+            table.insert(order, k)
+        else
+            local total = p.n + n
+            local mean = (p.n * p.mean + n * r.mean) / total
+            p.ss = p.ss + (n - 1) * sd * sd
+                + p.n * (p.mean - mean) ^ 2 + n * (r.mean - mean) ^ 2
+            p.n, p.mean = total, mean
+            p.commits[r.commit or "unknown"] = true
+        end
+    end
+    for _, p in pairs(pooled) do
+        p.var = p.n > 1 and p.ss / (p.n - 1) or 0
+    end
+    return pooled, order
+end
+
+local function commits(p_by_key)
+    local seen = {}
+    for _, p in pairs(p_by_key) do
+        for c in pairs(p.commits) do
+            seen[c] = true
+        end
+    end
+    local list = {}
+    for c in pairs(seen) do
+        table.insert(list, c)
+    end
+    table.sort(list)
+    return table.concat(list, ", ")
+end
+
+-- ---- Main ----
+
+local paths, confidence, threshold = {}, 0.95, 0
+for _, a in ipairs(arg) do
+    local k, v = string.match(a, "^(%w+)=(.*)$")
+    if k == "confidence" then
+        confidence = tonumber(v)
+        if not confidence or confidence <= 0 or confidence >= 1 then
+            error("bad confidence: " .. a)
+        end
+    elseif k == "threshold" then
+        threshold = tonumber(v)
+        if not threshold or threshold < 0 then
+            error("bad threshold: " .. a)
+        end
+    else
+        table.insert(paths, a)
+    end
+end
+if #paths ~= 2 then
+    io.stderr:write("usage: lua bench/compare.lua <base.json> <new.json> [confidence=0.95] [threshold=0]\n")
+    os.exit(2)
+end
+
+local base = pool(record.read(paths[1]))
+local new, order = pool(record.read(paths[2]))
+
+print(string.format("# base: %s (%s)", paths[1], commits(base)))
+print(string.format("# new:  %s (%s)", paths[2], commits(new)))
+print(string.format("# %g%% confidence intervals of the change, threshold %g%%",
+    confidence * 100, threshold))
+
+local regressions, improvements, compared, skipped = 0, 0, 0, 0
+local suite
+for _, k in ipairs(order) do
+    local b, n = base[k], new[k]
+    if not b then
+        skipped = skipped + 1
+    else
+        compared = compared + 1
+        local r = n.result
+        local diff = n.mean - b.mean
+        local change = b.mean ~= 0 and diff / math.abs(b.mean) * 100 or 0
+        local interval, verdict = "", "?"
+
+        local se2 = b.var / b.n + n.var / n.n
+        if b.n > 1 and n.n > 1 and se2 > 0 then
+            -- Welch-Satterthwaite degrees of freedom.
+            local df = se2 * se2 / ((b.var / b.n) ^ 2 / (b.n - 1) + (n.var / n.n) ^ 2 / (n.n - 1))
+            local half = t_critical(confidence, df) * math.sqrt(se2)
+            local scale = b.mean ~= 0 and 100 / math.abs(b.mean) or 0
+            local lo, hi = (diff - half) * scale, (diff + half) * scale
+            interval = string.format("[%+8.2f%%, %+8.2f%%]", lo, hi)
+
+            local up, down = lo > threshold, hi < -threshold
+            local worse = r.better == "higher" and down or r.better ~= "higher" and up
+            local better = r.better == "higher" and up or r.better ~= "higher" and down
+            if worse then
+                verdict = "REGRESSION"
+                regressions = regressions + 1
+            elseif better then
+                verdict = "improvement"
+                improvements = improvements + 1
+            else
+                verdict = "same"
+            end
+        elseif diff == 0 then
+            verdict = "same"
+        end
+
+        if r.suite ~= suite then
+            suite = r.suite
+            print()
+            print(suite)
+            print(string.format("  %-42s %-10s %14s %14s %9s %21s  %s",
+                "benchmark", "mode", "base", "new", "change", "interval", "verdict"))
+        end
+        print(string.format("  %-42s %-10s %14.6g %14.6g %+8.2f%% %21s  %s",
+            r.name, r.mode or "", b.mean, n.mean, change, interval, verdict))
+    end
+end
+
+print()
+print(string.format("# %d compared, %d regressions, %d improvements, %d only in %s",
+    compared, regressions, improvements, skipped, paths[2]))
+os.exit(regressions > 0 and 1 or 0)
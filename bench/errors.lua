@@ -0,0 +1,95 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Throughput of Pallene functions raising errors through `pcall` and
+-- `xpcall(pallene_tracer_errhandler)`, from several depths of C interface
+-- frames. Run by `make bench` as
+--     ./pt-lua bench/errors.lua
+--
+-- Every depth is measured five ways, so that the costs can be told apart:
+--   enter/exit  traced minus untracked calls returning normally.
+--   unwind      the finalizer removing the frames an error left behind, measured
+--               on its own by `module.unwind`.
+--   traceback   `xpcall` minus `pcall` of the traced error.
+
+local module = require "bench.errors_module"
+local record = require "bench.record"
+
+local RUNS = 10
+
+local traced, untracked = module.traced, module.untracked
+local errhandler = pallene_tracer_errhandler
+
+local modes = {
+    { name = "untracked ok",  args = { pcall, untracked, false } },
+    { name = "traced ok",     args = { pcall, traced, false } },
+    { name = "untracked err", args = { pcall, untracked, true } },
+    { name = "traced err",    args = { pcall, traced, true } },
+    { name = "traced xpcall", args = { xpcall, traced, errhandler, true } },
+}
+
+-- Calls the mode through `measure` with the depth before the last argument.
+local function measure(mode, depth, runs, reps)
+    local args = mode.args
+    if #args == 3 then
+        return module.measure(runs, reps, args[1], args[2], depth, args[3])
+    else
+        return module.measure(runs, reps, args[1], args[2], args[3], depth, args[4])
+    end
+end
+
+-- Same signature as `measure`, for `calibrate`.
+local function unwind(_, depth, runs, reps)
+    return module.unwind(runs, reps, depth)
+end
+
+-- Enough repetitions for a run to take about 20ms.
+local function calibrate(measure, mode, depth)
+    local reps = 1
+    while true do
+        local mean = measure(mode, depth, 1, reps)
+        if mean * reps >= 2e7 or reps >= 10000000 then
+            return reps
+        end
+        reps = reps * 4
+    end
+end
+
+print(string.format("# errors (PT_DEBUG, %d runs)", RUNS))
+print(string.format("%-14s %7s %12s %10s %12s", "mode", "depth", "us/op", "stddev", "ops/s"))
+
+local costs = {}
+for _, depth in ipairs({ 0, 10, 100, 1000, 10000 }) do
+    local means = {}
+    for _, mode in ipairs(modes) do
+        local mean, stddev = measure(mode, depth, RUNS, calibrate(measure, mode, depth))
+        means[mode.name] = mean
+        print(string.format("%-14s %7d %12.3f %10.3f %12.0f",
+            mode.name, depth, mean / 1e3, stddev / 1e3, 1e9 / mean))
+        io.stdout:flush()
+
+        record.write({ suite = "errors", name = string.format("%s depth=%d", mode.name, depth),
+            mode = "PT_DEBUG", unit = "ns/op", better = "lower",
+            mean = mean, stddev = stddev, runs = RUNS })
+    end
+    local unwind_mean, unwind_stddev = unwind(nil, depth, RUNS, calibrate(unwind, nil, depth))
+    record.write({ suite = "errors", name = string.format("unwind depth=%d", depth),
+        mode = "PT_DEBUG", unit = "ns/op", better = "lower",
+        mean = unwind_mean, stddev = unwind_stddev, runs = RUNS })
+
+    table.insert(costs, {
+        depth = depth,
+        enter_exit = means["traced ok"] - means["untracked ok"],
+        unwind = unwind_mean,
+        traceback = means["traced xpcall"] - means["traced err"],
+    })
+end
+
+print()
+print(string.format("%7s %14s %14s %14s", "depth", "enter/exit us", "unwind us", "traceback us"))
+for _, cost in ipairs(costs) do
+    print(string.format("%7d %14.3f %14.3f %14.3f",
+        cost.depth, cost.enter_exit / 1e3, cost.unwind / 1e3, cost.traceback / 1e3))
+end
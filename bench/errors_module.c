@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Helpers for bench/errors.lua: Pallene functions raising errors from any
+   depth of C interface frames, and their untracked twins. */
+
+#include "bench/bench.h"
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_FRAMEEXIT(fnstack)
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame)
+
+/* ---- TRACED FUNCTIONS ---- */
+
+/* A C interface function recursing `depth` times, like Pallene code calling
+   Pallene code does, before raising or not. */
+void raise_c(lua_State *L, lua_Integer depth, int fail) {
+    MODULE_C_FRAMEENTER();
+
+    if(depth > 0)
+        raise_c(L, depth - 1, fail);
+    else if(fail)
+        luaL_error(L, "raised");
+
+    MODULE_C_FRAMEEXIT();
+}
+
+/* traced(depth, fail): the Lua interface of `raise_c`. */
+int traced(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(traced);
+
+    lua_Integer depth = luaL_checkinteger(L, 1);
+    int fail = lua_toboolean(L, 2);
+    raise_c(L, depth, fail);
+
+    /* The finalizer object removes the Lua interface frame, error or not. */
+    return 0;
+}
+
+/* ---- UNTRACKED FUNCTIONS ---- */
+
+/* The same as `raise_c`, without Pallene Tracer. The barrier keeps the
+   compiler from turning the recursion into a loop. */
+void untracked_c(lua_State *L, lua_Integer depth, int fail) {
+    if(depth > 0)
+        untracked_c(L, depth - 1, fail);
+    else if(fail)
+        luaL_error(L, "raised");
+    BENCH_BARRIER();
+}
+
+/* untracked(depth, fail) */
+int untracked(lua_State *L) {
+    lua_Integer depth = luaL_checkinteger(L, 1);
+    int fail = lua_toboolean(L, 2);
+    untracked_c(L, depth, fail);
+    return 0;
+}
+
+/* ---- MEASUREMENT ---- */
+
+/* measure(runs, reps, fn, ...) -> mean ns, stddev ns */
+/* Calls `fn(...)` `reps` times per run, discarding the results. */
+int measure(lua_State *L) {
+    int runs = (int) luaL_checkinteger(L, 1);
+    long reps = (long) luaL_checkinteger(L, 2);
+    luaL_checkany(L, 3);
+    luaL_argcheck(L, runs > 0 && runs <= 1000 && reps > 0, 1, "bad runs or reps");
+
+    int nargs = lua_gettop(L) - 3;
+    double *samples = malloc(runs * sizeof(double));
+
+    /* The first run is a warm-up. */
+    for(int i = -1; i < runs; i++) {
+        double start = bench_now();
+        for(long r = 0; r < reps; r++) {
+            for(int a = 3; a <= 3 + nargs; a++)
+                lua_pushvalue(L, a);
+            lua_call(L, nargs, 0);
+        }
+        double elapsed = bench_now() - start;
+
+        if(i >= 0)
+            samples[i] = elapsed / (double) reps;
+    }
+
+    bench_stats_t stats = bench_stats(samples, runs);
+    free(samples);
+
+    lua_pushnumber(L, stats.mean);
+    lua_pushnumber(L, stats.stddev);
+    return 2;
+}
+
+static pt_fn_details_t unwind_details = PALLENE_TRACER_FN_DETAILS("raise_c", __FILE__);
+
+/* unwind(runs, reps, depth) -> mean ns, stddev ns */
+/* The finalizer alone, as it runs after an error: pushes a Lua interface frame
+   and `depth` C interface frames, then closes the finalizer object with an error
+   object. Pushing the same frames and dropping them by hand is measured apart
+   and taken out. */
+int unwind(lua_State *L) {
+    MODULE_GET_FNSTACK;
+    int runs = (int) luaL_checkinteger(L, 1);
+    long reps = (long) luaL_checkinteger(L, 2);
+    lua_Integer depth = luaL_checkinteger(L, 3);
+    luaL_argcheck(L, runs > 0 && runs <= 1000 && reps > 0, 1, "bad runs or reps");
+
+    luaL_getmetafield(L, lua_upvalueindex(2), "__close");
+    int close = lua_gettop(L);
+
+    double *samples = malloc(runs * sizeof(double));
+    pt_frame_t lua_frame = PALLENE_TRACER_LUA_FRAME(unwind);
+    pt_frame_t c_frame = PALLENE_TRACER_C_FRAME(unwind_details);
+    int base = fnstack->count;
+
+    /* The first run is a warm-up. */
+    for(int i = -1; i < runs; i++) {
+        double start = bench_now();
+        for(long r = 0; r < reps; r++) {
+            pallene_tracer_frameenter(fnstack, &lua_frame);
+            for(lua_Integer d = 0; d < depth; d++)
+                pallene_tracer_frameenter(fnstack, &c_frame);
+
+            lua_pushvalue(L, close);
+            lua_pushvalue(L, lua_upvalueindex(2));
+            lua_pushliteral(L, "raised");
+            lua_call(L, 2, 0);
+        }
+        double finalized = bench_now() - start;
+
+        start = bench_now();
+        for(long r = 0; r < reps; r++) {
+            pallene_tracer_frameenter(fnstack, &lua_frame);
+            for(lua_Integer d = 0; d < depth; d++)
+                pallene_tracer_frameenter(fnstack, &c_frame);
+
+            BENCH_BARRIER();
+            fnstack->count = base;
+        }
+        double dropped = bench_now() - start;
+
+        if(i >= 0)
+            samples[i] = (finalized - dropped) / (double) reps;
+    }
+
+    bench_stats_t stats = bench_stats(samples, runs);
+    free(samples);
+
+    lua_pushnumber(L, stats.mean);
+    lua_pushnumber(L, stats.stddev);
+    return 2;
+}
+
+int luaopen_bench_errors_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, traced, 2);
+    lua_setfield(L, -2, "traced");
+
+    lua_pushcfunction(L, untracked);
+    lua_setfield(L, -2, "untracked");
+
+    lua_pushcfunction(L, measure);
+    lua_setfield(L, -2, "measure");
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, unwind, 2);
+    lua_setfield(L, -2, "unwind");
+
+    return 1;
+}
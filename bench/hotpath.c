@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Per-call overhead of the Pallene Tracer hot path. Built twice by `make bench`,
+   with and without `PT_DEBUG`, using the wrapper macros just like modules do. */
+
+#include "bench/bench.h"
+
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include <lualib.h>
+
+/* Frames pushed before popping them all, as a function call chain would. */
+#define DEPTH 64
+
+typedef struct {
+    lua_State *L;
+    pt_fnstack_t *fnstack;
+} bench_ctx_t;
+
+static void bench_frameenter(void *ud, long n) {
+    bench_ctx_t *ctx = ud;
+    pt_fnstack_t *fnstack = ctx->fnstack;
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame);
+    (void) fnstack;
+
+    for(long i = 0; i < n; i += DEPTH) {
+        for(int j = 0; j < DEPTH; j++) {
+            PALLENE_TRACER_FRAMEENTER(fnstack, &_frame);
+            BENCH_BARRIER();
+        }
+#ifdef PT_DEBUG
+        fnstack->count -= DEPTH;
+#endif // PT_DEBUG
+    }
+}
+
+static void bench_frameexit(void *ud, long n) {
+    bench_ctx_t *ctx = ud;
+    pt_fnstack_t *fnstack = ctx->fnstack;
+    (void) fnstack;
+
+    for(long i = 0; i < n; i += DEPTH) {
+#ifdef PT_DEBUG
+        fnstack->count += DEPTH;
+#endif // PT_DEBUG
+        for(int j = 0; j < DEPTH; j++) {
+            PALLENE_TRACER_FRAMEEXIT(fnstack);
+            BENCH_BARRIER();
+        }
+    }
+}
+
+static void bench_setline(void *ud, long n) {
+    bench_ctx_t *ctx = ud;
+    pt_fnstack_t *fnstack = ctx->fnstack;
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame);
+    (void) fnstack;
+
+    for(long i = 0; i < n; i++) {
+        PALLENE_TRACER_GENERIC_C_SETLINE(fnstack);
+        BENCH_BARRIER();
+    }
+
+    PALLENE_TRACER_FRAMEEXIT(fnstack);
+}
+
+/* A Lua interface function, as generated by Pallene. */
+static int traced_fn(lua_State *L) {
+#ifdef PT_DEBUG
+    pt_fnstack_t *fnstack = lua_touserdata(L, lua_upvalueindex(1));
+#else
+    (void) L;
+#endif // PT_DEBUG
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, traced_fn, lua_upvalueindex(2), _frame_lua);
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c);
+
+    PALLENE_TRACER_GENERIC_C_SETLINE(fnstack);
+    PALLENE_TRACER_FRAMEEXIT(fnstack);
+    return 0;
+}
+
+/* The same function, never traced. */
+static int plain_fn(lua_State *L) {
+    (void) L;
+    return 0;
+}
+
+static void bench_call(void *ud, long n) {
+    bench_ctx_t *ctx = ud;
+    lua_State *L = ctx->L;
+
+    for(long i = 0; i < n; i++) {
+        lua_pushvalue(L, -1);
+        lua_call(L, 0, 0);
+    }
+}
+
+static void bench_init(void *ud, long n) {
+    bench_ctx_t *ctx = ud;
+
+    for(long i = 0; i < n; i++) {
+        (void) pallene_tracer_init(ctx->L);
+        lua_pop(ctx->L, 1);
+    }
+}
+
+static void bench_newstate(void *ud, long n) {
+    (void) ud;
+
+    for(long i = 0; i < n; i++) {
+        lua_State *L = luaL_newstate();
+        lua_close(L);
+    }
+}
+
+static void bench_newstate_init(void *ud, long n) {
+    (void) ud;
+
+    for(long i = 0; i < n; i++) {
+        lua_State *L = luaL_newstate();
+        (void) pallene_tracer_init(L);
+        lua_close(L);
+    }
+}
+
+int main(void) {
+    bench_ctx_t ctx;
+    ctx.L = luaL_newstate();
+    ctx.fnstack = pallene_tracer_init(ctx.L);
+
+    bench_header("hot path");
+    bench_run("frameenter", bench_frameenter, &ctx, 10000000);
+    bench_run("frameexit", bench_frameexit, &ctx, 10000000);
+    bench_run("setline", bench_setline, &ctx, 10000000);
+
+    /* The finalizer object is still on the stack. */
+    lua_pushlightuserdata(ctx.L, ctx.fnstack);
+    lua_pushvalue(ctx.L, -2);
+    lua_pushcclosure(ctx.L, plain_fn, 2);
+    bench_run("lua_call (untraced)", bench_call, &ctx, 2000000);
+    lua_pop(ctx.L, 1);
+
+    lua_pushlightuserdata(ctx.L, ctx.fnstack);
+    lua_pushvalue(ctx.L, -2);
+    lua_pushcclosure(ctx.L, traced_fn, 2);
+    bench_run("lua_call (LUA_FRAMEENTER + finalizer)", bench_call, &ctx, 2000000);
+    lua_pop(ctx.L, 2);
+
+    bench_run("init (stack exists)", bench_init, &ctx, 2000000);
+    bench_run("luaL_newstate + lua_close", bench_newstate, NULL, 20000);
+    bench_run("luaL_newstate + init + lua_close", bench_newstate_init, NULL, 20000);
+
+    lua_close(ctx.L);
+    return 0;
+}
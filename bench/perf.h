@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Whole-program measurements of the Pallene Tracer benchmarks: instructions
+   retired and resident memory. Include instead of `bench/bench.h`, before
+   anything else. */
+
+#ifndef PT_BENCH_PERF_H
+#define PT_BENCH_PERF_H
+
+/* For `syscall`. */
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "bench/bench.h"
+
+#include <sys/resource.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // __linux__
+
+/* Starts counting the user space instructions of the calling thread. Returns
+   -1 where perf events are missing or not allowed. */
+static inline int bench_instructions_start(void) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    int fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if(fd < 0)
+        return -1;
+
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    return fd;
+#else
+    return -1;
+#endif // __linux__
+}
+
+/* Stops counting. Returns the instructions counted, or -1. */
+static inline long long bench_instructions_stop(int fd) {
+    long long count = -1;
+
+#ifdef __linux__
+    if(fd < 0)
+        return -1;
+
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if(read(fd, &count, sizeof(count)) != sizeof(count))
+        count = -1;
+    close(fd);
+#else
+    (void) fd;
+#endif // __linux__
+
+    return count;
+}
+
+/* Peak resident set size of the process so far, in KB. */
+static inline long bench_maxrss_kb(void) {
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif // __APPLE__
+}
+
+/* Resident set size of the process right now, in KB. Falls back to the peak
+   where it can not be read. */
+static inline long bench_rss_kb(void) {
+#ifdef __linux__
+    FILE *statm = fopen("/proc/self/statm", "r");
+    long pages = -1;
+    if(statm != NULL) {
+        if(fscanf(statm, "%*s %ld", &pages) != 1)
+            pages = -1;
+        fclose(statm);
+    }
+    if(pages >= 0)
+        return pages * (sysconf(_SC_PAGESIZE) / 1024);
+#endif // __linux__
+
+    return bench_maxrss_kb();
+}
+
+#endif // PT_BENCH_PERF_H
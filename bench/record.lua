@@ -0,0 +1,145 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Machine-readable benchmark results. When the `BENCH_JSON` environment
+-- variable names a file, every result is appended to it as a JSON object on a
+-- line of its own, tagged with `BENCH_COMMIT` and `BENCH_FLAGS`. `make bench`
+-- sets those two. bench/bench.h writes the same records for C benchmarks, and
+-- bench/compare.lua compares two such files.
+
+local record = {}
+
+-- The fields of a record, in the order they are written.
+record.fields = {
+    "suite", "name", "mode", "commit", "flags", "unit", "better",
+    "mean", "stddev", "min", "max", "runs",
+}
+
+local function encode(value)
+    if type(value) == "number" then
+        if math.type(value) == "integer" then
+            return string.format("%d", value)
+        end
+        return string.format("%.17g", value)
+    end
+    return '"' .. string.gsub(tostring(value), '[%c"\\]', function(c)
+        return string.format("\\u%04x", string.byte(c))
+    end) .. '"'
+end
+
+-- Appends `result` to the file named by `BENCH_JSON`, if any. Missing tags are
+-- taken from the environment. `better` is "lower" or "higher".
+function record.write(result)
+    local path = os.getenv("BENCH_JSON")
+    if not path or path == "" then
+        return
+    end
+
+    result.commit = result.commit or os.getenv("BENCH_COMMIT") or "unknown"
+    result.flags = result.flags or os.getenv("BENCH_FLAGS") or ""
+
+    local parts = {}
+    for _, field in ipairs(record.fields) do
+        if result[field] ~= nil then
+            table.insert(parts, encode(field) .. ":" .. encode(result[field]))
+        end
+    end
+
+    local file = assert(io.open(path, "a"))
+    file:write("{", table.concat(parts, ","), "}\n")
+    file:close()
+end
+
+-- Decodes one record: a flat JSON object of strings and numbers.
+local function decode(line)
+    local result = {}
+    local pos = string.find(line, "{", 1, true)
+    if not pos then
+        return nil
+    end
+    pos = pos + 1
+
+    local function skip()
+        pos = string.find(line, "[^%s]", pos) or #line + 1
+    end
+
+    local function string_at()
+        local out = {}
+        pos = pos + 1
+        while true do
+            local c = string.sub(line, pos, pos)
+            if c == '"' then
+                pos = pos + 1
+                return table.concat(out)
+            elseif c == "\\" then
+                local e = string.sub(line, pos + 1, pos + 1)
+                if e == "u" then
+                    table.insert(out, utf8.char(tonumber(string.sub(line, pos + 2, pos + 5), 16)))
+                    pos = pos + 6
+                else
+                    local escapes = { b = "\b", f = "\f", n = "\n", r = "\r", t = "\t" }
+                    table.insert(out, escapes[e] or e)
+                    pos = pos + 2
+                end
+            elseif c == "" then
+                error("unterminated string")
+            else
+                table.insert(out, c)
+                pos = pos + 1
+            end
+        end
+    end
+
+    skip()
+    while string.sub(line, pos, pos) ~= "}" do
+        if string.sub(line, pos, pos) ~= '"' then
+            error("expected a key at " .. pos)
+        end
+        local key = string_at()
+        skip()
+        if string.sub(line, pos, pos) ~= ":" then
+            error("expected ':' at " .. pos)
+        end
+        pos = pos + 1
+        skip()
+
+        if string.sub(line, pos, pos) == '"' then
+            result[key] = string_at()
+        else
+            local token = string.match(line, "^[^,}%s]+", pos)
+            if not token then
+                error("expected a value at " .. pos)
+            end
+            result[key] = math.tointeger(token) or tonumber(token)
+            pos = pos + #token
+        end
+
+        skip()
+        if string.sub(line, pos, pos) == "," then
+            pos = pos + 1
+            skip()
+        end
+    end
+    return result
+end
+
+-- Every record in the file at `path`.
+function record.read(path)
+    local results = {}
+    local n = 0
+    for line in io.lines(path) do
+        n = n + 1
+        if string.find(line, "%S") then
+            local ok, result = pcall(decode, line)
+            if not ok or not result then
+                error(string.format("%s:%d: bad record: %s", path, n, tostring(result)))
+            end
+            table.insert(results, result)
+        end
+    end
+    return results
+end
+
+return record
@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Plays a call trace, written with `PT_TRACE_FILE=file ./pt-lua`, back through
+   the tracer API with no application code: the same Pallene functions entered
+   from Lua and from each other in the same order, at the same lines, and the
+   same errors unwinding them. So the tracer can be measured against the calls
+   of a real program. Built twice by `make bench`, with and without `PT_DEBUG`,
+   and run on a trace of the synthetic benchmark. Usage:
+       bench/replay_debug <trace> [capacity=N] [trace=file]
+
+   `capacity` is the size of the call-stack, see `pallene_tracer_init_capacity()`.
+   Calls from Lua nest at most as deep as Lua lets C functions nest.
+   Other tracer modes are measured by building it with them, e.g.
+       make bench/replay_debug BENCH_CFLAGS="-O2 -DPT_CPUTIME" BENCH_LDLIBS="-llua -lm -lpthread"
+   With `PT_RECORDER`, the trace is also played with the flight recorder on, and
+   with a call trace of its own. `trace` writes the call trace of one play to a
+   file, which is the same as the one played but for the pid, and the exits of
+   the functions left running where it ends. Times are per event. */
+
+#include "bench/bench.h"
+
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include <errno.h>
+#include <lualib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = NULL
+#endif // PT_DEBUG
+
+/* How a Pallene function being played ended. */
+enum { REPLAY_EXIT, REPLAY_ERROR, REPLAY_END };
+
+/* An event of the trace. */
+typedef struct {
+    pt_trace_kind_t kind;      /* Never a name. */
+    int id;
+    int line;
+} replay_op_t;
+
+typedef struct {
+    replay_op_t *ops;
+    long n;
+    long pc;                   /* Next event to play. */
+    pt_fn_details_t *details;  /* Indexed by the descriptors of the trace. */
+    int descriptors;
+
+    /* What is in the trace. */
+    unsigned pid;
+    long calls;
+    long enters;
+    long errors;
+    int max_depth;
+} replay_t;
+
+/* ---- DECODING ---- */
+
+static void replay_fail(const char *path, const char *what) {
+    fprintf(stderr, "%s: %s\n", path, what);
+    exit(1);
+}
+
+static uint32_t replay_varint(const char *path, const unsigned char *data, size_t size, size_t *pos) {
+    uint32_t v = 0;
+    for(int shift = 0; shift < 35; shift += 7) {
+        if(*pos >= size)
+            replay_fail(path, "truncated");
+        unsigned char b = data[(*pos)++];
+        v |= (uint32_t) (b & 0x7f) << shift;
+        if(b < 0x80)
+            return v;
+    }
+    replay_fail(path, "bad varint");
+    return 0;
+}
+
+static int replay_zigzag(uint32_t v) {
+    return (int) (v >> 1) ^ -(int) (v & 1);
+}
+
+/* Reads the trace at `path`. Names point into the file data, which stays. */
+static void replay_load(replay_t *r, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if(f == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    size_t size = 0, room = 1 << 16;
+    unsigned char *data = malloc(room);
+    size_t got;
+    while(data != NULL && (got = fread(data + size, 1, room - size, f)) > 0) {
+        size += got;
+        if(size == room)
+            data = realloc(data, room *= 2);
+    }
+    fclose(f);
+    if(data == NULL)
+        replay_fail(path, strerror(ENOMEM));
+    if(size < 8 || memcmp(data, "PTTRACE", 7) != 0)
+        replay_fail(path, "not a call trace file");
+    if(data[7] != 1)
+        replay_fail(path, "unknown version, only 1 is known");
+
+    size_t pos = 8;
+    memset(r, 0, sizeof(replay_t));
+    r->pid = replay_varint(path, data, size, &pos);
+
+    /* Names of the descriptors, in the data. */
+    const char **names = NULL;
+    long ops_room = 0;
+    int id = 0, line = 0, depth = 0;
+
+    while(pos < size) {
+        uint32_t tag = replay_varint(path, data, size, &pos);
+        pt_trace_kind_t kind = (pt_trace_kind_t) (tag & 7);
+        id += replay_zigzag(tag >> 3);
+        if(id < 0 || id >= (1 << 20) || kind > PALLENE_TRACER_TRACE_NAME)
+            replay_fail(path, "bad event");
+
+        if(id >= r->descriptors) {
+            int grown = r->descriptors > 0 ? r->descriptors : 64;
+            while(grown <= id)
+                grown *= 2;
+            names = realloc(names, grown * sizeof(const char *));
+            if(names == NULL)
+                replay_fail(path, strerror(ENOMEM));
+            for(int i = r->descriptors; i < grown; i++)
+                names[i] = NULL;
+            r->descriptors = grown;
+        }
+
+        if(kind == PALLENE_TRACER_TRACE_NAME) {
+            const unsigned char *end = memchr(data + pos, '\0', size - pos);
+            const unsigned char *file = end != NULL ? end + 1 : NULL;
+            if(file == NULL || (end = memchr(file, '\0', size - (file - data))) == NULL)
+                replay_fail(path, "truncated");
+            names[id] = (const char *) data + pos;
+            pos = end + 1 - data;
+            continue;
+        }
+
+        if(kind != PALLENE_TRACER_TRACE_CALL)
+            line += replay_zigzag(replay_varint(path, data, size, &pos));
+
+        if(r->n == ops_room) {
+            ops_room = ops_room > 0 ? ops_room * 2 : 4096;
+            r->ops = realloc(r->ops, ops_room * sizeof(replay_op_t));
+            if(r->ops == NULL)
+                replay_fail(path, strerror(ENOMEM));
+        }
+        r->ops[r->n++] = (replay_op_t) { kind, id, line };
+
+        if(kind == PALLENE_TRACER_TRACE_CALL)
+            r->calls++;
+        else if(kind == PALLENE_TRACER_TRACE_ENTER)
+            r->enters++;
+        else if(kind == PALLENE_TRACER_TRACE_ERROR)
+            r->errors++;
+        if(kind == PALLENE_TRACER_TRACE_CALL || kind == PALLENE_TRACER_TRACE_ENTER)
+            depth++;
+        else if(depth > 0)
+            depth--;
+        if(depth > r->max_depth)
+            r->max_depth = depth;
+    }
+
+    /* The details outlive the calls, as the counters need. */
+    r->details = malloc((r->descriptors > 0 ? r->descriptors : 1) * sizeof(pt_fn_details_t));
+    if(r->details == NULL)
+        replay_fail(path, strerror(ENOMEM));
+    for(int i = 0; i < r->descriptors; i++) {
+        pt_fn_details_t details = PALLENE_TRACER_FN_DETAILS(
+            names[i] != NULL ? names[i] : "<?>", names[i] != NULL ? names[i] + strlen(names[i]) + 1 : "?");
+        memcpy(&r->details[i], &details, sizeof(pt_fn_details_t));
+    }
+    free(names);
+}
+
+/* ---- PLAYING ---- */
+
+/* Plays the trace from `r->pc` on, for the Pallene function entered last.
+   `depth` is how many of them the Lua call being played has entered, 0 if
+   none. Returns how the function ended: an exit, an error going through it or
+   the end of the trace. `self` is where the Lua interface function is. */
+static int replay_run(replay_t *r, lua_State *L, pt_fnstack_t *fnstack, int self, int depth) {
+    (void) fnstack;
+
+    while(r->pc < r->n) {
+        const replay_op_t *op = &r->ops[r->pc++];
+
+        if(op->kind == PALLENE_TRACER_TRACE_CALL) {
+            lua_pushvalue(L, self);
+            if(lua_pcall(L, 0, 0, 0) != LUA_OK)
+                lua_pop(L, 1);
+        } else if(op->kind == PALLENE_TRACER_TRACE_ENTER) {
+            PALLENE_TRACER_SETLINE(fnstack, op->line);
+#ifdef PT_DEBUG
+            int base = fnstack->count;
+#endif // PT_DEBUG
+            pt_frame_t frame = PALLENE_TRACER_C_FRAME(r->details[op->id]);
+            PALLENE_TRACER_FRAMEENTER(fnstack, &frame);
+            (void) frame;
+
+            int end = replay_run(r, L, fnstack, self, depth + 1);
+            if(end == REPLAY_END) {
+                PALLENE_TRACER_FRAMEEXIT(fnstack);
+                return REPLAY_END;
+            }
+
+            /* The error goes on through us, at the line we called from. The
+               finalizer removes the frames. Outside of a Lua call nothing
+               would, so we do. */
+            if(end == REPLAY_ERROR) {
+                if(depth > 0 && r->pc < r->n && r->ops[r->pc].kind == PALLENE_TRACER_TRACE_ERROR) {
+                    r->pc++;
+                    return REPLAY_ERROR;
+                }
+#ifdef PT_DEBUG
+                fnstack->count = base;
+#endif // PT_DEBUG
+            }
+
+        /* Functions entered before the trace started are not played. */
+        } else if(depth > 0) {
+            PALLENE_TRACER_SETLINE(fnstack, op->line);
+            if(op->kind == PALLENE_TRACER_TRACE_ERROR)
+                return REPLAY_ERROR;
+            PALLENE_TRACER_FRAMEEXIT(fnstack);
+            return REPLAY_EXIT;
+        }
+    }
+
+    return REPLAY_END;
+}
+
+/* The Lua interface function of whatever Pallene function the last event
+   called, as generated by Pallene. Errors unwind through the finalizer. */
+static int replay_call(lua_State *L) {
+    MODULE_GET_FNSTACK;
+    replay_t *r = lua_touserdata(L, lua_upvalueindex(3));
+    const replay_op_t *op = &r->ops[r->pc - 1];
+
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, replay_call, lua_upvalueindex(2), _frame_lua);
+    pt_frame_t frame = PALLENE_TRACER_C_FRAME(r->details[op->id]);
+    PALLENE_TRACER_FRAMEENTER(fnstack, &frame);
+    (void) frame;
+
+    int end = replay_run(r, L, fnstack, lua_upvalueindex(4), 1);
+    if(end == REPLAY_ERROR) {
+        lua_pushboolean(L, 0);
+        return lua_error(L);
+    }
+    if(end == REPLAY_END) {
+        PALLENE_TRACER_FRAMEEXIT(fnstack);
+    }
+    return 0;
+}
+
+typedef struct {
+    replay_t *r;
+    lua_State *L;
+    pt_fnstack_t *fnstack;
+    int self;
+} bench_ctx_t;
+
+static void bench_replay(void *ud, long n) {
+    bench_ctx_t *ctx = ud;
+    (void) n;
+
+    ctx->r->pc = 0;
+    replay_run(ctx->r, ctx->L, ctx->fnstack, ctx->self, 0);
+}
+
+int main(int argc, char **argv) {
+    const char *path = NULL;
+    const char *retrace = NULL;
+    int capacity = PALLENE_TRACER_MAX_CALLSTACK;
+    for(int i = 1; i < argc; i++) {
+        if(strncmp(argv[i], "capacity=", 9) == 0) {
+            char *end;
+            long v = strtol(argv[i] + 9, &end, 10);
+            if(*end != '\0' || v < 1 || v > 1 << 30) {
+                path = NULL;
+                break;
+            }
+            capacity = (int) v;
+        } else if(strncmp(argv[i], "trace=", 6) == 0) {
+            retrace = argv[i] + 6;
+        } else if(path == NULL) {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if(path == NULL) {
+        fprintf(stderr, "usage: %s <trace> [capacity=N] [trace=file]\n", argv[0]);
+        return 2;
+    }
+
+    replay_t r;
+    replay_load(&r, path);
+    if(r.n == 0)
+        replay_fail(path, "no events");
+
+    bench_ctx_t ctx;
+    ctx.r = &r;
+    ctx.L = luaL_newstate();
+    ctx.fnstack = pallene_tracer_init_capacity(ctx.L, capacity);
+
+    /* The Lua interface function refers to itself, to call it again. */
+    lua_pushlightuserdata(ctx.L, ctx.fnstack);
+    lua_pushvalue(ctx.L, -2);
+    lua_pushlightuserdata(ctx.L, &r);
+    lua_pushnil(ctx.L);
+    lua_pushcclosure(ctx.L, replay_call, 4);
+    lua_pushvalue(ctx.L, -1);
+    lua_setupvalue(ctx.L, -2, 4);
+    ctx.self = lua_gettop(ctx.L);
+
+    printf("# %s: pid %u, %ld events, %ld calls from Lua, %ld from Pallene, %ld errors, depth %d\n",
+        path, r.pid, r.n, r.calls, r.enters, r.errors, r.max_depth);
+
+#ifdef PT_RECORDER
+    if(retrace != NULL) {
+        int error = pallene_tracer_trace_open(ctx.fnstack, retrace, 0);
+        if(error != 0)
+            replay_fail(retrace, strerror(error));
+        bench_replay(&ctx, r.n);
+        pallene_tracer_trace_close(ctx.fnstack);
+    }
+#else
+    if(retrace != NULL)
+        replay_fail(retrace, "needs PT_RECORDER");
+#endif // PT_RECORDER
+
+    char suite[256];
+    snprintf(suite, sizeof(suite), "replay %s", path);
+    bench_header(suite);
+    bench_run("replay", bench_replay, &ctx, r.n);
+
+#ifdef PT_RECORDER
+    int error = pallene_tracer_trace_open(ctx.fnstack, "/dev/null", 0);
+    if(error != 0)
+        replay_fail("/dev/null", strerror(error));
+    bench_run("replay + call trace", bench_replay, &ctx, r.n);
+    pallene_tracer_trace_close(ctx.fnstack);
+
+    /* The flight recorder keeps its mapping, not the file. */
+    char ring[] = "/tmp/pt-replay-XXXXXX";
+    int fd = mkstemp(ring);
+    if(fd < 0)
+        replay_fail(ring, strerror(errno));
+    close(fd);
+    error = pallene_tracer_recorder_open(ctx.fnstack, ring, 4096);
+    unlink(ring);
+    if(error != 0)
+        replay_fail(ring, strerror(error));
+    bench_run("replay + flight recorder", bench_replay, &ctx, r.n);
+#endif // PT_RECORDER
+
+    lua_close(ctx.L);
+    free(r.ops);
+    free(r.details);
+    return 0;
+}
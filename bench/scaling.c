@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Scaling of Pallene Tracer over OS threads, each with its own traced Lua state:
+   throughput of a Fibonacci and error workload from 1 thread to one per core,
+   memory per state and states created and destroyed per second. Built twice by
+   `make bench`, with and without `PT_DEBUG`. */
+
+#include "bench/perf.h"
+
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include <lualib.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Threads go up in powers of two until one per core, at most this many. */
+#define MAX_THREADS 64
+
+/* States kept alive at once when measuring memory. */
+#define MEMORY_STATES 200
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame)
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_SETLINE()                                       \
+    PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_FRAMEEXIT(fnstack)
+
+/* ---- WORKLOAD ---- */
+
+/* As in examples/fibonacci. */
+static lua_Integer fib(lua_State *L, lua_Integer n) {
+    MODULE_C_FRAMEENTER();
+
+    if(n <= 1) {
+        MODULE_C_FRAMEEXIT();
+        return n;
+    }
+
+    MODULE_C_SETLINE();
+    lua_Integer result = fib(L, n - 1) + fib(L, n - 2);
+    MODULE_C_FRAMEEXIT();
+    return result;
+}
+
+static int fib_lua(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(fib_lua);
+
+    lua_pushinteger(L, fib(L, luaL_checkinteger(L, 1)));
+    return 1;
+}
+
+/* Raises an error `depth` C interface frames deep. */
+static void fail(lua_State *L, lua_Integer depth) {
+    MODULE_C_FRAMEENTER();
+
+    MODULE_C_SETLINE();
+    if(depth > 0)
+        fail(L, depth - 1);
+    else
+        luaL_error(L, "failed");
+
+    MODULE_C_FRAMEEXIT();
+}
+
+static int fail_lua(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(fail_lua);
+
+    fail(L, luaL_checkinteger(L, 1));
+    return 0;
+}
+
+/* workload(n, fibn, faildepth): `n` operations, each a Fibonacci number and an
+   error caught by `pcall`. */
+static const char *WORKLOAD =
+    "local fib, fail = ...\n"
+    "return function(n, fibn, faildepth)\n"
+    "    for _ = 1, n do\n"
+    "        fib(fibn)\n"
+    "        pcall(fail, faildepth)\n"
+    "    end\n"
+    "end\n";
+
+/* A traced state with the workload function on top of its stack. */
+static lua_State *new_worker_state(void) {
+    lua_State *L = luaL_newstate();
+    luaL_openlibs(L);
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    if(luaL_loadstring(L, WORKLOAD) != LUA_OK) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, fib_lua, 2);
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -4);
+    lua_pushcclosure(L, fail_lua, 2);
+
+    lua_call(L, 2, 1);
+    return L;
+}
+
+static void run_workload(lua_State *L, long n, int fibn, int faildepth) {
+    lua_pushvalue(L, -1);
+    lua_pushinteger(L, n);
+    lua_pushinteger(L, fibn);
+    lua_pushinteger(L, faildepth);
+    lua_call(L, 3, 0);
+}
+
+/* ---- THREADS ---- */
+
+typedef struct {
+    pthread_t thread;
+    pthread_barrier_t *barrier;
+    long n;
+    int churn;          /* Create and destroy states instead. */
+    double elapsed;
+} worker_t;
+
+static void *worker_main(void *ud) {
+    worker_t *worker = ud;
+    lua_State *L = worker->churn ? NULL : new_worker_state();
+
+    pthread_barrier_wait(worker->barrier);
+    double start = bench_now();
+    if(worker->churn) {
+        for(long i = 0; i < worker->n; i++)
+            lua_close(new_worker_state());
+    } else {
+        run_workload(L, worker->n, 15, 8);
+    }
+    worker->elapsed = bench_now() - start;
+
+    if(L != NULL)
+        lua_close(L);
+    return NULL;
+}
+
+/* Operations per second of `threads` workers doing `n` operations each. The
+   slowest thread decides. */
+static double run_threads(int threads, long n, int churn) {
+    worker_t workers[MAX_THREADS];
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, threads);
+
+    for(int i = 0; i < threads; i++) {
+        workers[i].barrier = &barrier;
+        workers[i].n = n;
+        workers[i].churn = churn;
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+
+    double slowest = 0.0;
+    for(int i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if(workers[i].elapsed > slowest)
+            slowest = workers[i].elapsed;
+    }
+
+    pthread_barrier_destroy(&barrier);
+    return (double) threads * (double) n / slowest * 1e9;
+}
+
+static void report_scaling(const char *suite, long n, int churn) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cores < 1)
+        cores = 1;
+
+    printf("# %s (%s, %d runs, %ld cores)\n", suite, BENCH_MODE, BENCH_RUNS, cores);
+    printf("%-8s %14s %12s %9s %11s\n", "threads", "ops/s", "stddev", "speedup", "efficiency");
+
+    double single = 0.0;
+    for(int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        if(threads > cores && threads > 1)
+            break;
+
+        double samples[BENCH_RUNS];
+        (void) run_threads(threads, n, churn);
+        for(int i = 0; i < BENCH_RUNS; i++)
+            samples[i] = run_threads(threads, n, churn);
+
+        bench_stats_t stats = bench_stats(samples, BENCH_RUNS);
+        if(threads == 1)
+            single = stats.mean;
+        printf("%-8d %14.0f %12.0f %8.2fx %10.1f%%\n", threads, stats.mean, stats.stddev,
+            stats.mean / single, stats.mean / single / threads * 100);
+        fflush(stdout);
+
+        char name[32];
+        snprintf(name, sizeof(name), "threads=%d", threads);
+        bench_record(suite, name, "ops/s", "higher", stats);
+    }
+}
+
+/* ---- MEMORY ---- */
+
+/* Resident memory per state of `MEMORY_STATES` states alive at once, after
+   they reached a Pallene stack `depth` frames deep. Only the pages of the frame
+   buffer that were written to are resident. */
+static void measure_memory(int depth, size_t buffer) {
+    static lua_State *states[MEMORY_STATES];
+
+    long before = bench_rss_kb();
+    size_t heap = 0;
+    for(int i = 0; i < MEMORY_STATES; i++) {
+        states[i] = new_worker_state();
+        run_workload(states[i], 1, 10, depth);
+        heap += (size_t) lua_gc(states[i], LUA_GCCOUNT) * 1024
+            + (size_t) lua_gc(states[i], LUA_GCCOUNTB);
+    }
+    long after = bench_rss_kb();
+
+    for(int i = 0; i < MEMORY_STATES; i++)
+        lua_close(states[i]);
+
+    double resident = (double) (after - before) / MEMORY_STATES;
+    printf("%-8d %11.1f KB %11.1f KB %11.1f KB\n", depth, buffer / 1024.0,
+        heap / 1024.0 / MEMORY_STATES, resident);
+    fflush(stdout);
+
+    /* A single measurement, without a spread. */
+    char name[32];
+    snprintf(name, sizeof(name), "depth=%d resident", depth);
+    bench_stats_t stats = bench_stats(&resident, 1);
+    bench_record("memory per state", name, "KB", "lower", stats);
+}
+
+static void report_memory(void) {
+    printf("# memory per state (%s, %d states)\n", BENCH_MODE, MEMORY_STATES);
+    printf("%-8s %14s %14s %14s\n", "depth", "frame buffer", "Lua heap", "resident");
+
+    lua_State *L = new_worker_state();
+    size_t buffer = 0;
+#ifdef PT_DEBUG
+    lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY);
+    pt_fnstack_t *fnstack = lua_touserdata(L, -1);
+    buffer = (size_t) fnstack->capacity * sizeof(pt_frame_t);
+    lua_pop(L, 1);
+#endif // PT_DEBUG
+    lua_close(L);
+
+    /* Every depth in a child of its own, so that none reuses the memory freed
+       by another one. */
+    int depths[] = { 16, 1000, 10000 };
+    fflush(stdout);
+    for(size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+        pid_t pid = fork();
+        if(pid == 0) {
+            measure_memory(depths[d], buffer);
+            _exit(0);
+        }
+        if(pid > 0)
+            waitpid(pid, NULL, 0);
+    }
+}
+
+int main(void) {
+    report_scaling("fibonacci + pcall throughput", 2000, 0);
+    report_scaling("state create + destroy", 500, 1);
+    report_memory();
+    return 0;
+}
@@ -0,0 +1,345 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Generates traced C modules shaped like Pallene output, and a Lua driver
+-- script running them. Usage:
+--     lua bench/synthetic/gen.lua out=<dir> [option=value...]
+--
+-- The call-graph is a chain of levels. Every level is a function doing some
+-- arithmetic and calling the next level `fanout` times, and the last one goes
+-- `recursion` calls deep into a self-recursive function. Levels are dealt to
+-- the modules in turn. A level calls the next one directly when both live in
+-- the same module, like Pallene code calling Pallene code. Otherwise it calls
+-- through Lua, like the `multimod` spec, and so does every `callbacks`-th level
+-- through a Lua function, like the `dispatch` spec.
+
+local gen = {}
+
+gen.defaults = {
+    depth = 8,          -- levels in the call-graph
+    fanout = 2,         -- calls from a level to the next one
+    recursion = 16,     -- depth of the recursive function under the last level
+    callbacks = 0,      -- every n-th level calls the next one via Lua, 0 for never
+    modules = 1,        -- C modules the levels are dealt to
+    work = 10,          -- arithmetic loop iterations in every function
+    iterations = 2000,  -- calls from the driver into the first level
+}
+
+-- Parses `option=value` arguments over the defaults.
+function gen.options(args, defaults)
+    local options = {}
+    for k, v in pairs(defaults) do
+        options[k] = v
+    end
+    for _, arg in ipairs(args) do
+        local k, v = string.match(arg, "^([%w_]+)=(.*)$")
+        if not k or options[k] == nil then
+            error("bad option: " .. arg)
+        end
+        if type(options[k]) == "number" then
+            v = math.tointeger(tonumber(v))
+            if not v or v < 0 then
+                error("bad value: " .. arg)
+            end
+        end
+        options[k] = v
+    end
+    return options
+end
+
+local function module_of(options, level)
+    return (level - 1) % options.modules + 1
+end
+
+-- Whether the call from `level` into the next one goes through Lua.
+local function indirect(options, level)
+    return module_of(options, level) ~= module_of(options, level + 1)
+        or (options.callbacks > 0 and level % options.callbacks == 0)
+end
+
+local HEADER = [[
+/* Generated by bench/synthetic/gen.lua, do not edit. */
+/* %s */
+
+#include "bench/perf.h"
+
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame)
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_SETLINE()                                       \
+    PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_FRAMEEXIT(fnstack)
+
+/* The functions linked by the driver, by level. */
+#define MODULE_LINKED    lua_upvalueindex(3)
+
+/* Calls the function linked for `level` from Lua. */
+static lua_Integer call_linked(lua_State *L, int level, lua_Integer x) {
+    lua_rawgeti(L, MODULE_LINKED, level);
+    lua_pushinteger(L, x);
+    lua_call(L, 1, 1);
+    x = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return x;
+}
+]]
+
+local RECURSIVE = [[
+
+lua_Integer rec(lua_State *L, lua_Integer n, lua_Integer x) {
+    MODULE_C_FRAMEENTER();
+
+    for(int i = 0; i < %d; i++)
+        x = x * 31 + i;
+    if(n > 0) {
+        MODULE_C_SETLINE();
+        x = rec(L, n - 1, x);
+    }
+
+    MODULE_C_FRAMEEXIT();
+    return x;
+}
+]]
+
+local LEVEL = [[
+
+lua_Integer lvl_%d(lua_State *L, lua_Integer x) {
+    MODULE_C_FRAMEENTER();
+
+    for(int i = 0; i < %d; i++)
+        x = x * 31 + i;
+    for(int i = 0; i < %d; i++) {
+        MODULE_C_SETLINE();
+        x += %s;
+    }
+
+    MODULE_C_FRAMEEXIT();
+    return x;
+}
+
+int lvl_%d_lua(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(lvl_%d_lua);
+
+    lua_Integer x = luaL_checkinteger(L, 1);
+
+    /* Dispatch. */
+    lua_pushinteger(L, lvl_%d(L, x));
+    return 1;
+}
+]]
+
+local FOOTER = [[
+
+/* link(level, fn) */
+static int link_fn(lua_State *L) {
+    lua_Integer level = luaL_checkinteger(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    lua_settop(L, 2);
+    lua_rawseti(L, lua_upvalueindex(1), level);
+    return 0;
+}
+
+/* measure(fn) -> wall ns, instructions, peak RSS KB */
+/* Instructions are -1 where they can not be counted. */
+static int measure_fn(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+
+    int fd = bench_instructions_start();
+    double start = bench_now();
+    lua_call(L, 0, 0);
+    double wall = bench_now() - start;
+    long long instructions = bench_instructions_stop(fd);
+
+    lua_pushinteger(L, (lua_Integer) wall);
+    lua_pushinteger(L, (lua_Integer) instructions);
+    lua_pushinteger(L, (lua_Integer) bench_maxrss_kb());
+    return 3;
+}
+
+int luaopen_synth_%d(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    /* The linked functions. */
+    lua_newtable(L);
+
+    lua_newtable(L);
+]]
+
+local REGISTER = [[
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -4);
+    lua_pushvalue(L, -4);
+    lua_pushcclosure(L, lvl_%d_lua, 3);
+    lua_setfield(L, -2, "lvl_%d");
+]]
+
+local RETURN = [[
+
+    lua_pushvalue(L, -2);
+    lua_pushcclosure(L, link_fn, 1);
+    lua_setfield(L, -2, "link");
+
+    lua_pushcfunction(L, measure_fn);
+    lua_setfield(L, -2, "measure");
+
+    return 1;
+}
+]]
+
+local function describe(options)
+    local keys = {}
+    for k in pairs(gen.defaults) do
+        table.insert(keys, k)
+    end
+    table.sort(keys)
+
+    local parts = {}
+    for _, k in ipairs(keys) do
+        table.insert(parts, k .. "=" .. tostring(options[k]))
+    end
+    return table.concat(parts, " ")
+end
+
+-- The C source of module `m`.
+function gen.module(options, m)
+    local out = { string.format(HEADER, describe(options)), "\n" }
+
+    if module_of(options, options.depth) == m then
+        table.insert(out, "lua_Integer rec(lua_State *L, lua_Integer n, lua_Integer x);\n")
+    end
+    for level = 1, options.depth do
+        if module_of(options, level) == m then
+            table.insert(out, string.format("lua_Integer lvl_%d(lua_State *L, lua_Integer x);\n", level))
+        end
+    end
+
+    if module_of(options, options.depth) == m then
+        table.insert(out, string.format(RECURSIVE, options.work))
+    end
+
+    for level = 1, options.depth do
+        if module_of(options, level) == m then
+            local call
+            if level == options.depth then
+                call = string.format("rec(L, %d, x)", options.recursion)
+            elseif indirect(options, level) then
+                call = string.format("call_linked(L, %d, x)", level + 1)
+            else
+                call = string.format("lvl_%d(L, x)", level + 1)
+            end
+
+            local fanout = level == options.depth and 1 or options.fanout
+            table.insert(out, string.format(LEVEL,
+                level, options.work, fanout, call, level, level, level))
+        end
+    end
+
+    table.insert(out, string.format(FOOTER, m))
+    for level = 1, options.depth do
+        if module_of(options, level) == m then
+            table.insert(out, string.format(REGISTER, level, level))
+        end
+    end
+    table.insert(out, RETURN)
+
+    return table.concat(out)
+end
+
+-- The Lua driver, expecting the modules next to it.
+function gen.driver(options)
+    local out = {
+        "-- Generated by bench/synthetic/gen.lua, do not edit.\n",
+        "-- " .. describe(options) .. "\n\n",
+        'local dir = string.match(arg[0], "^(.*)/[^/]*$") or "."\n',
+        'package.cpath = dir .. "/?.so;" .. package.cpath\n\n',
+        "local modules = {\n",
+    }
+    for m = 1, options.modules do
+        table.insert(out, string.format('    require "synth_%d",\n', m))
+    end
+    table.insert(out, "}\n\n")
+
+    for level = 1, options.depth - 1 do
+        if indirect(options, level) then
+            local from, to = module_of(options, level), module_of(options, level + 1)
+            local target = string.format("modules[%d].lvl_%d", to, level + 1)
+            if from == to then
+                -- A callback: a Lua function calling back into the module.
+                target = string.format("function(x) return %s(x) end", target)
+            end
+            table.insert(out, string.format("modules[%d].link(%d, %s)\n", from, level + 1, target))
+        end
+    end
+
+    table.insert(out, string.format([[
+
+local entry = modules[1].lvl_1
+local checksum = 0
+local wall, instructions, rss = modules[1].measure(function()
+    for i = 1, %d do
+        checksum = checksum + entry(i)
+    end
+end)
+
+print(wall, instructions, rss, checksum)
+]], options.iterations))
+
+    return table.concat(out)
+end
+
+local function write(path, contents)
+    local file = assert(io.open(path, "w"))
+    file:write(contents)
+    file:close()
+end
+
+-- Writes `synth_<m>.c` and `driver.lua` in directory `out`.
+function gen.generate(options, out)
+    assert(options.depth >= 1 and options.modules >= 1 and options.fanout >= 1,
+        "depth, modules and fanout must be positive")
+
+    for m = 1, options.modules do
+        write(string.format("%s/synth_%d.c", out, m), gen.module(options, m))
+    end
+    write(out .. "/driver.lua", gen.driver(options))
+end
+
+if arg and arg[0] and string.match(arg[0], "gen%.lua$") then
+    local defaults = { out = "" }
+    for k, v in pairs(gen.defaults) do
+        defaults[k] = v
+    end
+
+    local options = gen.options(arg, defaults)
+    if options.out == "" then
+        io.stderr:write("usage: lua bench/synthetic/gen.lua out=<dir> [option=value...]\n")
+        os.exit(1)
+    end
+    gen.generate(options, options.out)
+end
+
+return gen
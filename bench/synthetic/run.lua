@@ -0,0 +1,145 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Builds the modules of bench/synthetic/gen.lua in every tracer mode, runs
+-- their driver and compares wall time, instructions and peak RSS. Run from the
+-- repository root, `make bench` does it as
+--     ./pt-lua bench/synthetic/run.lua lua=... cc=... cppflags=... ldflags=...
+-- Any option of the generator may be given as well, e.g. `depth=12 modules=3`.
+-- With `trace=file`, the driver is also run once with its modules built with
+-- `PT_RECORDER`, writing the first `trace_limit` bytes of its call trace to the
+-- file, for bench/replay.c to play back.
+
+local gen = dofile("bench/synthetic/gen.lua")
+local record = require "bench.record"
+
+local defaults = {
+    runs = 5,
+    build = "bench/synthetic/build",
+    lua = "lua",
+    ptlua = "./pt-lua",
+    cc = "cc",
+    cflags = "-O2 -std=c99",
+    cppflags = "-I/usr/include -I.",
+    ldflags = "",
+    trace = "",
+    trace_limit = 4000000,
+}
+for k, v in pairs(gen.defaults) do
+    defaults[k] = v
+end
+
+local options = gen.options(arg, defaults)
+
+-- `interp` is the interpreter running the driver, `cflags` how the modules are
+-- compiled on top of the common flags.
+local modes = {
+    { name = "release",    interp = options.lua,   cflags = "" },
+    { name = "PT_DEBUG",   interp = options.lua,   cflags = "-DPT_DEBUG" },
+    { name = "pt-lua",     interp = options.ptlua, cflags = "-DPT_DEBUG" },
+    { name = "pt-lua+cpu", interp = options.ptlua, cflags = "-DPT_DEBUG -DPT_CPUTIME -pthread" },
+}
+
+local function run(command)
+    if not os.execute(command) then
+        error("failed: " .. command)
+    end
+end
+
+local function build(mode)
+    local dir = options.build .. "/" .. mode.name
+    run("mkdir -p '" .. dir .. "'")
+    gen.generate(options, dir)
+
+    for m = 1, options.modules do
+        local src = string.format("%s/synth_%d.c", dir, m)
+        run(string.format("%s %s %s %s -fPIC -shared %s -o %s/synth_%d.so %s",
+            options.cc, options.cflags, mode.cflags, options.cppflags, src, dir, m,
+            options.ldflags))
+    end
+    return dir .. "/driver.lua"
+end
+
+-- One run of the driver: wall ns, instructions, peak RSS KB, checksum.
+local function measure(mode, driver)
+    local path = os.tmpname()
+    os.execute(mode.interp .. " " .. driver .. " > " .. path .. " 2>&1")
+    local file = assert(io.open(path))
+    local output = file:read("a")
+    file:close()
+    os.remove(path)
+
+    local wall, instructions, rss, checksum = string.match(output,
+        "^(%-?%d+)\t(%-?%d+)\t(%-?%d+)\t(%-?%d+)")
+    if not wall then
+        error(mode.name .. " driver failed: " .. output)
+    end
+    return tonumber(wall), tonumber(instructions), tonumber(rss), checksum
+end
+
+local function stats(samples)
+    local sum, sq = 0, 0
+    for _, s in ipairs(samples) do
+        sum = sum + s
+    end
+    local mean = sum / #samples
+    for _, s in ipairs(samples) do
+        sq = sq + (s - mean) ^ 2
+    end
+    return mean, #samples > 1 and math.sqrt(sq / (#samples - 1)) or 0
+end
+
+local suite = string.format("synthetic depth=%d fanout=%d recursion=%d callbacks=%d modules=%d work=%d iterations=%d",
+    options.depth, options.fanout, options.recursion, options.callbacks,
+    options.modules, options.work, options.iterations)
+
+print(string.format("# %s (%d runs)", suite, options.runs))
+print(string.format("%-12s %12s %10s %9s %16s %9s %10s",
+    "mode", "wall ms", "stddev", "overhead", "instructions", "overhead", "peak KB"))
+
+local base_wall, base_instructions, base_checksum
+for _, mode in ipairs(modes) do
+    local driver = build(mode)
+
+    local walls = {}
+    local instructions, rss, checksum
+    for i = 1, options.runs do
+        local wall
+        wall, instructions, rss, checksum = measure(mode, driver)
+        walls[i] = wall
+    end
+    assert(base_checksum == nil or checksum == base_checksum,
+        mode.name .. " computed something else")
+
+    local wall, stddev = stats(walls)
+    base_wall = base_wall or wall
+    base_instructions = base_instructions or instructions
+    base_checksum = base_checksum or checksum
+
+    local counted = instructions >= 0 and base_instructions >= 0
+    print(string.format("%-12s %12.2f %10.2f %8.1f%% %16s %9s %10d",
+        mode.name, wall / 1e6, stddev / 1e6, (wall / base_wall - 1) * 100,
+        counted and string.format("%d", instructions) or "n/a",
+        counted and string.format("%.1f%%", (instructions / base_instructions - 1) * 100) or "n/a",
+        rss))
+    io.stdout:flush()
+
+    local flags = options.cflags .. " " .. mode.cflags
+    record.write({ suite = suite, name = "wall", mode = mode.name, flags = flags,
+        unit = "ns", better = "lower", mean = wall, stddev = stddev, runs = options.runs })
+    if instructions >= 0 then
+        record.write({ suite = suite, name = "instructions", mode = mode.name, flags = flags,
+            unit = "instructions", better = "lower", mean = instructions, stddev = 0, runs = 1 })
+    end
+    record.write({ suite = suite, name = "peak RSS", mode = mode.name, flags = flags,
+        unit = "KB", better = "lower", mean = rss, stddev = 0, runs = 1 })
+end
+
+if options.trace ~= "" then
+    local driver = build({ name = "pt-lua+trace", interp = options.ptlua,
+        cflags = "-DPT_DEBUG -DPT_RECORDER -pthread" })
+    run(string.format("PT_TRACE_FILE='%s' PT_TRACE_LIMIT=%d %s %s > /dev/null",
+        options.trace, options.trace_limit, options.ptlua, driver))
+end
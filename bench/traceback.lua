@@ -0,0 +1,97 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Latency and memory of the `pt-lua` traceback across stack depths, kinds of
+-- frames and sizes of the global table. Run by `make bench` as
+--     PT_STACK_CAPACITY=200000 ./pt-lua bench/traceback.lua
+
+local module = require "bench.traceback_module"
+local record = require "bench.record"
+
+local RUNS = 10
+
+-- Lua functions nested `depth` levels deep. Not tail calls, on purpose.
+local function lua_levels(depth, fn)
+    if depth == 0 then
+        fn()
+    else
+        lua_levels(depth - 1, fn)
+    end
+end
+
+-- Every level is a Lua function calling a C function calling the next one.
+local function alternate(cfn, depth, fn)
+    if depth == 0 then
+        fn()
+    else
+        cfn(function() alternate(cfn, depth - 1, fn) end)
+    end
+end
+
+-- Depths mixing in C functions stop well before LUAI_MAXCCALLS (200). Lua only
+-- stacks stop at 10000, as `lua_getstack` walks the stack from the top for every
+-- level and the traceback becomes quadratic in the number of Lua frames.
+local shapes = {
+    { name = "pallene", depths = { 10, 100, 1000, 10000, 100000 },
+      build = function(depth, fn) module.pallene_fn(depth, fn) end },
+    { name = "lua", depths = { 10, 100, 1000, 10000 },
+      build = function(depth, fn) lua_levels(depth, function() module.pallene_fn(1, fn) end) end },
+    { name = "lua+pallene", depths = { 10, 50, 150 },
+      build = function(depth, fn)
+          alternate(function(f) module.pallene_fn(1, f) end, depth, fn)
+      end },
+    { name = "lua+untracked", depths = { 10, 50, 150 },
+      build = function(depth, fn)
+          alternate(module.untracked_fn, depth, function() module.pallene_fn(1, fn) end)
+      end },
+}
+
+-- Globals make the lookup of function names for C frames more expensive.
+local function grow_globals(n)
+    for i = 1, n do
+        _G["bench_global_" .. i] = i
+    end
+end
+
+-- Enough repetitions for a run to take about 20ms.
+local function calibrate(build, depth)
+    local reps = 1
+    while true do
+        local mean
+        build(depth, function() mean = module.measure(1, reps) end)
+        if mean * reps >= 2e7 or reps >= 100000 then
+            return reps
+        end
+        reps = reps * 4
+    end
+end
+
+print(string.format("# traceback (PT_DEBUG, %d runs)", RUNS))
+print(string.format("%-14s %7s %8s %12s %10s %10s %8s %7s",
+    "shape", "depth", "globals", "us/op", "stddev", "peak KB", "allocs", "length"))
+
+local globals = 0
+for _, nglobals in ipairs({ 0, 10000 }) do
+    grow_globals(nglobals)
+    globals = nglobals
+    for _, shape in ipairs(shapes) do
+        for _, depth in ipairs(shape.depths) do
+            local reps = calibrate(shape.build, depth)
+            local mean, stddev, peak, allocs, length
+            shape.build(depth, function()
+                mean, stddev, peak, allocs, length = module.measure(RUNS, reps)
+            end)
+            print(string.format("%-14s %7d %8d %12.2f %10.2f %10.1f %8d %7d",
+                shape.name, depth, globals, mean / 1e3, stddev / 1e3, peak / 1024, allocs, length))
+            io.stdout:flush()
+
+            local name = string.format("%s depth=%d globals=%d", shape.name, depth, globals)
+            record.write({ suite = "traceback", name = name, mode = "PT_DEBUG",
+                unit = "ns/op", better = "lower", mean = mean, stddev = stddev, runs = RUNS })
+            record.write({ suite = "traceback", name = name .. " peak", mode = "PT_DEBUG",
+                unit = "bytes", better = "lower", mean = peak, stddev = 0, runs = 1 })
+        end
+    end
+end
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Helpers for bench/traceback.lua: builds Pallene call-stacks of any shape and
+   measures the `pallene_tracer_errhandler` of `pt-lua` on top of them. */
+
+#include "bench/bench.h"
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include <string.h>
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_FRAMEEXIT(fnstack)
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* ---- ALLOCATION ACCOUNTING ---- */
+
+typedef struct {
+    lua_Alloc f;
+    void *ud;
+    long bytes;
+    long peak;
+    long allocs;
+} alloc_stats_t;
+
+static alloc_stats_t astats;
+
+static void *counting_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    alloc_stats_t *stats = ud;
+
+    /* Without a block, `osize` is a type tag. */
+    if(ptr == NULL)
+        osize = 0;
+    if(nsize > 0)
+        stats->allocs++;
+    stats->bytes += (long) nsize - (long) osize;
+    if(stats->bytes > stats->peak)
+        stats->peak = stats->bytes;
+
+    return stats->f(stats->ud, ptr, osize, nsize);
+}
+
+/* ---- STACK SHAPES ---- */
+
+static pt_fn_details_t white_details = PALLENE_TRACER_FN_DETAILS("white_fn", __FILE__);
+
+/* A Lua interface function, which then goes `depth` C interface functions deep
+   before calling back the Lua function it got. The C interface frames are
+   pushed in a loop rather than by recursion, to keep the C stack small. */
+int pallene_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(pallene_fn);
+
+    lua_Integer depth = luaL_checkinteger(L, 1);
+    pt_frame_t frame = PALLENE_TRACER_C_FRAME(white_details);
+    for(lua_Integer i = 1; i < depth; i++) {
+        frame.line = (int) i;
+        pallene_tracer_frameenter(fnstack, &frame);
+    }
+
+    lua_pushvalue(L, 2);
+    lua_call(L, 0, 0);
+
+    for(lua_Integer i = 1; i < depth; i++)
+        MODULE_C_FRAMEEXIT();
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+/* A C function Pallene Tracer knows nothing about, calling back the Lua function
+   it got. */
+int untracked_fn(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    lua_call(L, 0, 0);
+    return 0;
+}
+
+/* ---- MEASUREMENT ---- */
+
+/* measure(runs, reps) -> mean ns, stddev ns, peak bytes, allocations, length */
+/* Calls `pallene_tracer_errhandler` `reps` times per run on the current stack.
+   The peak is the most memory a single traceback held at once, net of what the
+   garbage collector freed meanwhile. */
+int measure(lua_State *L) {
+    int runs = (int) luaL_checkinteger(L, 1);
+    long reps = (long) luaL_checkinteger(L, 2);
+    luaL_argcheck(L, runs > 0 && runs <= 1000 && reps > 0, 1, "bad runs or reps");
+
+    double *samples = malloc(runs * sizeof(double));
+    long peak = 0;
+    long allocs = 0;
+    size_t length = 0;
+
+    astats.f = lua_getallocf(L, &astats.ud);
+    lua_setallocf(L, counting_alloc, &astats);
+
+    for(int i = -1; i < runs; i++) {
+        lua_gc(L, LUA_GCCOLLECT);
+        astats.peak = 0;
+        astats.allocs = 0;
+
+        double start = bench_now();
+        for(long r = 0; r < reps; r++) {
+            astats.bytes = 0;
+            lua_getglobal(L, "pallene_tracer_errhandler");
+            lua_pushliteral(L, "error");
+            lua_call(L, 1, 1);
+            length = lua_rawlen(L, -1);
+            lua_pop(L, 1);
+        }
+        double elapsed = bench_now() - start;
+
+        /* The first run is a warm-up. */
+        if(i >= 0) {
+            samples[i] = elapsed / (double) reps;
+            if(astats.peak > peak)
+                peak = astats.peak;
+            allocs = astats.allocs / reps;
+        }
+    }
+
+    lua_setallocf(L, astats.f, astats.ud);
+
+    bench_stats_t stats = bench_stats(samples, runs);
+    free(samples);
+
+    lua_pushnumber(L, stats.mean);
+    lua_pushnumber(L, stats.stddev);
+    lua_pushinteger(L, (lua_Integer) peak);
+    lua_pushinteger(L, (lua_Integer) allocs);
+    lua_pushinteger(L, (lua_Integer) length);
+    return 5;
+}
+
+int luaopen_bench_traceback_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, pallene_fn, 2);
+    lua_setfield(L, -2, "pallene_fn");
+
+    lua_pushcfunction(L, untracked_fn);
+    lua_setfield(L, -2, "untracked_fn");
+
+    lua_pushcfunction(L, measure);
+    lua_setfield(L, -2, "measure");
+
+    return 1;
+}
@@ -0,0 +1,69 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Overhead of the trampolines `pt-lua` puts around the functions of wrapped C
+-- modules (see `PT_WRAP_MODULES`). Run by `make bench` as
+--     PT_WRAP_MODULES=bench.wrap_module ./pt-lua bench/wrap.lua
+--
+-- The module is required, which wraps it, and loaded again with
+-- `package.loadlib`, which does not. Every call is measured both ways, so the
+-- difference is what a trampoline costs: the Lua interface frame, the C
+-- interface frame and the extra call. Errors also unwind through the finalizer.
+
+local wrapped = require "bench.wrap_module"
+local record = require "bench.record"
+
+local path = assert(package.searchpath("bench.wrap_module", package.cpath))
+local plain = assert(package.loadlib(path, "luaopen_bench_wrap_module"))()
+if wrapped.nop == plain.nop or not pallene_tracer_errhandler then
+    error("run with PT_WRAP_MODULES=bench.wrap_module ./pt-lua")
+end
+
+local RUNS = 10
+
+local modes = {
+    { name = "nop",      fn = "nop",  args = {} },
+    { name = "sum 4",    fn = "sum",  args = { 1, 2, 3, 4 } },
+    { name = "fail",     fn = "fail", args = {}, pcall = true },
+}
+
+-- Mean and standard deviation of a call of `mode` from `module`, in ns.
+local function measure(module, mode, runs, reps)
+    local fn = module[mode.fn]
+    if mode.pcall then
+        return plain.measure(runs, reps, pcall, fn, table.unpack(mode.args))
+    end
+    return plain.measure(runs, reps, fn, table.unpack(mode.args))
+end
+
+-- Enough repetitions for a run to take about 20ms.
+local function calibrate(module, mode)
+    local reps = 1
+    while true do
+        local mean = measure(module, mode, 1, reps)
+        if mean * reps >= 2e7 or reps >= 10000000 then
+            return reps
+        end
+        reps = reps * 4
+    end
+end
+
+print(string.format("# wrap (PT_DEBUG, %d runs)", RUNS))
+print(string.format("%-10s %12s %10s %12s %10s %12s", "call", "plain ns", "stddev",
+    "wrapped ns", "stddev", "overhead ns"))
+
+for _, mode in ipairs(modes) do
+    local means, stddevs = {}, {}
+    for _, kind in ipairs({ "plain", "wrapped" }) do
+        local module = kind == "plain" and plain or wrapped
+        means[kind], stddevs[kind] = measure(module, mode, RUNS, calibrate(module, mode))
+        record.write({ suite = "wrap", name = mode.name .. " " .. kind,
+            mode = "PT_DEBUG", unit = "ns/op", better = "lower",
+            mean = means[kind], stddev = stddevs[kind], runs = RUNS })
+    end
+    print(string.format("%-10s %12.1f %10.1f %12.1f %10.1f %12.1f", mode.name,
+        means.plain, stddevs.plain, means.wrapped, stddevs.wrapped, means.wrapped - means.plain))
+    io.stdout:flush()
+end
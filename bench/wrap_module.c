@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Helpers for bench/wrap.lua: a plain C module knowing nothing of Pallene
+   Tracer, for `pt-lua` to wrap with `PT_WRAP_MODULES`. */
+
+#include "bench/bench.h"
+
+#include "lua.h"
+#include "lauxlib.h"
+
+/* nop() */
+static int nop(lua_State *L) {
+    (void) L;
+    return 0;
+}
+
+/* sum(...) -> the sum of the integers given */
+static int sum(lua_State *L) {
+    lua_Integer total = 0;
+    for(int i = lua_gettop(L); i > 0; i--)
+        total += luaL_checkinteger(L, i);
+    lua_pushinteger(L, total);
+    return 1;
+}
+
+/* fail(): raises an error. */
+static int fail(lua_State *L) {
+    return luaL_error(L, "failed");
+}
+
+/* measure(runs, reps, fn, ...) -> mean ns, stddev ns */
+/* Calls `fn(...)` `reps` times per run, discarding the results. */
+static int measure(lua_State *L) {
+    int runs = (int) luaL_checkinteger(L, 1);
+    long reps = (long) luaL_checkinteger(L, 2);
+    luaL_checkany(L, 3);
+    luaL_argcheck(L, runs > 0 && runs <= 1000 && reps > 0, 1, "bad runs or reps");
+
+    int nargs = lua_gettop(L) - 3;
+    double *samples = malloc(runs * sizeof(double));
+
+    /* The first run is a warm-up. */
+    for(int i = -1; i < runs; i++) {
+        double start = bench_now();
+        for(long r = 0; r < reps; r++) {
+            for(int a = 3; a <= 3 + nargs; a++)
+                lua_pushvalue(L, a);
+            lua_call(L, nargs, 0);
+        }
+        double elapsed = bench_now() - start;
+
+        if(i >= 0)
+            samples[i] = elapsed / (double) reps;
+    }
+
+    bench_stats_t stats = bench_stats(samples, runs);
+    free(samples);
+
+    lua_pushnumber(L, stats.mean);
+    lua_pushnumber(L, stats.stddev);
+    return 2;
+}
+
+int luaopen_bench_wrap_module(lua_State *L) {
+    luaL_Reg functions[] = {
+        { "nop", nop },
+        { "sum", sum },
+        { "fail", fail },
+        { "measure", measure },
+        { NULL, NULL }
+    };
+    luaL_newlib(L, functions);
+    return 1;
+}
@@ -49,6 +49,8 @@
 #endif                  /* } */
 
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -78,6 +80,105 @@
 #define PT_LUA_TRACEBACK_BOTTOM_THRESHOLD        8
 #endif // PT_RUN_TRACEBACK_BOTTOM_THRESHOLD
 
+/* The sampler (see '--top') needs POSIX signals and timers, and the counters
+   to tell the call rate of Pallene functions. */
+#if defined(PT_COUNTERS) && !defined(_WIN32)
+#define PT_LUA_SAMPLER
+#endif // PT_COUNTERS
+
+/* The call tree (see '--calltree') is told of every Pallene frame boundary by
+   the CPU time accounting. */
+#if defined(PT_LUA_SAMPLER) && defined(PT_CPUTIME)
+#define PT_LUA_CALLTREE
+#endif // PT_CPUTIME
+
+/* The stats page (see 'PT_STATS_NAME') needs POSIX shared memory, and the
+   counters to publish. */
+#if defined(PT_COUNTERS) && !defined(_WIN32)
+#define PT_LUA_STATS
+#endif // PT_COUNTERS
+
+/* Forked children set up their own stats page and files (see 'forks_hook'),
+   once they notice the new generation of the tracer. */
+#if defined(PT_COUNTERS) && !defined(_WIN32)
+#define PT_LUA_FORKS
+#endif // PT_COUNTERS
+
+/* Microseconds of CPU time between samples. */
+#ifndef PT_LUA_SAMPLE_PERIOD
+#define PT_LUA_SAMPLE_PERIOD                     1000
+#endif // PT_LUA_SAMPLE_PERIOD
+
+/* Milliseconds between refreshes of the live view, and how many functions
+   it shows. */
+#ifndef PT_LUA_TOP_INTERVAL
+#define PT_LUA_TOP_INTERVAL                      1000
+#endif // PT_LUA_TOP_INTERVAL
+
+#ifndef PT_LUA_TOP_ROWS
+#define PT_LUA_TOP_ROWS                          20
+#endif // PT_LUA_TOP_ROWS
+
+/* Events the flight recorder keeps, and how many of them go with a traceback. */
+#ifndef PT_LUA_RECORDER_EVENTS
+#define PT_LUA_RECORDER_EVENTS                   4096
+#endif // PT_LUA_RECORDER_EVENTS
+
+#ifndef PT_LUA_RECORDER_HISTORY
+#define PT_LUA_RECORDER_HISTORY                  16
+#endif // PT_LUA_RECORDER_HISTORY
+
+/* Bytes after which the call trace stops, 0 for never. */
+#ifndef PT_LUA_TRACE_LIMIT
+#define PT_LUA_TRACE_LIMIT                       0
+#endif // PT_LUA_TRACE_LIMIT
+
+/* Milliseconds between updates of the stats page. */
+#ifndef PT_LUA_STATS_INTERVAL
+#define PT_LUA_STATS_INTERVAL                    1000
+#endif // PT_LUA_STATS_INTERVAL
+
+/* Lua instructions between two counts of '--icount'. The counts of the same
+   run are the same either way, but only 1 charges every instruction to the
+   function which ran it. */
+#ifndef PT_LUA_ICOUNT_PERIOD
+#define PT_LUA_ICOUNT_PERIOD                     1
+#endif // PT_LUA_ICOUNT_PERIOD
+
+/* Most frames 'PT_STACK_CAPACITY' may ask for, a few hundred MB of call-stack. */
+#ifndef PT_LUA_MAX_STACK_CAPACITY
+#define PT_LUA_MAX_STACK_CAPACITY                10000000
+#endif // PT_LUA_MAX_STACK_CAPACITY
+
+/* Settings of the Pallene Tracer frontend. The macros above are only the
+   defaults, which can be overridden at startup by the `PT_*` environment
+   variables (see 'handle_ptenv'). */
+static struct {
+  int traceback_top;     /* PT_TRACEBACK_TOP */
+  int traceback_bottom;  /* PT_TRACEBACK_BOTTOM */
+  int stack_capacity;    /* PT_STACK_CAPACITY */
+  int sample_period;     /* PT_SAMPLE_PERIOD */
+  int top_interval;      /* PT_TOP_INTERVAL */
+  int top_rows;          /* PT_TOP_ROWS */
+  int recorder_events;   /* PT_RECORDER_EVENTS */
+  int recorder_history;  /* PT_RECORDER_HISTORY */
+  int trace_limit;       /* PT_TRACE_LIMIT */
+  int stats_interval;    /* PT_STATS_INTERVAL */
+  int icount_period;     /* PT_ICOUNT_PERIOD */
+} ptconfig = {
+  PT_LUA_TRACEBACK_TOP_THRESHOLD,
+  PT_LUA_TRACEBACK_BOTTOM_THRESHOLD,
+  PALLENE_TRACER_MAX_CALLSTACK,
+  PT_LUA_SAMPLE_PERIOD,
+  PT_LUA_TOP_INTERVAL,
+  PT_LUA_TOP_ROWS,
+  PT_LUA_RECORDER_EVENTS,
+  PT_LUA_RECORDER_HISTORY,
+  PT_LUA_TRACE_LIMIT,
+  PT_LUA_STATS_INTERVAL,
+  PT_LUA_ICOUNT_PERIOD
+};
+
 
 #if !defined(LUA_PROGNAME)
 #define LUA_PROGNAME            "pt-lua"
@@ -117,6 +218,18 @@ static void setsignal (int sig, void (*handler)(int)) {
 
 /* ---------------- PALLENE TRACER CODE ---------------- */
 
+/* Trampoline of the functions of wrapped C modules (see 'PT_WRAP_MODULES'),
+   and how many functions got one. */
+static int wrap_call (lua_State *L);
+static int wrapped = 0;
+
+/* Take the frames of yielding coroutines off the call-stack and back. */
+static void wrap_park (lua_State *L, pt_fnstack_t *fnstack, int co, int base);
+static void wrap_unpark (lua_State *L, pt_fnstack_t *fnstack, int co);
+
+/* Forked children report there the files they could not open. */
+static void l_message (const char *pname, const char *msg);
+
 /* Global table name deduction. Can we find a function name? */
 static bool findfield(lua_State *L, int fn_idx, int level) {
   if(level == 0 || !lua_istable(L, -1))
@@ -150,206 +263,2855 @@ static bool findfield(lua_State *L, int fn_idx, int level) {
         lua_pushliteral(L, ".");
         lua_insert(L, -2);
 
-        /* Concatenate last 3 values, resulting "table.some_func". */
-        lua_concat(L, 3);
+        /* Concatenate last 3 values, resulting "table.some_func". */
+        lua_concat(L, 3);
+
+        return true;
+      }
+    }
+
+    /* Pop the value. */
+    lua_pop(L, 1);
+  }
+
+  return false;
+}
+
+
+/* Pushes a function name if found in the global table and returns true.
+   Returns false otherwise. */
+/* Expects the function to be pushed in the stack. */
+static bool pushglobalfuncname(lua_State *L) {
+  int top = lua_gettop(L);
+
+  /* Start from the global table. */
+  lua_pushglobaltable(L);
+
+  if(findfield(L, top, 2)) {
+    lua_remove(L, -2);
+    return true;
+  }
+
+  lua_pop(L, 1);
+  return false;
+}
+
+
+/* Returns the maximum number of levels in Lua stack. */
+static int countlevels(lua_State *L) {
+  lua_Debug ar;
+  int li = 1, le = 1;
+
+  /* Find an upper bound */
+  while (lua_getstack(L, le, &ar)) {
+    li = le, le *= 2;
+  }
+
+  /* Do a binary search */
+  while (li < le) {
+    int m = (li + le) / 2;
+
+    if (lua_getstack(L, m, &ar)) li = m + 1;
+    else le = m;
+  }
+
+  return le - 1;
+}
+
+
+/* Returns the number of frames actually recorded in the Pallene call stack.
+   Frames pushed after the stack ran out of capacity are counted but not stored. */
+static int recordedframes(pt_fnstack_t *fnstack) {
+  return fnstack->count < fnstack->capacity ? fnstack->count : fnstack->capacity;
+}
+
+/* The names of the C interface frame 'i'. Modules compiled without any feature
+   macro do not copy them, their details are read instead (see
+   'pt_frame_names_t'). */
+static pt_frame_names_t framenames(const pt_fnstack_t *fnstack, int i) {
+  pt_frame_names_t names = fnstack->names[i];
+  const pt_fn_details_t *details = fnstack->stack[i].shared.details;
+  if(names.details != details) {
+    names.details = details;
+    names.fn_name = details->fn_name;
+    names.filename = details->filename;
+    names.id = details->id;
+    names.recorded = false;
+  }
+  return names;
+}
+
+
+/* Counts the number of white and black frames in the Pallene call stack. */
+static void countframes(pt_fnstack_t *fnstack, int *mwhite, int *mblack) {
+  *mwhite = *mblack = 0;
+
+  for(int i = 0; i < recordedframes(fnstack); i++) {
+    *mwhite += (fnstack->stack[i].type == PALLENE_TRACER_FRAME_TYPE_C);
+    *mblack += (fnstack->stack[i].type == PALLENE_TRACER_FRAME_TYPE_LUA);
+  }
+}
+
+
+/* Whether the function at 'level' of the Lua stack is the trampoline of a
+   wrapped C function. The level above it is then the wrapped function, which
+   the Pallene frames of the trampoline stand for. */
+static bool wrap_level(lua_State *L, int level) {
+  lua_Debug ar;
+  if(wrapped == 0 || !lua_getstack(L, level, &ar))
+    return false;
+
+  lua_getinfo(L, "f", &ar);
+  bool is_wrap = lua_tocfunction(L, -1) == wrap_call;
+  lua_pop(L, 1);
+  return is_wrap;
+}
+
+
+/* This function is called by `debugtraceback` function decides whether to print the stack frame info string
+   pushed onto the Lua stack. The function is also responsible for printing ellipsis (skipped frames). If we
+   are skipping frames, the current frame pushed in stack is not printed. */
+/* Pops the frame string from the Lua stack. */
+/* pframes = Amount of printed frames; current count, nframes = Number of total frames to be printed. */
+static void render(lua_State *L, luaL_Buffer *buf, int pframes, int nframes) {
+  /* Should we print? Are we at any point in top or bottom printing threshold? */
+  bool should_print = (pframes <= ptconfig.traceback_top)
+    || ((nframes - pframes) <= ptconfig.traceback_bottom);
+
+  if(should_print)
+    luaL_addvalue(buf);
+  else {
+    /* The frame string pushed onto the stack. We are not printing it, so just pop it out. */
+    lua_pop(L, 1);
+
+    /* Have we escaped the threshold to skip frames? */
+    if(pframes == ptconfig.traceback_top + 1) {
+      lua_pushfstring(L, "\n\n    ... (Skipped %d frames) ...\n",
+        nframes - (ptconfig.traceback_top + ptconfig.traceback_bottom));
+      luaL_addvalue(buf);
+    }
+  }
+}
+
+
+/* Pallene Tracer explicit traceback function to show Pallene call-stack
+   tracebacks. */
+int debugtraceback(lua_State *L, const char* msg) {
+  lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY);
+  pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, -1);
+  pt_frame_t *stack = fnstack->stack;
+  /* The point where we are in the Pallene stack. */
+  int index = recordedframes(fnstack) - 1;
+  lua_pop(L, 1);
+
+  /* Max number of white and black frames. */
+  int mwhite, mblack;
+  countframes(fnstack, &mwhite, &mblack);
+  /* Max levels of Lua stack. */
+  int mlevel = countlevels(L);
+
+  /* Total frames we are going to print. */
+  /* Black frames are used for switching and we will start from
+     Lua stack level 1. */
+  int nframes = mlevel + mwhite - mblack - 1;
+  /* Wrapped C functions are only shown by their trampoline. */
+  for(int i = 0; i < recordedframes(fnstack) && wrapped > 0; i++)
+    nframes -= (stack[i].type == PALLENE_TRACER_FRAME_TYPE_LUA
+      && stack[i].shared.c_fnptr == wrap_call);
+  /* Amount of frames printed. */
+  int pframes = 0;
+
+  luaL_Buffer buf;
+  luaL_buffinit(L, &buf);
+  lua_pushfstring(L, "%s\nstack traceback:", msg);
+  luaL_addvalue(&buf);
+
+  lua_Debug ar;
+  int level = 1;
+  const char *tname;
+
+  while(lua_getstack(L, level++, &ar)) {
+    /* Get information regarding the frame: name, source, linenumbers etc. */
+    lua_getinfo(L, "Slnf", &ar);
+
+    /* If the frame is a C frame. */
+    if(lua_iscfunction(L, -1)) {
+      /* A wrapped C function, its trampoline comes next. */
+      if(wrap_level(L, level)) {
+        lua_pop(L, 1);  /* the function */
+        continue;
+      }
+
+      if(index >= 0) {
+        /* Check whether this frame is tracked (C interface frames). */
+        int check = index;
+        while(check >= 0 && stack[check].type != PALLENE_TRACER_FRAME_TYPE_LUA)
+          check--;
+
+        /* If the frame matches, we switch to printing Pallene frames. */
+        if(check >= 0 && lua_tocfunction(L, -1) == stack[check].shared.c_fnptr) {
+          lua_pop(L, 1);  /* the function */
+
+          /* Now print all the frames in Pallene stack. */
+          for(; index > check; index--) {
+            lua_pushfstring(L, "\n    %s:%d: in function '%s'",
+              stack[index].shared.details->filename,
+              stack[index].line, stack[index].shared.details->fn_name);
+            pframes++;  /* We are printing the frame regardless of frame visibility. */
+            render(L, &buf, pframes, nframes);
+          }
+
+          /* 'check' idx is guaranteed to be a Lua interface frame.
+             Which is basically our 'stack' index at this point. So,
+             we simply ignore the Lua interface frame. */
+          index--;
+
+          /* We are done. */
+          continue;
+        }
+      }
+
+      /* Then it's an untracked C frame. */
+      if(pushglobalfuncname(L)) {
+        tname = lua_tostring(L, -1);
+        lua_pop(L, 1);
+      } else tname = "<?>";
+
+      lua_pop(L, 1);  /* the function */
+      lua_pushfstring(L, "\n    C: in function '%s'", tname);
+      pframes++;
+      render(L, &buf, pframes, nframes);
+    } else {
+      /* It's a Lua frame. */
+
+      /* Do we have a name? */
+      if(*ar.namewhat != '\0') {
+        lua_pushfstring(L, "function '%s'", ar.name);
+        tname = lua_tostring(L, -1);
+        lua_pop(L, 1);
+      }
+      /* Is it the main chunk? */
+      else if(*ar.what == 'm')
+        tname = "<main>";
+      /* Can we deduce the name from the global table? */
+      else if(pushglobalfuncname(L)) {
+        lua_pushfstring(L, "function '%s'", lua_tostring(L, -1));
+        tname = lua_tostring(L, -1);
+        lua_pop(L, 2);
+      } else tname = "function '<?>'";
+
+      lua_pop(L, 1);  /* the function */
+      lua_pushfstring(L, "\n    %s:%d: in %s", ar.short_src,
+        ar.currentline, tname);
+      pframes++;
+      render(L, &buf, pframes, nframes);
+    }
+  }
+
+  luaL_pushresult(&buf);
+  return 1;
+}
+
+
+#ifdef PT_RECORDER
+/* Appends the last events of the flight recorder, if any, to the traceback on
+   top of the stack: the Pallene calls which led to the error. */
+static void recorderhistory(lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY);
+  pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, -1);
+  lua_pop(L, 1);
+
+  pt_record_t record;
+  int n = 0, mindepth = INT_MAX;
+  while(n < ptconfig.recorder_history && pallene_tracer_recorder_event(fnstack, n, &record)) {
+    if(record.depth < mindepth)
+      mindepth = record.depth;
+    n++;
+  }
+  if(n == 0)
+    return;
+
+  static const char *const kinds[] = { "?", "enter", "exit", "error" };
+  luaL_Buffer buf;
+  luaL_buffinit(L, &buf);
+  lua_pushvalue(L, -2);  /* the traceback */
+  luaL_addvalue(&buf);
+  luaL_addstring(&buf, "\nrecent Pallene calls (oldest first):");
+
+  for(int back = n - 1; back >= 0; back--) {
+    pallene_tracer_recorder_event(fnstack, back, &record);
+    const pt_fn_details_t *details = pallene_tracer_descriptor(record.id);
+    int indent = 2 * (record.depth - mindepth);
+    luaL_addstring(&buf, "\n    ");
+    for(int i = 0; i < indent && i < 40; i++)
+      luaL_addchar(&buf, ' ');
+    lua_pushfstring(L, "%s %s (%s",
+      kinds[record.kind <= PALLENE_TRACER_RECORD_ERROR ? record.kind : 0],
+      details != NULL ? details->fn_name : "?", details != NULL ? details->filename : "?");
+    luaL_addvalue(&buf);
+    if(record.line > 0) {
+      lua_pushfstring(L, ":%d", record.line);
+      luaL_addvalue(&buf);
+    }
+    luaL_addchar(&buf, ')');
+  }
+
+  luaL_pushresult(&buf);
+  lua_replace(L, -2);
+}
+
+
+/* The flight recorder and the call trace of the script, as given, for the
+   names in forked children. */
+static struct {
+  pt_fnstack_t *fnstack;
+  const char *recorder;          /* PT_RECORDER_FILE, NULL if none. */
+  const char *trace;             /* PT_TRACE_FILE, NULL if none. */
+  unsigned generation;           /* Of the tracer, when the files were opened. */
+} recorderfiles;
+
+
+/* The files stay with the parent, the tracer has stopped recording to them.
+   A forked child records to files of its own, "<name>.<pid>", from the first
+   Lua code it runs on. Called on the thread running the script. */
+static void recorder_forked (lua_State *L) {
+  if (recorderfiles.generation == pallene_tracer_generation())
+    return;
+  recorderfiles.generation = pallene_tracer_generation();
+
+  char name[256];
+  if (recorderfiles.recorder != NULL) {
+    snprintf(name, sizeof(name), "%s.%ld", recorderfiles.recorder, (long)getpid());
+    int error = pallene_tracer_recorder_open(recorderfiles.fnstack, name,
+      ptconfig.recorder_events);
+    if (error != 0) {
+      l_message(progname, lua_pushfstring(L, "cannot open flight recorder '%s': %s",
+        name, strerror(error)));
+      lua_pop(L, 1);
+    }
+  }
+  if (recorderfiles.trace != NULL) {
+    snprintf(name, sizeof(name), "%s.%ld", recorderfiles.trace, (long)getpid());
+    int error = pallene_tracer_trace_open(recorderfiles.fnstack, name,
+      (size_t)ptconfig.trace_limit);
+    if (error != 0) {
+      l_message(progname, lua_pushfstring(L, "cannot open call trace '%s': %s",
+        name, strerror(error)));
+      lua_pop(L, 1);
+    }
+  }
+}
+
+
+/* Opens the files of the script again in forked children (see 'forks_hook'). */
+static void recorder_forks (pt_fnstack_t *fnstack, const char *recorder,
+                            const char *trace) {
+  recorderfiles.fnstack = fnstack;
+  recorderfiles.recorder = recorder;
+  recorderfiles.trace = trace;
+  recorderfiles.generation = pallene_tracer_generation();
+}
+#endif // PT_RECORDER
+
+
+#ifdef PT_LUA_SAMPLER
+/* ---- SAMPLER ---- */
+
+/* The sampler interrupts the Lua thread with SIGPROF every 'sample_period'
+   microseconds of CPU time. The signal handler copies the top of the Pallene
+   call-stack into a queue and sets a count hook on the running coroutine. The
+   hook runs at the next Lua instruction and adds the Lua stack to the queued
+   samples, switching to the Pallene frames at the Lua interface frames just
+   like 'debugtraceback'. Samples whose hook does not come, e.g. while Pallene
+   code runs for long without calling back into Lua, are taken without their
+   Lua stack after a while. */
+
+#include <stddef.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+/* How many frames of the Pallene and of the Lua stack a sample keeps, counting
+   from the top. */
+#ifndef PT_LUA_SAMPLE_FRAMES
+#define PT_LUA_SAMPLE_FRAMES                     64
+#endif // PT_LUA_SAMPLE_FRAMES
+
+/* Samples waiting for their Lua stack. A power of 2. */
+#ifndef PT_LUA_SAMPLE_QUEUE
+#define PT_LUA_SAMPLE_QUEUE                      1024
+#endif // PT_LUA_SAMPLE_QUEUE
+
+/* Nanoseconds after which a queued sample is taken without its Lua stack. */
+#define SAMPLE_STALE            200000000u
+
+/* A Pallene frame as seen by the signal handler. The names are copied out of
+   the call-stack, not out of the details, which may live in the C stack of a
+   function an error has unwound by the time the sample is taken. Only those of
+   modules compiled without any feature macro are read from the details. */
+typedef struct sample_frame {
+  const char *fn_name;       /* NULL for Lua interface frames. */
+  const char *filename;
+  lua_CFunction c_fnptr;     /* Lua interface frames only. */
+  int line;
+  int id;                    /* Descriptor, 0 if none. */
+} sample_frame_t;
+
+typedef struct sample {
+  lua_State *co;             /* The running coroutine. */
+  uint64_t when;             /* CLOCK_MONOTONIC, in nanoseconds. */
+  uint64_t cpu;              /* CPU time since the previous sample. */
+  uint64_t wall;             /* Wall time since the previous sample. */
+  uint64_t alloc;            /* Bytes allocated since the previous sample. */
+  int depth;                 /* Frames recorded in the Pallene call-stack. */
+  int nframes;               /* Frames kept, the topmost first. */
+  sample_frame_t frames[PT_LUA_SAMPLE_FRAMES];
+} sample_t;
+
+/* A function of the profile. Never freed, so that the names can be read
+   without the lock. */
+typedef struct profile_fn {
+  const char *name;          /* Interned. */
+  const char *file;          /* Interned. */
+  int defined;               /* Line where a Lua function is defined. */
+  char kind;                 /* 'P'allene, 'L'ua or 'C'. */
+  int id;                    /* Pallene descriptor, 0 if none. */
+  unsigned stamp;            /* Last sample counted in 'total'. */
+  uint64_t self, total;      /* Samples of the current window. */
+  uint64_t self_ns, total_ns;  /* CPU time of the current window. */
+} profile_fn_t;
+
+/* A frame of a sample, once taken. */
+typedef struct profile_frame {
+  profile_fn_t *fn;
+  int line;
+} profile_frame_t;
+
+/* What the samples of a profile add up, in the order of the pprof sample
+   types. The call tree counts calls as samples, and only has CPU time. */
+enum { PROFILE_SAMPLES, PROFILE_CPU, PROFILE_WALL, PROFILE_ALLOC, PROFILE_VALUES };
+
+/* A node of the call tree of the profile: a function and the line it was at,
+   under the node of its caller. */
+typedef struct profile_node {
+  profile_fn_t *fn;          /* NULL for the root. */
+  int line;
+  struct profile_node *parent, *child, *sibling;
+  uint64_t values[PROFILE_VALUES];  /* Of the samples with the node on top. */
+} profile_node_t;
+
+static struct {
+  volatile sig_atomic_t armed;
+  pthread_t thread;              /* Thread running the Lua state. */
+  lua_State *L;                  /* Main thread of the Lua state. */
+  lua_State *volatile running;   /* Running coroutine. */
+  pt_fnstack_t *fnstack;
+  unsigned generation;           /* Process generation we were set up in. */
+  unsigned first_generation;     /* Same, for the process which started us. */
+  struct itimerval period;
+  uint64_t last_cpu, last_wall;  /* Time of the previous sample. */
+  uint64_t allocated, last_alloc;  /* Bytes allocated by the Lua state. */
+  lua_Alloc allocf;              /* The allocator we count for. */
+
+  /* Written by the signal handler only, read by the hook and the display. */
+  sample_t queue[PT_LUA_SAMPLE_QUEUE];
+  unsigned head, tail;
+  unsigned dropped;              /* Samples lost to a full queue. */
+
+  /* Everything below is guarded by the lock. */
+  pthread_mutex_t lock;
+  profile_fn_t **fns;            /* Open addressing, 'fnsize' a power of 2. */
+  int nfns, fnsize;
+  const char **strings;          /* Same, interned strings. */
+  int nstrings, strsize;
+  unsigned stamp;
+  uint64_t samples;              /* Samples of the current window. */
+  int luadepth;                  /* Lua levels at the last sample. */
+  uint64_t luadepth_when;
+  profile_node_t root;           /* Call tree, if writing a profile. */
+
+  /* The profile, written when the sampler stops. */
+  const char *profile;           /* File name, NULL if none. */
+  bool calltree;                 /* Of every call (see '--calltree'), not sampled. */
+  bool icount;                   /* Same, of instructions (see '--icount'). */
+  uint64_t profile_started;      /* CLOCK_REALTIME. */
+
+  /* The live view. */
+  bool top;
+  pthread_t display;
+  pthread_cond_t wake;
+  bool stop;
+  uint64_t started, refreshed;
+} sampler = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .wake = PTHREAD_COND_INITIALIZER
+};
+
+
+static uint64_t sampler_clock (clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+
+#ifdef PT_LUA_CALLTREE
+static void calltree_switch (lua_State *L, lua_State *co);
+#endif // PT_LUA_CALLTREE
+
+/* Makes 'co' the running coroutine, whose stack the samples are taken from.
+   'L' is the one running now. */
+static void sampler_switch (lua_State *L, lua_State *co) {
+  sampler.running = co;
+#ifdef PT_LUA_CALLTREE
+  if (sampler.calltree)
+    calltree_switch(L, co);
+#else
+  (void)L;
+#endif // PT_LUA_CALLTREE
+}
+
+
+static void sampler_hook (lua_State *L, lua_Debug *ar);
+
+/* SIGPROF handler. Runs on the Lua thread, in between any two instructions of
+   it. The frames below 'count' are never written to but by 'setline'. */
+static void sampler_signal (int sig) {
+  int saved = errno;
+  (void)sig;
+
+  /* Other threads get their share of the signals too. */
+  if (!sampler.armed || !pthread_equal(pthread_self(), sampler.thread)) {
+    errno = saved;
+    return;
+  }
+
+  uint64_t cpu = sampler_clock(CLOCK_THREAD_CPUTIME_ID);
+  uint64_t wall = sampler_clock(CLOCK_MONOTONIC);
+  lua_State *co = sampler.running;
+  unsigned head = sampler.head;
+
+  if (head - __atomic_load_n(&sampler.tail, __ATOMIC_ACQUIRE) >= PT_LUA_SAMPLE_QUEUE)
+    __atomic_add_fetch(&sampler.dropped, 1, __ATOMIC_RELAXED);
+  else {
+    sample_t *s = &sampler.queue[head % PT_LUA_SAMPLE_QUEUE];
+    pt_fnstack_t *fnstack = sampler.fnstack;
+    int n = 0;
+
+    s->co = co;
+    s->when = wall;
+    s->cpu = cpu - sampler.last_cpu;
+    s->wall = wall - sampler.last_wall;
+    s->alloc = sampler.allocated - sampler.last_alloc;
+    s->depth = recordedframes(fnstack);
+    for (int i = s->depth - 1; i >= 0 && n < PT_LUA_SAMPLE_FRAMES; i--, n++) {
+      const pt_frame_t *frame = &fnstack->stack[i];
+      sample_frame_t *f = &s->frames[n];
+      f->line = frame->line;
+      if (frame->type == PALLENE_TRACER_FRAME_TYPE_C) {
+        pt_frame_names_t names = framenames(fnstack, i);
+        f->fn_name = names.fn_name;
+        f->filename = names.filename;
+        f->c_fnptr = NULL;
+        f->id = names.id;
+      }
+      else {
+        f->fn_name = f->filename = NULL;
+        f->c_fnptr = frame->shared.c_fnptr;
+        f->id = 0;
+      }
+    }
+    s->nframes = n;
+    __atomic_store_n(&sampler.head, head + 1, __ATOMIC_RELEASE);
+  }
+  sampler.last_cpu = cpu;
+  sampler.last_wall = wall;
+  sampler.last_alloc = sampler.allocated;
+
+  /* Leave alone the hooks of others, e.g. 'debug.sethook'. */
+  lua_Hook hook = lua_gethook(co);
+  if (hook == NULL || hook == sampler_hook)
+    lua_sethook(co, sampler_hook, LUA_MASKCOUNT, 1);
+
+  errno = saved;
+}
+
+
+/* Copies the oldest queued sample into 's', if it was taken before 'before'.
+   The hook and the display both take samples, so they race for the tail. The
+   handler does not write to a sample until the tail has moved past it. */
+static bool sampler_dequeue (sample_t *s, uint64_t before) {
+  for (;;) {
+    unsigned tail = __atomic_load_n(&sampler.tail, __ATOMIC_ACQUIRE);
+    if (tail == __atomic_load_n(&sampler.head, __ATOMIC_ACQUIRE))
+      return false;
+    const sample_t *queued = &sampler.queue[tail % PT_LUA_SAMPLE_QUEUE];
+    if (queued->when >= before)
+      return false;
+    memcpy(s, queued, offsetof(sample_t, frames)
+                      + queued->nframes * sizeof(sample_frame_t));
+    if (__atomic_compare_exchange_n(&sampler.tail, &tail, tail + 1, false,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      return true;
+  }
+}
+
+
+/* FNV-1a. */
+static unsigned sampler_hash (const char *s, unsigned h) {
+  for (; *s != '\0'; s++)
+    h = (h ^ (unsigned char)*s) * 16777619u;
+  return h;
+}
+
+
+/* Returns the interned copy of 's'. */
+static const char *profile_intern (const char *s) {
+  if (2 * (sampler.nstrings + 1) > sampler.strsize) {
+    int size = sampler.strsize == 0 ? 256 : 2 * sampler.strsize;
+    const char **strings = calloc(size, sizeof(char *));
+    if (strings == NULL)
+      return "?";
+    for (int i = 0; i < sampler.strsize; i++) {
+      const char *old = sampler.strings[i];
+      if (old == NULL) continue;
+      unsigned h = sampler_hash(old, 2166136261u) & (size - 1);
+      while (strings[h] != NULL) h = (h + 1) & (size - 1);
+      strings[h] = old;
+    }
+    free(sampler.strings);
+    sampler.strings = strings;
+    sampler.strsize = size;
+  }
+
+  unsigned h = sampler_hash(s, 2166136261u) & (sampler.strsize - 1);
+  for (; sampler.strings[h] != NULL; h = (h + 1) & (sampler.strsize - 1)) {
+    if (strcmp(sampler.strings[h], s) == 0)
+      return sampler.strings[h];
+  }
+
+  size_t len = strlen(s) + 1;
+  char *copy = malloc(len);
+  if (copy == NULL)
+    return "?";
+  memcpy(copy, s, len);
+  sampler.strings[h] = copy;
+  sampler.nstrings++;
+  return copy;
+}
+
+
+/* Lua functions are told apart by where they are defined, the others by name. */
+static unsigned profile_fnhash (char kind, const char *name, const char *file, int defined) {
+  unsigned h = (unsigned)kind * 16777619u;
+  h = (h ^ (unsigned)(uintptr_t)file) * 16777619u;
+  if (kind == 'L')
+    return (h ^ (unsigned)defined) * 16777619u;
+  return (h ^ (unsigned)(uintptr_t)name) * 16777619u;
+}
+
+
+/* Returns the function of the profile, adding it if new. NULL if out of memory. */
+static profile_fn_t *profile_fn (char kind, const char *name, const char *file,
+                                 int defined, int id) {
+  name = profile_intern(name);
+  file = profile_intern(file);
+
+  if (2 * (sampler.nfns + 1) > sampler.fnsize) {
+    int size = sampler.fnsize == 0 ? 256 : 2 * sampler.fnsize;
+    profile_fn_t **fns = calloc(size, sizeof(profile_fn_t *));
+    if (fns == NULL)
+      return NULL;
+    for (int i = 0; i < sampler.fnsize; i++) {
+      profile_fn_t *fn = sampler.fns[i];
+      if (fn == NULL) continue;
+      unsigned h = profile_fnhash(fn->kind, fn->name, fn->file, fn->defined) & (size - 1);
+      while (fns[h] != NULL) h = (h + 1) & (size - 1);
+      fns[h] = fn;
+    }
+    free(sampler.fns);
+    sampler.fns = fns;
+    sampler.fnsize = size;
+  }
+
+  unsigned h = profile_fnhash(kind, name, file, defined) & (sampler.fnsize - 1);
+  for (; sampler.fns[h] != NULL; h = (h + 1) & (sampler.fnsize - 1)) {
+    profile_fn_t *fn = sampler.fns[h];
+    if (fn->kind == kind && fn->file == file
+        && (kind == 'L' ? fn->defined == defined : fn->name == name)) {
+      if (fn->id <= 0)
+        fn->id = id;
+      if (fn->name[0] == '?')  /* a Lua function first seen without a name */
+        fn->name = name;
+      return fn;
+    }
+  }
+
+  profile_fn_t *fn = calloc(1, sizeof(profile_fn_t));
+  if (fn == NULL)
+    return NULL;
+  fn->name = name;
+  fn->file = file;
+  fn->defined = defined;
+  fn->kind = kind;
+  fn->id = id;
+  sampler.fns[h] = fn;
+  sampler.nfns++;
+  return fn;
+}
+
+
+static int profile_pallene (profile_frame_t *out, const sample_frame_t *f) {
+  out->fn = profile_fn('P', f->fn_name, f->filename, 0, f->id);
+  out->line = f->line;
+  return out->fn != NULL;
+}
+
+
+static int profile_lua (profile_frame_t *out, lua_Debug *ar) {
+  const char *name = "?";
+  if (*ar->namewhat != '\0')
+    name = ar->name;
+  else if (*ar->what == 'm')
+    name = "main chunk";
+  if (*ar->what == 'C')
+    out->fn = profile_fn('C', name, "[C]", 0, 0);
+  else
+    out->fn = profile_fn('L', name, ar->short_src, ar->linedefined, 0);
+  out->line = ar->currentline;
+  return out->fn != NULL;
+}
+
+
+/* Takes sample 's' into 'out', the topmost frame first, and returns the number
+   of frames. 'L' is the coroutine running now, or NULL to take the Pallene
+   frames alone. */
+static int profile_resolve (lua_State *L, const sample_t *s, profile_frame_t *out) {
+  int n = 0, k = 0;
+  int current = 0;  /* Frames still on the Pallene call-stack. */
+
+  if (L != NULL && L == s->co)
+    current = recordedframes(sampler.fnstack);
+  else
+    L = NULL;
+
+  /* Frames which are gone since the sample went on top of the Lua stack,
+     whose Lua interface frames are gone too. */
+  for (; k < s->nframes && s->depth - 1 - k >= current; k++) {
+    if (s->frames[k].fn_name != NULL)
+      n += profile_pallene(&out[n], &s->frames[k]);
+  }
+  if (L == NULL)
+    return n;
+
+  /* If so, what the Lua stack got on top since was not there either: up to
+     the Lua interface frame of the Pallene frames left. */
+  bool stale = false;
+  if (k > 0) {
+    for (int check = k; check < s->nframes && !stale; check++)
+      stale = s->frames[check].fn_name == NULL;
+  }
+
+  lua_Debug ar;
+  int level;
+  for (level = 0; level < PT_LUA_SAMPLE_FRAMES && lua_getstack(L, level, &ar); level++) {
+    lua_getinfo(L, "Slnf", &ar);
+    lua_CFunction fnptr = lua_tocfunction(L, -1);
+    lua_pop(L, 1);  /* the function */
+
+    if (fnptr != NULL && wrap_level(L, level + 1))
+      continue;  /* a wrapped C function, its trampoline stands for it */
+    if (fnptr != NULL) {
+      /* Is it the Lua interface frame of the Pallene frames above? */
+      int check = k;
+      while (check < s->nframes && s->frames[check].fn_name != NULL)
+        check++;
+      if (check < s->nframes && s->frames[check].c_fnptr == fnptr) {
+        for (; k < check; k++)
+          n += profile_pallene(&out[n], &s->frames[k]);
+        k = check + 1;
+        stale = false;
+        continue;  /* the Pallene frames stand for it */
+      }
+    }
+    if (!stale)
+      n += profile_lua(&out[n], &ar);
+  }
+
+  /* Counting every level is quadratic, so only now and then. */
+  if (level < PT_LUA_SAMPLE_FRAMES)
+    sampler.luadepth = level;
+  else if (s->when - sampler.luadepth_when > SAMPLE_STALE) {
+    sampler.luadepth = countlevels(L) + 1;
+    sampler.luadepth_when = s->when;
+  }
+  return n;
+}
+
+
+/* Returns the node of 'fn' at 'line' under 'node', adding it if new. NULL if
+   out of memory. The node found moves to the front, as stacks repeat. */
+static profile_node_t *profile_child (profile_node_t *node, profile_fn_t *fn, int line) {
+  profile_node_t **p;
+  for (p = &node->child; *p != NULL; p = &(*p)->sibling) {
+    profile_node_t *child = *p;
+    if (child->fn == fn && child->line == line) {
+      *p = child->sibling;
+      child->sibling = node->child;
+      node->child = child;
+      return child;
+    }
+  }
+
+  profile_node_t *child = calloc(1, sizeof(profile_node_t));
+  if (child == NULL)
+    return NULL;
+  child->fn = fn;
+  child->line = line;
+  child->parent = node;
+  child->sibling = node->child;
+  node->child = child;
+  return child;
+}
+
+
+/* Charges a sample to its functions: to the topmost one as self, and once to
+   every function in it as total. When writing a profile, adds it to the call
+   tree as well. */
+static void profile_add (const sample_t *s, const profile_frame_t *frames, int n) {
+  unsigned stamp = ++sampler.stamp;
+
+  sampler.samples++;
+  if (n == 0)
+    return;
+
+  frames[0].fn->self++;
+  frames[0].fn->self_ns += s->cpu;
+  for (int i = 0; i < n; i++) {
+    profile_fn_t *fn = frames[i].fn;
+    if (fn->stamp != stamp) {
+      fn->stamp = stamp;
+      fn->total++;
+      fn->total_ns += s->cpu;
+    }
+  }
+
+  if (sampler.profile == NULL)
+    return;
+  profile_node_t *node = &sampler.root;
+  for (int i = n - 1; i >= 0 && node != NULL; i--)
+    node = profile_child(node, frames[i].fn, frames[i].line);
+  if (node != NULL) {
+    node->values[PROFILE_SAMPLES]++;
+    node->values[PROFILE_CPU] += s->cpu;
+    node->values[PROFILE_WALL] += s->wall;
+    node->values[PROFILE_ALLOC] += s->alloc;
+  }
+}
+
+
+/* Takes the queued samples taken before 'before', with the Lua stack of 'L'
+   if not NULL. */
+static void sampler_drain (lua_State *L, uint64_t before, sample_t *s) {
+  profile_frame_t frames[2 * PT_LUA_SAMPLE_FRAMES];
+
+  while (sampler_dequeue(s, before)) {
+    pthread_mutex_lock(&sampler.lock);
+    profile_add(s, frames, profile_resolve(L, s, frames));
+    pthread_mutex_unlock(&sampler.lock);
+  }
+}
+
+
+static void profile_reset (profile_node_t *node) {
+  for (; node != NULL; node = node->sibling) {
+    memset(node->values, 0, sizeof(node->values));
+    profile_reset(node->child);
+  }
+}
+
+
+/* Sets the sampler up again in a forked child. The timer and the display
+   thread stayed with the parent, but a profile goes on in a file of its own.
+   What was sampled before the fork belongs to the parent. */
+static void sampler_forked (void) {
+  pthread_mutex_lock(&sampler.lock);
+  sampler.generation = pallene_tracer_generation();
+  sampler.top = false;
+  sampler.tail = sampler.head;
+  sampler.dropped = 0;
+  sampler.samples = 0;
+  for (int i = 0; i < sampler.fnsize; i++) {
+    profile_fn_t *fn = sampler.fns[i];
+    if (fn != NULL)
+      fn->self = fn->total = fn->self_ns = fn->total_ns = 0;
+  }
+  profile_reset(&sampler.root);
+  sampler.profile_started = sampler_clock(CLOCK_REALTIME);
+  if (sampler.profile == NULL)
+    sampler.armed = 0;
+  pthread_mutex_unlock(&sampler.lock);
+}
+
+
+/* Count hook set by the signal handler. */
+static void sampler_hook (lua_State *L, lua_Debug *ar) {
+  static sample_t s;
+  (void)ar;
+
+  lua_sethook(L, NULL, 0, 0);
+  if (sampler.generation != pallene_tracer_generation())
+    sampler_forked();
+  if (sampler.armed)
+    sampler_drain(L, UINT64_MAX, &s);
+}
+
+
+/* Counts the bytes allocated by the Lua state, for the profile. */
+static void *sampler_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  size_t old = ptr == NULL ? 0 : osize;  /* else 'osize' is the type */
+  if (nsize > old)
+    sampler.allocated += nsize - old;
+  return sampler.allocf(ud, ptr, osize, nsize);
+}
+
+
+/* How a function is shown: Lua functions by where they are defined, since
+   the same one goes by different names. */
+static int profile_label (char *buf, size_t size, const profile_fn_t *fn) {
+  if (fn->kind == 'L')
+    return snprintf(buf, size, "%s (%s:%d)", fn->name, fn->file, fn->defined);
+  return snprintf(buf, size, "%s (%s)", fn->name, fn->file);
+}
+
+
+/* ---- LIVE VIEW ---- */
+
+typedef struct top_row {
+  const profile_fn_t *fn;
+  uint64_t self, total, self_ns, total_ns;
+} top_row_t;
+
+
+static int top_compare (const void *a, const void *b) {
+  const top_row_t *ra = (const top_row_t *)a, *rb = (const top_row_t *)b;
+  if (ra->self != rb->self)
+    return ra->self < rb->self ? 1 : -1;
+  if (ra->total != rb->total)
+    return ra->total < rb->total ? 1 : -1;
+  return 0;
+}
+
+
+/* Shows the functions of the window since the last refresh on stderr, the
+   hottest first, and starts a new window. */
+static void top_refresh (void) {
+  static sample_t s;
+  static pt_counter_t counters[PALLENE_TRACER_MAX_DESCRIPTORS];
+  static uint64_t calls[PALLENE_TRACER_MAX_DESCRIPTORS];
+  uint64_t now = sampler_clock(CLOCK_MONOTONIC);
+  double seconds = (double)(now - sampler.refreshed) / 1e9;
+
+  sampler_drain(NULL, now - SAMPLE_STALE, &s);
+  int ncounters = pallene_tracer_counters_merge(counters);
+
+  pthread_mutex_lock(&sampler.lock);
+  top_row_t *rows = malloc((sampler.nfns + 1) * sizeof(top_row_t));
+  int nrows = 0;
+  uint64_t samples = sampler.samples;
+  for (int i = 0; i < sampler.fnsize; i++) {
+    profile_fn_t *fn = sampler.fns[i];
+    if (fn == NULL || fn->total == 0)
+      continue;
+    if (rows != NULL)
+      rows[nrows++] = (top_row_t){ fn, fn->self, fn->total, fn->self_ns, fn->total_ns };
+    fn->self = fn->total = fn->self_ns = fn->total_ns = 0;
+  }
+  sampler.samples = 0;
+  int luadepth = sampler.luadepth;
+  pthread_mutex_unlock(&sampler.lock);
+
+  if (rows == NULL)
+    return;
+  qsort(rows, nrows, sizeof(top_row_t), top_compare);
+
+  int pallenedepth = __atomic_load_n(&sampler.fnstack->count, __ATOMIC_RELAXED);
+  bool tty = isatty(2);
+  fprintf(stderr, "%s%s --top: pid %ld, %.1fs, %llu samples in %.2fs (%u dropped), "
+    "depth %d Pallene / %d Lua frames\n\n",
+    tty ? "\033[H\033[2J" : "\n", progname, (long)getpid(),
+    (double)(now - sampler.started) / 1e9, (unsigned long long)samples, seconds,
+    __atomic_load_n(&sampler.dropped, __ATOMIC_RELAXED), pallenedepth, luadepth);
+  fprintf(stderr, "%7s %10s %7s %10s %12s  %s\n",
+    "SELF%", "SELF ms", "TOTAL%", "TOTAL ms", "CALLS/s", "FUNCTION");
+
+  for (int i = 0; i < nrows && i < ptconfig.top_rows; i++) {
+    const top_row_t *row = &rows[i];
+    const profile_fn_t *fn = row->fn;
+    char rate[32] = "-", label[512];
+    if (fn->id > 0 && fn->id < ncounters && seconds > 0)
+      snprintf(rate, sizeof(rate), "%.0f", (double)(counters[fn->id].calls - calls[fn->id]) / seconds);
+    profile_label(label, sizeof(label), fn);
+    fprintf(stderr, "%7.1f %10.1f %7.1f %10.1f %12s  %s\n",
+      100.0 * (double)row->self / (double)samples, (double)row->self_ns / 1e6,
+      100.0 * (double)row->total / (double)samples, (double)row->total_ns / 1e6,
+      rate, label);
+  }
+  fflush(stderr);
+  free(rows);
+
+  for (int id = 1; id < ncounters; id++)
+    calls[id] = counters[id].calls;
+  sampler.refreshed = now;
+}
+
+
+static void *top_main (void *ud) {
+  (void)ud;
+
+  pthread_mutex_lock(&sampler.lock);
+  while (!sampler.stop) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ptconfig.top_interval / 1000;
+    deadline.tv_nsec += (long)(ptconfig.top_interval % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    while (!sampler.stop
+           && pthread_cond_timedwait(&sampler.wake, &sampler.lock, &deadline) == 0)
+      ;
+    if (sampler.stop)
+      break;
+    pthread_mutex_unlock(&sampler.lock);
+    top_refresh();
+    pthread_mutex_lock(&sampler.lock);
+  }
+  pthread_mutex_unlock(&sampler.lock);
+  return NULL;
+}
+
+
+/* ---- PROFILES ---- */
+
+/* A buffer growing as needed. 'failed' tells it ran out of memory. */
+typedef struct pbuf {
+  unsigned char *data;
+  size_t len, size;
+  bool failed;
+} pbuf_t;
+
+
+static void pb_raw (pbuf_t *b, const void *data, size_t len) {
+  if (b->len + len > b->size) {
+    size_t size = b->size == 0 ? 4096 : b->size;
+    while (size < b->len + len)
+      size *= 2;
+    unsigned char *grown = realloc(b->data, size);
+    if (grown == NULL) {
+      b->failed = true;
+      return;
+    }
+    b->data = grown;
+    b->size = size;
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+
+/* Protocol buffers wire format. */
+static void pb_varint (pbuf_t *b, uint64_t v) {
+  unsigned char bytes[10];
+  size_t n = 0;
+  do {
+    bytes[n++] = (unsigned char)((v & 0x7f) | (v > 0x7f ? 0x80 : 0));
+    v >>= 7;
+  } while (v != 0);
+  pb_raw(b, bytes, n);
+}
+
+static void pb_uint (pbuf_t *b, int field, uint64_t v) {
+  pb_varint(b, (uint64_t)field << 3);
+  pb_varint(b, v);
+}
+
+static void pb_bytes (pbuf_t *b, int field, const void *data, size_t len) {
+  pb_varint(b, (uint64_t)field << 3 | 2);
+  pb_varint(b, len);
+  pb_raw(b, data, len);
+}
+
+/* Adds the message in 'sub' as 'field' and empties 'sub' for the next one. */
+static void pb_message (pbuf_t *b, int field, pbuf_t *sub) {
+  pb_bytes(b, field, sub->data, sub->len);
+  b->failed |= sub->failed;
+  sub->len = 0;
+}
+
+
+/* Numbers the strings, functions and locations of a pprof profile. Keys are
+   pointers, to interned strings or to functions, with a line. */
+typedef struct idmap {
+  const void **keys;
+  int *lines;
+  uint64_t *ids;
+  size_t size, count;
+} idmap_t;
+
+
+static size_t idmap_slot (const idmap_t *m, const void *key, int line) {
+  size_t h = ((size_t)(uintptr_t)key * 2654435761u) ^ (size_t)line * 40503u;
+  h &= m->size - 1;
+  while (m->keys[h] != NULL && (m->keys[h] != key || m->lines[h] != line))
+    h = (h + 1) & (m->size - 1);
+  return h;
+}
+
+
+/* Returns the id of 'key' and 'line', numbering them if new (then 'added' is
+   set). Returns 0 if out of memory. */
+static uint64_t idmap_get (idmap_t *m, const void *key, int line, bool *added) {
+  *added = false;
+  if (2 * (m->count + 1) > m->size) {
+    idmap_t grown = { NULL, NULL, NULL, m->size == 0 ? 256 : 2 * m->size, m->count };
+    grown.keys = calloc(grown.size, sizeof(void *));
+    grown.lines = calloc(grown.size, sizeof(int));
+    grown.ids = calloc(grown.size, sizeof(uint64_t));
+    if (grown.keys == NULL || grown.lines == NULL || grown.ids == NULL) {
+      free(grown.keys); free(grown.lines); free(grown.ids);
+      return 0;
+    }
+    for (size_t i = 0; i < m->size; i++) {
+      if (m->keys[i] == NULL) continue;
+      size_t h = idmap_slot(&grown, m->keys[i], m->lines[i]);
+      grown.keys[h] = m->keys[i];
+      grown.lines[h] = m->lines[i];
+      grown.ids[h] = m->ids[i];
+    }
+    free(m->keys); free(m->lines); free(m->ids);
+    *m = grown;
+  }
+
+  size_t h = idmap_slot(m, key, line);
+  if (m->keys[h] == NULL) {
+    m->keys[h] = key;
+    m->lines[h] = line;
+    m->ids[h] = ++m->count;
+    *added = true;
+  }
+  return m->ids[h];
+}
+
+
+static void idmap_free (idmap_t *m) {
+  free(m->keys);
+  free(m->lines);
+  free(m->ids);
+}
+
+
+/* The pprof profile under construction. */
+typedef struct pprof {
+  pbuf_t out, msg, sub, ids;
+  idmap_t strings, functions, locations;
+  pbuf_t table;              /* The string table, after the empty string. */
+} pprof_t;
+
+
+/* Index of 's' in the string table. */
+static uint64_t pprof_string (pprof_t *p, const char *s) {
+  bool added;
+  s = profile_intern(s);
+  uint64_t id = idmap_get(&p->strings, s, 0, &added);
+  if (added)
+    pb_bytes(&p->table, 6, s, strlen(s));
+  if (id == 0)
+    p->out.failed = true;
+  return id;  /* the empty string is 0 */
+}
+
+
+static void pprof_value_type (pprof_t *p, int field, const char *type, const char *unit) {
+  pb_uint(&p->sub, 1, pprof_string(p, type));
+  pb_uint(&p->sub, 2, pprof_string(p, unit));
+  pb_message(&p->out, field, &p->sub);
+}
+
+
+/* Id of the location of 'fn' at 'line', adding it and its function if new. */
+static uint64_t pprof_location (pprof_t *p, profile_fn_t *fn, int line) {
+  bool added;
+  uint64_t fid = idmap_get(&p->functions, fn, 0, &added);
+  if (added) {
+    char label[512];
+    profile_label(label, sizeof(label), fn);
+    pb_uint(&p->sub, 1, fid);
+    pb_uint(&p->sub, 2, pprof_string(p, fn->kind == 'L' && fn->name[0] == '?' ? label : fn->name));
+    pb_uint(&p->sub, 3, pprof_string(p, label));
+    pb_uint(&p->sub, 4, pprof_string(p, fn->file));
+    pb_uint(&p->sub, 5, (uint64_t)(fn->defined > 0 ? fn->defined : 0));
+    pb_message(&p->out, 5, &p->sub);
+  }
+
+  uint64_t lid = idmap_get(&p->locations, fn, line, &added);
+  if (added) {
+    pb_uint(&p->sub, 1, lid);
+    pbuf_t entry = { NULL, 0, 0, false };
+    pb_uint(&entry, 1, fid);
+    pb_uint(&entry, 2, (uint64_t)(line > 0 ? line : 0));
+    pb_message(&p->sub, 4, &entry);
+    free(entry.data);
+    pb_message(&p->out, 4, &p->sub);
+  }
+  if (fid == 0 || lid == 0)
+    p->out.failed = true;
+  return lid;
+}
+
+
+/* A sample: the locations from the leaf up to the root, and its values, the
+   calls and callbacks of 'counter' last (none if NULL). The call tree only has
+   the calls and the CPU time of every node. */
+static void pprof_sample (pprof_t *p, profile_node_t *node, const uint64_t *values,
+                          const pt_counter_t *counter) {
+  pbuf_t *ids = &p->ids;
+  for (; node->fn != NULL; node = node->parent)
+    pb_varint(ids, pprof_location(p, node->fn, node->line));
+  pb_bytes(&p->msg, 1, ids->data, ids->len);  /* packed */
+  ids->len = 0;
+
+  if (sampler.calltree) {
+    pb_varint(ids, values[PROFILE_SAMPLES]);
+    pb_varint(ids, values[PROFILE_CPU]);
+  }
+  else {
+    for (int i = 0; i < PROFILE_VALUES; i++)
+      pb_varint(ids, values[i]);
+    pb_varint(ids, counter != NULL ? counter->calls : 0);
+    pb_varint(ids, counter != NULL ? counter->callbacks : 0);
+  }
+  pb_bytes(&p->msg, 2, ids->data, ids->len);
+  ids->len = 0;
+  pb_message(&p->out, 2, &p->msg);
+}
+
+
+static void pprof_samples (pprof_t *p, profile_node_t *node) {
+  for (; node != NULL; node = node->sibling) {
+    if (node->values[PROFILE_SAMPLES] != 0 || node->values[PROFILE_CPU] != 0)
+      pprof_sample(p, node, node->values, NULL);
+    pprof_samples(p, node->child);
+  }
+}
+
+
+/* Encodes the profile in 'out' (see profile.proto of pprof). The calls of the
+   Pallene functions, and their calls back into Lua, are not sampled but
+   counted, so they come as samples of their own, with the function alone. The
+   call tree has every call in it already. */
+static bool pprof_encode (pbuf_t *out, uint64_t duration) {
+  static pt_counter_t counters[PALLENE_TRACER_MAX_DESCRIPTORS];
+  static const uint64_t none[PROFILE_VALUES];
+  pprof_t p;
+  memset(&p, 0, sizeof(p));
+
+  if (sampler.icount) {
+    pprof_value_type(&p, 1, "calls", "count");
+    pprof_value_type(&p, 1, "instructions", "count");
+  }
+  else if (sampler.calltree) {
+    pprof_value_type(&p, 1, "calls", "count");
+    pprof_value_type(&p, 1, "cpu", "nanoseconds");
+  }
+  else {
+    pprof_value_type(&p, 1, "samples", "count");
+    pprof_value_type(&p, 1, "cpu", "nanoseconds");
+    pprof_value_type(&p, 1, "wall", "nanoseconds");
+    pprof_value_type(&p, 1, "alloc_space", "bytes");
+    pprof_value_type(&p, 1, "calls", "count");
+    pprof_value_type(&p, 1, "callbacks", "count");
+  }
+
+  pprof_samples(&p, sampler.root.child);
+
+  int ncounters = sampler.calltree ? 0 : pallene_tracer_counters_merge(counters);
+  for (int id = 1; id < ncounters; id++) {
+    const pt_fn_details_t *details = pallene_tracer_descriptor(id);
+    if (details == NULL || counters[id].calls == 0)
+      continue;
+    profile_node_t leaf = { profile_fn('P', details->fn_name, details->filename, 0, id),
+                            0, &sampler.root, NULL, NULL, { 0 } };
+    if (leaf.fn != NULL)
+      pprof_sample(&p, &leaf, none, &counters[id]);
+  }
+
+  pb_uint(&p.out, 9, sampler.profile_started);
+  pb_uint(&p.out, 10, duration);
+  if (sampler.icount)
+    pprof_value_type(&p, 11, "instructions", "count");
+  else
+    pprof_value_type(&p, 11, "cpu", "nanoseconds");
+  if (!sampler.calltree)
+    pb_uint(&p.out, 12, (uint64_t)ptconfig.sample_period * 1000);
+
+  /* The string table goes last, as only now it is complete. */
+  pb_bytes(&p.out, 6, "", 0);
+  pb_raw(&p.out, p.table.data, p.table.len);
+
+  bool ok = !p.out.failed && !p.msg.failed && !p.sub.failed && !p.ids.failed
+            && !p.table.failed;
+  *out = p.out;
+  free(p.msg.data);
+  free(p.sub.data);
+  free(p.ids.data);
+  free(p.table.data);
+  idmap_free(&p.strings);
+  idmap_free(&p.functions);
+  idmap_free(&p.locations);
+  return ok;
+}
+
+
+static uint32_t gzip_crc32 (uint32_t crc, const unsigned char *data, size_t len) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int k = 0; k < 8; k++)
+      crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+  }
+  return ~crc;
+}
+
+
+/* Writes 'len' bytes as gzip, without compressing them: the deflate stream
+   has stored blocks only. It spares us a dependency, and pprof profiles are
+   small anyway. */
+static bool gzip_write (FILE *f, const unsigned char *data, size_t len) {
+  static const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+  unsigned char trailer[8];
+  uint32_t crc = gzip_crc32(0, data, len);
+  size_t done = 0;
+
+  fwrite(header, 1, sizeof(header), f);
+  do {
+    size_t n = len - done < 65535 ? len - done : 65535;
+    unsigned char block[5] = { done + n == len, (unsigned char)n, (unsigned char)(n >> 8),
+                               (unsigned char)~n, (unsigned char)(~n >> 8) };
+    fwrite(block, 1, sizeof(block), f);
+    fwrite(data + done, 1, n, f);
+    done += n;
+  } while (done < len);
+
+  for (int i = 0; i < 4; i++) {
+    trailer[i] = (unsigned char)(crc >> (8 * i));
+    trailer[4 + i] = (unsigned char)((uint32_t)len >> (8 * i));
+  }
+  fwrite(trailer, 1, sizeof(trailer), f);
+  return !ferror(f);
+}
+
+
+static bool profile_ends (const char *path, const char *suffix) {
+  size_t n = strlen(path), m = strlen(suffix);
+  return n >= m && strcmp(path + n - m, suffix) == 0;
+}
+
+
+/* A line of the folded profile: the functions from the root, then the samples,
+   or the microseconds of CPU time of the call tree. */
+static char *folded_line (profile_node_t *node) {
+  profile_node_t *path[2 * PT_LUA_SAMPLE_FRAMES];
+  int n = 0;
+  for (; node->fn != NULL && n < 2 * PT_LUA_SAMPLE_FRAMES; node = node->parent)
+    path[n++] = node;
+
+  pbuf_t line = { NULL, 0, 0, false };
+  for (int i = n - 1; i >= 0; i--) {
+    char label[512];
+    int len = profile_label(label, sizeof(label), path[i]->fn);
+    if (len < 0) continue;
+    if (len >= (int)sizeof(label)) len = sizeof(label) - 1;
+    for (char *c = label; *c != '\0'; c++) {
+      if (*c == ';') *c = ':';  /* the separator */
+    }
+    pb_raw(&line, label, len);
+    pb_raw(&line, i > 0 ? ";" : "", i > 0);
+  }
+  pb_raw(&line, "", 1);
+  if (line.failed) {
+    free(line.data);
+    return NULL;
+  }
+  return (char *)line.data;
+}
+
+
+typedef struct folded {
+  char *line;
+  uint64_t samples;
+} folded_t;
+
+
+static size_t folded_collect (folded_t *lines, size_t count, profile_node_t *node) {
+  for (; node != NULL; node = node->sibling) {
+    uint64_t samples = node->values[sampler.calltree ? PROFILE_CPU : PROFILE_SAMPLES];
+    if (samples != 0) {
+      char *line = folded_line(node);
+      if (line != NULL) {
+        lines[count].line = line;
+        lines[count++].samples = samples;
+      }
+    }
+    count = folded_collect(lines, count, node->child);
+  }
+  return count;
+}
+
+
+static size_t profile_count (profile_node_t *node) {
+  size_t n = 0;
+  for (; node != NULL; node = node->sibling)
+    n += 1 + profile_count(node->child);
+  return n;
+}
+
+
+static int folded_compare (const void *a, const void *b) {
+  return strcmp(((const folded_t *)a)->line, ((const folded_t *)b)->line);
+}
+
+
+/* Writes the folded stacks, as taken by flamegraph.pl: one line per stack
+   with its samples, sorted. Stacks which differ only by lines are merged. The
+   call tree gives microseconds of CPU time instead, leaving out what is less,
+   or instructions with '--icount'. */
+static bool folded_write (FILE *out) {
+  folded_t *lines = malloc((profile_count(sampler.root.child) + 1) * sizeof(folded_t));
+  if (lines == NULL)
+    return false;
+  size_t count = folded_collect(lines, 0, sampler.root.child);
+  qsort(lines, count, sizeof(folded_t), folded_compare);
+
+  for (size_t i = 0; i < count; ) {
+    uint64_t samples = 0;
+    size_t j = i;
+    for (; j < count && strcmp(lines[j].line, lines[i].line) == 0; j++)
+      samples += lines[j].samples;
+    if (sampler.calltree && !sampler.icount)
+      samples /= 1000;
+    if (samples != 0)
+      fprintf(out, "%s %llu\n", lines[i].line, (unsigned long long)samples);
+    i = j;
+  }
+
+  for (size_t i = 0; i < count; i++)
+    free(lines[i].line);
+  free(lines);
+  return !ferror(out);
+}
+
+
+/* Writes the profile to the file given to '--profile' or '--calltree': pprof
+   if its name ends in '.pb', '.pprof' or '.gz' (then gzipped), folded stacks
+   otherwise. A forked child adds its pid to the name. */
+static void profile_write (void) {
+  char path[4096];
+  const char *name = sampler.profile;
+  if (sampler.generation != sampler.first_generation) {
+    snprintf(path, sizeof(path), "%s.%ld", sampler.profile, (long)getpid());
+    name = path;
+  }
+
+  FILE *f = fopen(name, "wb");
+  bool ok = f != NULL;
+  if (ok) {
+    pthread_mutex_lock(&sampler.lock);
+    if (profile_ends(sampler.profile, ".gz") || profile_ends(sampler.profile, ".pb")
+        || profile_ends(sampler.profile, ".pprof")) {
+      pbuf_t out;
+      uint64_t duration = sampler_clock(CLOCK_REALTIME) - sampler.profile_started;
+      ok = pprof_encode(&out, duration);
+      if (ok && profile_ends(sampler.profile, ".gz"))
+        ok = gzip_write(f, out.data, out.len);
+      else if (ok)
+        ok = fwrite(out.data, 1, out.len, f) == out.len;
+      free(out.data);
+    }
+    else
+      ok = folded_write(f);
+    pthread_mutex_unlock(&sampler.lock);
+    ok = (fclose(f) == 0) && ok;
+  }
+  if (!ok)
+    fprintf(stderr, "%s: cannot write profile '%s': %s\n", progname, name,
+      f == NULL ? strerror(errno) : "write error");
+}
+
+
+#ifdef PT_LUA_CALLTREE
+/* ---- CALL TREE ---- */
+
+/* With '--calltree', a hook on every call and return of the Lua functions of
+   every coroutine and a listener on every Pallene frame boundary keep a shadow
+   of the stack of the running coroutine, as a path of the call tree. The CPU
+   time between two of them is charged to the node on top, and every node
+   entered counts a call. The Pallene frames stand for the C function of their
+   Lua interface frame, just like in 'debugtraceback'. Lines are not followed,
+   every node is at line 0.
+
+   With '--icount', the clock is not the CPU time but a count of what ran: Lua
+   instructions, counted by the hook as well, and the Pallene frame boundaries
+   and lines. The same script with the same input gets the same counts. */
+
+/* A Lua level or a Pallene frame of the shadow stack. */
+typedef struct calltree_entry {
+  profile_node_t *node;
+  const void *ci;            /* Of a Lua level, NULL for a Pallene frame. */
+  lua_CFunction fnptr;       /* Of a C function. */
+  int frame;                 /* Its Pallene frame, -1 if none. */
+  int below;                 /* The next entry down with a frame, -1 if none. */
+  bool black;                /* A C function whose Lua interface frame is on
+                                the Pallene call-stack, but not its C frame. */
+  uint64_t cpu;              /* Charged to the node since pushed. */
+} calltree_entry_t;
+
+/* The shadow stack of a coroutine, a userdata. */
+typedef struct calltree_stack {
+  calltree_entry_t *entries;
+  int n, size;
+  int framed;                /* The topmost entry with a frame, -1 if none. */
+} calltree_stack_t;
+
+static struct {
+  lua_State *running;        /* Coroutine of 'current'. */
+  calltree_stack_t *current; /* NULL if not known. */
+  int mirrored;              /* Pallene frames the shadow stacks know of. */
+  uint64_t last;             /* CPU time of the last event. */
+  lua_CFunction finalizer;   /* Pops the Pallene frames, left out of the tree. */
+  uint64_t instructions;     /* Lua instructions counted, with '--icount'. */
+  uint64_t boundaries;       /* Pallene frame boundaries seen, same. */
+} calltree;
+
+/* Registry fields of the table of shadow stacks, weak keyed by coroutine, and
+   of their metatable. */
+#define CALLTREE_STACKS         "__PT_LUA_CALLTREE"
+#define CALLTREE_STACK          "__PT_LUA_CALLTREE_STACK"
+
+
+static int calltree_free (lua_State *L) {
+  calltree_stack_t *st = (calltree_stack_t *)lua_touserdata(L, 1);
+  if (calltree.current == st)
+    calltree.current = NULL;
+  free(st->entries);
+  st->entries = NULL;
+  st->n = st->size = 0;
+  return 0;
+}
+
+
+/* Returns the shadow stack of 'co', adding it if new. 'L' is the one running. */
+static calltree_stack_t *calltree_stackof (lua_State *L, lua_State *co) {
+  lua_getfield(L, LUA_REGISTRYINDEX, CALLTREE_STACKS);
+  if (co == L)
+    lua_pushthread(L);
+  else {
+    lua_pushthread(co);
+    lua_xmove(co, L, 1);
+  }
+  lua_pushvalue(L, -1);
+  lua_rawget(L, -3);
+  calltree_stack_t *st = (calltree_stack_t *)lua_touserdata(L, -1);
+  if (st == NULL) {
+    lua_pop(L, 1);
+    st = (calltree_stack_t *)lua_newuserdata(L, sizeof(calltree_stack_t));
+    memset(st, 0, sizeof(calltree_stack_t));
+    st->framed = -1;
+    luaL_setmetatable(L, CALLTREE_STACK);
+    lua_rawset(L, -3);
+  }
+  else
+    lua_pop(L, 2);
+  lua_pop(L, 1);
+  return st;
+}
+
+
+/* Pushes an entry for 'node', a call of it. NULL if out of memory. */
+static calltree_entry_t *calltree_push (calltree_stack_t *st, profile_node_t *node) {
+  if (node == NULL)
+    return NULL;
+  if (st->n == st->size) {
+    int size = st->size == 0 ? 64 : 2 * st->size;
+    calltree_entry_t *entries = realloc(st->entries, size * sizeof(calltree_entry_t));
+    if (entries == NULL)
+      return NULL;
+    st->entries = entries;
+    st->size = size;
+  }
+
+  calltree_entry_t *e = &st->entries[st->n++];
+  e->node = node;
+  e->ci = NULL;
+  e->fnptr = NULL;
+  e->frame = e->below = -1;
+  e->black = false;
+  e->cpu = 0;
+  node->values[PROFILE_SAMPLES]++;
+  return e;
+}
+
+
+/* Time of the call tree: CPU time, or what ran so far with '--icount'. */
+static uint64_t calltree_clock (void) {
+  if (!sampler.icount)
+    return sampler_clock(CLOCK_THREAD_CPUTIME_ID);
+  return calltree.instructions + calltree.boundaries + sampler.fnstack->lines;
+}
+
+
+/* Pops the entries from 'n' up. */
+static void calltree_pop (calltree_stack_t *st, int n) {
+  st->n = n;
+  while (st->framed >= n)
+    st->framed = st->entries[st->framed].below;
+}
+
+
+static profile_node_t *calltree_top (calltree_stack_t *st) {
+  return st->n > 0 ? st->entries[st->n - 1].node : &sampler.root;
+}
+
+
+/* Gives the Pallene frame 'frame' to the entry on top. */
+static void calltree_frame (calltree_stack_t *st, int frame) {
+  calltree_entry_t *e = &st->entries[st->n - 1];
+  e->frame = frame;
+  e->below = st->framed;
+  st->framed = st->n - 1;
+}
+
+
+/* Pops what stood for the Pallene frames from 'count' up, and what got on top
+   of them. A Lua level stays, it is only without its frames. */
+static void calltree_unwind (calltree_stack_t *st, int count) {
+  int k = -1;
+  for (int i = st->framed; i >= 0 && st->entries[i].frame >= count; i = st->entries[i].below)
+    k = i;
+  if (k < 0)
+    return;
+
+  calltree_entry_t *e = &st->entries[k];
+  if (e->ci != NULL) {
+    calltree_pop(st, k + 1);
+    st->framed = e->below;
+    e->frame = e->below = -1;
+    e->black = false;
+  }
+  else
+    calltree_pop(st, k);
+}
+
+
+/* Brings the shadow stack of the running coroutine up to date with the Pallene
+   call-stack. The frames pushed since are only looked at while 'alive'. */
+static void calltree_sync (pt_fnstack_t *fnstack, bool alive) {
+  calltree_stack_t *st = calltree.current;
+  int count = recordedframes(fnstack);
+  int first = calltree.mirrored;
+
+  calltree.mirrored = count;
+  if (st == NULL)
+    return;
+  if (first > count)
+    calltree_unwind(st, count);
+  if (!alive)
+    return;
+
+  for (int i = first; i < count; i++) {
+    const pt_frame_t *frame = &fnstack->stack[i];
+    calltree_entry_t *top = st->n > 0 ? &st->entries[st->n - 1] : NULL;
+
+    if (frame->type != PALLENE_TRACER_FRAME_TYPE_C) {
+      /* Is it the Lua interface frame of the C function on top? */
+      if (top != NULL && top->ci != NULL && top->frame < 0
+          && top->fnptr == frame->shared.c_fnptr) {
+        calltree_frame(st, i);
+        top->black = true;
+      }
+      continue;
+    }
+
+    pt_frame_names_t names = framenames(fnstack, i);
+    profile_fn_t *fn = profile_fn('P', names.fn_name, names.filename, 0, names.id);
+    if (fn == NULL)
+      continue;
+    if (top != NULL && top->black && top->frame == i - 1) {
+      /* The C function was this Pallene function all along. */
+      profile_node_t *node = profile_child(top->node->parent, fn, 0);
+      if (node != NULL) {
+        top->node->values[PROFILE_SAMPLES]--;
+        top->node->values[PROFILE_CPU] -= top->cpu;
+        node->values[PROFILE_SAMPLES]++;
+        node->values[PROFILE_CPU] += top->cpu;
+        top->node = node;
+      }
+      top->black = false;
+    }
+    else if (calltree_push(st, profile_child(calltree_top(st), fn, 0)) != NULL)
+      calltree_frame(st, i);
+  }
+}
+
+
+/* Charges the CPU time since the last event to the node on top. What was
+   charged before a fork belongs to the parent. */
+static void calltree_charge (uint64_t now) {
+  if (sampler.generation != pallene_tracer_generation()) {
+    sampler_forked();
+    calltree.last = now;
+  }
+
+  uint64_t elapsed = now > calltree.last ? now - calltree.last : 0;
+  calltree_stack_t *st = calltree.current;
+  calltree.last = now;
+  if (st != NULL && st->n > 0) {
+    calltree_entry_t *e = &st->entries[st->n - 1];
+    e->node->values[PROFILE_CPU] += elapsed;
+    e->cpu += elapsed;
+  }
+}
+
+
+/* Makes 'co' the running coroutine. Its Pallene frames which are gone since
+   it last ran are gone from its shadow stack as well. */
+static void calltree_enter (lua_State *L, lua_State *co) {
+  calltree.current = calltree_stackof(L, co);
+  calltree.running = co;
+  calltree_unwind(calltree.current, recordedframes(sampler.fnstack));
+}
+
+
+static void calltree_switch (lua_State *L, lua_State *co) {
+  if (!sampler.armed)
+    return;
+  calltree_charge(calltree_clock());
+  calltree_sync(sampler.fnstack, true);
+  calltree_enter(L, co);
+}
+
+
+/* Listener of the Pallene frame boundaries. */
+static void calltree_listen (pt_fnstack_t *fnstack, uint64_t now, bool alive, void *ud) {
+  (void)ud;
+  if (sampler.icount) {
+    calltree.boundaries++;
+    now = calltree_clock();
+  }
+  calltree_charge(now);
+  calltree_sync(fnstack, alive);
+}
+
+
+/* Call and return hook. A Lua level is known by its 'CallInfo', so that the
+   levels an error went through are popped once a level below returns or calls
+   again. */
+static void calltree_hook (lua_State *L, lua_Debug *ar) {
+  if (!sampler.armed) {
+    lua_sethook(L, NULL, 0, 0);
+    return;
+  }
+  if (ar->event == LUA_HOOKCOUNT) {
+    /* Charged to the function on top at the next event, it stays there. */
+    calltree.instructions += (uint64_t)ptconfig.icount_period;
+    return;
+  }
+
+  calltree_charge(calltree_clock());
+  if (L != calltree.running || calltree.current == NULL)
+    calltree_enter(L, L);
+
+  /* An error calls the finalizer once it has unwound the C stack, but before
+     the finalizer drops the frames it went through: they are not alive. */
+  lua_CFunction fnptr = NULL;
+  if (ar->event != LUA_HOOKRET) {
+    lua_getinfo(L, "Snf", ar);
+    fnptr = lua_tocfunction(L, -1);
+    lua_pop(L, 1);  /* the function */
+  }
+  calltree_sync(sampler.fnstack, fnptr != calltree.finalizer);
+
+  calltree_stack_t *st = calltree.current;
+  if (ar->event == LUA_HOOKRET) {
+    if (st->n > 0 && st->entries[st->n - 1].ci == ar->i_ci) {
+      calltree_pop(st, st->n - 1);
+      return;
+    }
+    lua_getinfo(L, "f", ar);
+    fnptr = lua_tocfunction(L, -1);
+    lua_pop(L, 1);  /* the function */
+    for (int i = st->n - 1; i >= 0 && fnptr != calltree.finalizer; i--) {
+      if (st->entries[i].ci == ar->i_ci) {
+        calltree_pop(st, i);
+        break;
+      }
+    }
+    return;
+  }
+
+  /* Pops the levels which are gone without returning, up to the caller if
+     it is known. What stands for Pallene frames is up to date. */
+  lua_Debug caller;
+  const void *ci = lua_getstack(L, 1, &caller) ? caller.i_ci : NULL;
+  while (st->n > 0 && st->entries[st->n - 1].ci != NULL
+         && st->entries[st->n - 1].ci != ci)
+    calltree_pop(st, st->n - 1);
+
+  profile_frame_t f;
+  calltree_entry_t *e;
+  if (wrap_level(L, 1)) {
+    /* A wrapped C function, the node of its trampoline stands for it. */
+    profile_node_t *node = calltree_top(st);
+    e = calltree_push(st, node);
+    if (e != NULL) {
+      node->values[PROFILE_SAMPLES]--;  /* the same call */
+      e->ci = ar->i_ci;
+      e->fnptr = fnptr;
+    }
+    return;
+  }
+  if (fnptr == calltree.finalizer || !profile_lua(&f, ar))
+    return;
+  e = calltree_push(st, profile_child(calltree_top(st), f.fn, 0));
+  if (e != NULL) {
+    e->ci = ar->i_ci;
+    e->fnptr = fnptr;
+  }
+}
+
+
+static void calltree_stop (void) {
+  pallene_tracer_cputime_listen(sampler.fnstack, NULL, NULL);
+  lua_sethook(sampler.L, NULL, 0, 0);
+}
+
+#endif // PT_LUA_CALLTREE
+
+
+/* ---- START AND STOP ---- */
+
+/* Stops sampling, then shows the last window and writes the profile. Called
+   when the Lua state is closed or the process exits, whatever comes first. */
+static void sampler_stop (void) {
+  static const struct itimerval off;
+  static sample_t s;
+
+  if (!sampler.armed)
+    return;
+  sampler.armed = 0;
+  setitimer(ITIMER_PROF, &off, NULL);
+#ifdef PT_LUA_CALLTREE
+  if (sampler.calltree)
+    calltree_stop();
+#endif // PT_LUA_CALLTREE
+
+  if (sampler.generation != pallene_tracer_generation())
+    sampler_forked();
+
+  if (sampler.top) {
+    pthread_mutex_lock(&sampler.lock);
+    sampler.stop = true;
+    pthread_cond_signal(&sampler.wake);
+    pthread_mutex_unlock(&sampler.lock);
+    pthread_join(sampler.display, NULL);
+  }
+
+  sampler_drain(NULL, UINT64_MAX, &s);
+  if (sampler.top)
+    top_refresh();
+  if (sampler.profile != NULL)
+    profile_write();
+}
+
+
+static int sampler_gc (lua_State *L) {
+  (void)L;
+  sampler_stop();
+  return 0;
+}
+
+
+/* Nobody may hold the lock while we fork. */
+static void sampler_atfork_prepare (void) {
+  pthread_mutex_lock(&sampler.lock);
+}
+
+static void sampler_atfork_parent (void) {
+  pthread_mutex_unlock(&sampler.lock);
+}
+
+/* The timer is not inherited. The rest is set up again by 'sampler_forked',
+   once the child notices the new process generation. */
+static void sampler_atfork_child (void) {
+  pthread_mutex_init(&sampler.lock, NULL);
+  pthread_cond_init(&sampler.wake, NULL);
+  if (sampler.armed && sampler.profile != NULL && !sampler.calltree)
+    setitimer(ITIMER_PROF, &sampler.period, NULL);
+}
+
+
+/* Stops when the Lua state is closed or the process exits, and goes on in a
+   forked child. */
+static void sampler_register (lua_State *L) {
+  pthread_atfork(sampler_atfork_prepare, sampler_atfork_parent, sampler_atfork_child);
+  atexit(sampler_stop);
+
+  /* Stop before the call-stack goes. This userdata is finalized first, as it
+     is the newest one with a finalizer. */
+  lua_newuserdata(L, 0);
+  lua_newtable(L);
+  lua_pushcfunction(L, sampler_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, "__PT_LUA_SAMPLER");
+}
+
+
+/* Starts sampling the Lua state. With 'top', shows the hottest functions on
+   stderr every 'top_interval' milliseconds. With a 'profile' file name, writes
+   the profile there when done. Returns false if it could not start. */
+static bool sampler_start (lua_State *L, pt_fnstack_t *fnstack, bool top,
+                           const char *profile) {
+  if (fnstack == NULL)
+    return false;
+
+  sampler.thread = pthread_self();
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+  sampler.L = sampler.running = lua_tothread(L, -1);
+  lua_pop(L, 1);
+  sampler.fnstack = fnstack;
+  sampler.generation = sampler.first_generation = pallene_tracer_generation();
+  sampler.started = sampler.refreshed = sampler_clock(CLOCK_MONOTONIC);
+  sampler.profile_started = sampler_clock(CLOCK_REALTIME);
+  sampler.top = top;
+  sampler.profile = profile;
+
+  /* The display thread never takes samples. */
+  if (top) {
+    sigset_t prof, old;
+    sigemptyset(&prof);
+    sigaddset(&prof, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &prof, &old);
+    int failed = pthread_create(&sampler.display, NULL, top_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (failed)
+      return false;
+  }
+
+  if (profile != NULL) {
+    void *ud;
+    sampler.allocf = lua_getallocf(L, &ud);
+    lua_setallocf(L, sampler_alloc, ud);
+  }
+
+  sampler_register(L);
+
+  struct sigaction sa;
+  sa.sa_handler = sampler_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, NULL);
+
+  sampler.period.it_interval.tv_sec = ptconfig.sample_period / 1000000;
+  sampler.period.it_interval.tv_usec = ptconfig.sample_period % 1000000;
+  sampler.period.it_value = sampler.period.it_interval;
+  sampler.last_cpu = sampler_clock(CLOCK_THREAD_CPUTIME_ID);
+  sampler.last_wall = sampler.started;
+  sampler.armed = 1;
+  setitimer(ITIMER_PROF, &sampler.period, NULL);
+  return true;
+}
+
+
+#ifdef PT_LUA_CALLTREE
+/* Starts following every call of the Lua state, to write the call tree to the
+   'profile' file when done. Returns false if it could not start. */
+static bool calltree_start (lua_State *L, pt_fnstack_t *fnstack, const char *profile,
+                            bool icount) {
+  if (!pallene_tracer_cputime_listen(fnstack, calltree_listen, NULL))
+    return false;
+
+  sampler.thread = pthread_self();
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+  sampler.L = sampler.running = lua_tothread(L, -1);
+  lua_pop(L, 1);
+  sampler.fnstack = fnstack;
+  sampler.generation = sampler.first_generation = pallene_tracer_generation();
+  sampler.profile_started = sampler_clock(CLOCK_REALTIME);
+  sampler.profile = profile;
+  sampler.calltree = true;
+  sampler.icount = icount;
+
+  sampler_register(L);
+
+  luaL_newmetatable(L, CALLTREE_STACK);
+  lua_pushcfunction(L, calltree_free);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+  lua_newtable(L);
+  lua_newtable(L);
+  lua_pushliteral(L, "k");
+  lua_setfield(L, -2, "__mode");
+  lua_setmetatable(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, CALLTREE_STACKS);
+
+  lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_FINALIZER_ENTRY);
+  if (lua_getmetatable(L, -1)) {
+    lua_getfield(L, -1, "__close");
+    calltree.finalizer = lua_tocfunction(L, -1);
+    lua_pop(L, 2);
+  }
+  lua_pop(L, 1);
+
+  /* Coroutines get the hook of the thread which makes them. */
+  calltree.mirrored = recordedframes(fnstack);
+  calltree.last = calltree_clock();
+  sampler.armed = 1;
+  if (icount)
+    lua_sethook(sampler.L, calltree_hook, LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT,
+                ptconfig.icount_period);
+  else
+    lua_sethook(sampler.L, calltree_hook, LUA_MASKCALL | LUA_MASKRET, 0);
+  return true;
+}
+#endif // PT_LUA_CALLTREE
+
+#endif // PT_LUA_SAMPLER
+
+
+#ifdef PT_LUA_STATS
+/* ---- STATS PAGE ---- */
+
+/* A page of POSIX shared memory (see 'shm_open'), where a thread of ours
+   publishes the counters of the process every 'stats_interval' milliseconds
+   for monitors in other processes to read, e.g. tools/stats.lua. Nothing is
+   done on the hot path: the counters are there anyway, and the incidents are
+   only counted when they happen. The page goes when the Lua state is closed
+   or the process exits, a forked child publishes its own as "<name>.<pid>". */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Bytes of the stats page for the names of the functions. */
+#ifndef PT_LUA_STATS_NAMES
+#define PT_LUA_STATS_NAMES                       65536
+#endif // PT_LUA_STATS_NAMES
+
+#define STATS_HEADER            128
+
+/* Start of the stats page, version 1. It goes on with the table of states at
+   offset 128, 'max_states' entries of 'stats_state_t', then the table of
+   descriptors, 'max_descriptors' entries of 'stats_descriptor_t' indexed by
+   descriptor, then 'names_size' bytes of names. Integers are in the byte order
+   of the machine. */
+/* The page is a seqlock: readers copy it out and retry until 'seq' was the
+   same even number before and after. */
+typedef struct stats_header {
+  char magic[8];             /* "PTSTATS" */
+  uint32_t version;          /* 1 */
+  uint32_t pid;
+  uint64_t seq;              /* Odd while the page is being written. */
+  uint64_t updated;          /* CLOCK_REALTIME of the last update, in ns. */
+  uint32_t interval;         /* Milliseconds between updates. */
+  uint32_t max_states;
+  uint32_t max_descriptors;
+  uint32_t names_size;
+  uint32_t states;           /* Entries of the table of states in use. */
+  uint32_t descriptors;      /* Descriptors assigned, all of them below it. */
+  uint64_t errors;           /* See 'pt_incidents_t'. */
+  uint64_t overflows;
+  uint64_t tracebacks;       /* Made by 'msghandler'. */
+  uint64_t reserved[6];
+} stats_header_t;
+
+/* A live Lua state, in no particular order. */
+typedef struct stats_state {
+  uint32_t depth;            /* Frames on its call-stack, recorded or not. */
+  uint32_t capacity;
+} stats_state_t;
+
+/* A descriptor. 'name' is 0 if unknown or out of room, and otherwise one past
+   the offset of the function name and filename, each ending in a NUL. */
+typedef struct stats_descriptor {
+  uint64_t calls;
+  uint64_t callbacks;
+  uint32_t name;
+  uint32_t reserved;
+} stats_descriptor_t;
+
+static struct {
+  stats_header_t *page;          /* NULL unless publishing. */
+  size_t size;
+  char name[256];                /* Of the shared memory object. */
+  const char *base;              /* As given, for the name in forked children. */
+  stats_state_t *states;
+  stats_descriptor_t *descriptors;
+  char *names;
+  uint32_t names_used;
+  uint64_t tracebacks;
+  unsigned generation;           /* Of the tracer, when the page was opened. */
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  bool stop;
+} stats = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .wake = PTHREAD_COND_INITIALIZER
+};
+
+
+/* Copies the names of a descriptor to the page, if there is room. */
+static void stats_name (int id) {
+  const pt_fn_details_t *details = pallene_tracer_descriptor(id);
+  if (details == NULL)
+    return;
+  size_t fn_len = strlen(details->fn_name) + 1;
+  size_t file_len = strlen(details->filename) + 1;
+  if (fn_len + file_len > PT_LUA_STATS_NAMES - stats.names_used)
+    return;
+  memcpy(stats.names + stats.names_used, details->fn_name, fn_len);
+  memcpy(stats.names + stats.names_used + fn_len, details->filename, file_len);
+  stats.descriptors[id].name = stats.names_used + 1;
+  stats.names_used += (uint32_t)(fn_len + file_len);
+}
+
+
+static int stats_state (const pt_registry_entry_t *entry, void *ud) {
+  stats_header_t *page = (stats_header_t *)ud;
+  if (page->states >= PALLENE_TRACER_MAX_STATES)
+    return 1;
+  stats_state_t *state = &stats.states[page->states++];
+  int depth = __atomic_load_n(&entry->fnstack->count, __ATOMIC_RELAXED);
+  state->depth = depth > 0 ? (uint32_t)depth : 0;
+  state->capacity = (uint32_t)entry->fnstack->capacity;
+  return 0;
+}
+
+
+/* Writes the counters of the process to the page. Only the publishing thread
+   writes to it. */
+static void stats_publish (void) {
+  static pt_counter_t counters[PALLENE_TRACER_MAX_DESCRIPTORS];
+  stats_header_t *page = stats.page;
+  pt_incidents_t incidents;
+  struct timespec now;
+
+  int ncounters = pallene_tracer_counters_merge(counters);
+  pallene_tracer_incidents(&incidents);
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  uint64_t seq = page->seq;
+  __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  page->updated = (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+  page->states = 0;
+  pallene_tracer_registry_foreach(stats_state, page);
+  for (int id = 1; id < ncounters; id++) {
+    stats.descriptors[id].calls = counters[id].calls;
+    stats.descriptors[id].callbacks = counters[id].callbacks;
+    if (stats.descriptors[id].name == 0)
+      stats_name(id);
+  }
+  page->descriptors = (uint32_t)ncounters;
+  page->errors = incidents.errors;
+  page->overflows = incidents.overflows;
+  page->tracebacks = __atomic_load_n(&stats.tracebacks, __ATOMIC_RELAXED);
+
+  __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+
+static void *stats_main (void *ud) {
+  (void)ud;
+
+  pthread_mutex_lock(&stats.lock);
+  while (!stats.stop) {
+    pthread_mutex_unlock(&stats.lock);
+    stats_publish();
+    pthread_mutex_lock(&stats.lock);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ptconfig.stats_interval / 1000;
+    deadline.tv_nsec += (long)(ptconfig.stats_interval % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    while (!stats.stop
+           && pthread_cond_timedwait(&stats.wake, &stats.lock, &deadline) == 0)
+      ;
+  }
+  pthread_mutex_unlock(&stats.lock);
+  return NULL;
+}
+
+
+/* Creates the page of the shared memory object 'name' and the thread
+   publishing to it. Returns 0, or an 'errno' value if it could not. */
+static int stats_open (const char *name) {
+  size_t size = STATS_HEADER + PALLENE_TRACER_MAX_STATES * sizeof(stats_state_t)
+    + PALLENE_TRACER_MAX_DESCRIPTORS * sizeof(stats_descriptor_t) + PT_LUA_STATS_NAMES;
+
+  /* Names of shared memory objects start with a slash. */
+  snprintf(stats.name, sizeof(stats.name), "%s%s", name[0] == '/' ? "" : "/", name);
+  int fd = shm_open(stats.name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return errno;
+  if (ftruncate(fd, (off_t)size) != 0) {
+    int error = errno;
+    close(fd);
+    shm_unlink(stats.name);
+    return error;
+  }
+  void *page = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  int error = errno;
+  close(fd);
+  if (page == MAP_FAILED) {
+    shm_unlink(stats.name);
+    return error;
+  }
+
+  stats.page = (stats_header_t *)page;
+  stats.size = size;
+  stats.generation = pallene_tracer_generation();
+  stats.states = (stats_state_t *)((char *)page + STATS_HEADER);
+  stats.descriptors = (stats_descriptor_t *)(stats.states + PALLENE_TRACER_MAX_STATES);
+  stats.names = (char *)(stats.descriptors + PALLENE_TRACER_MAX_DESCRIPTORS);
+  stats.names_used = 0;
+
+  memcpy(stats.page->magic, "PTSTATS", 8);
+  stats.page->version = 1;
+  stats.page->pid = (uint32_t)getpid();
+  stats.page->interval = (uint32_t)ptconfig.stats_interval;
+  stats.page->max_states = PALLENE_TRACER_MAX_STATES;
+  stats.page->max_descriptors = PALLENE_TRACER_MAX_DESCRIPTORS;
+  stats.page->names_size = PT_LUA_STATS_NAMES;
+
+  /* The publishing thread never takes samples. */
+  sigset_t prof, old;
+  sigemptyset(&prof);
+  sigaddset(&prof, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &prof, &old);
+  stats.stop = false;
+  error = pthread_create(&stats.thread, NULL, stats_main, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (error != 0) {
+    munmap(page, size);
+    shm_unlink(stats.name);
+    stats.page = NULL;
+  }
+  return error;
+}
+
+
+/* Stops publishing and removes the page. Called when the Lua state is closed
+   or the process exits, whatever comes first. */
+static void stats_stop (void) {
+  if (stats.page == NULL)
+    return;
+  if (stats.generation != pallene_tracer_generation()) {
+    /* A forked child which never got to open its own. */
+    munmap(stats.page, stats.size);
+    stats.page = NULL;
+    return;
+  }
+
+  pthread_mutex_lock(&stats.lock);
+  stats.stop = true;
+  pthread_cond_signal(&stats.wake);
+  pthread_mutex_unlock(&stats.lock);
+  pthread_join(stats.thread, NULL);
+
+  munmap(stats.page, stats.size);
+  shm_unlink(stats.name);
+  stats.page = NULL;
+}
+
+
+static int stats_gc (lua_State *L) {
+  (void)L;
+  stats_stop();
+  return 0;
+}
+
+
+/* Nobody may hold the lock while we fork. */
+static void stats_atfork_prepare (void) {
+  pthread_mutex_lock(&stats.lock);
+}
+
+static void stats_atfork_parent (void) {
+  pthread_mutex_unlock(&stats.lock);
+}
+
+/* Only the lock is taken care of here, the page is left to 'stats_forked'. */
+static void stats_atfork_child (void) {
+  pthread_mutex_unlock(&stats.lock);
+}
+
+
+/* The page and its thread stay with the parent. A forked child starts over
+   with a page of its own, "<name>.<pid>", just as its counters do. Called on
+   the thread running the script. */
+static void stats_forked (lua_State *L) {
+  if (stats.page == NULL || stats.generation == pallene_tracer_generation())
+    return;
+
+  munmap(stats.page, stats.size);
+  stats.page = NULL;
+  pthread_cond_init(&stats.wake, NULL);
+  char name[256];
+  snprintf(name, sizeof(name), "%s.%ld", stats.base, (long)getpid());
+  int error = stats_open(name);
+  if (error != 0) {
+    l_message(progname, lua_pushfstring(L, "cannot open stats page '%s': %s",
+      name, strerror(error)));
+    lua_pop(L, 1);
+  }
+}
+
+
+/* Starts publishing the stats page 'name'. Returns 0, or an 'errno' value if
+   it could not. */
+static int stats_start (lua_State *L, const char *name) {
+  int error = stats_open(name);
+  if (error != 0)
+    return error;
+  stats.base = name;
+
+  pthread_atfork(stats_atfork_prepare, stats_atfork_parent, stats_atfork_child);
+  atexit(stats_stop);
+
+  /* Stop before the call-stack goes. */
+  lua_newuserdata(L, 0);
+  lua_newtable(L);
+  lua_pushcfunction(L, stats_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, "__PT_LUA_STATS");
+  return 0;
+}
+
+#endif // PT_LUA_STATS
+
+
+#ifdef PT_LUA_FORKS
+/* ---- FORKED CHILDREN ---- */
+
+/* Little is safe in the child handlers of 'pthread_atfork', as the parent may
+   have had other threads. The one here just sets a count hook on the running
+   coroutine, which then sets up the child on the thread running the script. */
+static struct {
+  pthread_t thread;              /* Thread running the Lua state. */
+  lua_State *running;            /* Running coroutine. */
+  lua_Hook hook;                 /* The hook replaced in the child. */
+  int mask;
+  int count;
+} forks;
+
+
+static void forks_hook (lua_State *L, lua_Debug *ar) {
+  lua_sethook(L, forks.hook, forks.mask, forks.count);
+#ifdef PT_RECORDER
+  recorder_forked(L);
+#endif // PT_RECORDER
+#ifdef PT_LUA_STATS
+  stats_forked(L);
+#endif // PT_LUA_STATS
+
+  /* Tail calls are told to call hooks. */
+  int event = ar->event == LUA_HOOKTAILCALL ? LUA_HOOKCALL : ar->event;
+  if (forks.hook != NULL && (forks.mask & (1 << event)))
+    forks.hook(L, ar);
+}
+
+
+static void forks_atfork_child (void) {
+  if (!pthread_equal(pthread_self(), forks.thread))
+    return;
+
+  lua_State *co = forks.running;
+  forks.hook = lua_gethook(co);
+  forks.mask = lua_gethookmask(co);
+  forks.count = lua_gethookcount(co);
+  lua_sethook(co, forks_hook, forks.mask | LUA_MASKCOUNT, 1);
+}
+
+
+/* Makes 'co' the running coroutine, the one hooked in forked children. */
+static void forks_switch (lua_State *co) {
+  forks.running = co;
+}
+
+
+static void forks_start (lua_State *L) {
+  forks.thread = pthread_self();
+  forks.running = L;
+  pthread_atfork(NULL, NULL, forks_atfork_child);
+}
+#endif // PT_LUA_FORKS
+
+
+#ifdef PT_CPUTIME
+/* 'coroutine.resume' charging the CPU time to the coroutine while it runs.
+   Upvalues: the call-stack and the original 'coroutine.resume'. */
+static int cputime_resume (lua_State *L) {
+  pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, lua_upvalueindex(1));
+  lua_State *co = lua_tothread(L, 1);
+  luaL_argexpected(L, co, 1, "coroutine");
+  lua_pushvalue(L, 1);  /* kept below, for 'wrap_park' */
+  lua_pushvalue(L, lua_upvalueindex(2));
+  lua_rotate(L, 1, 2);
+  pallene_tracer_cputime_switch(L, fnstack, co);
+#ifdef PT_LUA_SAMPLER
+  sampler_switch(L, co);
+#endif // PT_LUA_SAMPLER
+#ifdef PT_LUA_FORKS
+  forks_switch(co);
+#endif // PT_LUA_FORKS
+  int base = fnstack->count;
+  wrap_unpark(L, fnstack, 1);
+  lua_call(L, lua_gettop(L) - 2, LUA_MULTRET);
+#ifdef PT_LUA_SAMPLER
+  sampler_switch(L, L);
+#endif // PT_LUA_SAMPLER
+#ifdef PT_LUA_FORKS
+  forks_switch(L);
+#endif // PT_LUA_FORKS
+  pallene_tracer_cputime_switch(L, fnstack, L);
+  wrap_park(L, fnstack, 1, base);
+  return lua_gettop(L) - 1;
+}
+
 
-        return true;
-      }
+/* Functions made by 'coroutine.wrap', same as the ones of lcorolib.c.
+   Upvalues: the call-stack, the coroutine and the original 'coroutine.resume'. */
+static int cputime_auxwrap (lua_State *L) {
+  pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, lua_upvalueindex(1));
+  lua_State *co = lua_tothread(L, lua_upvalueindex(2));
+  lua_pushvalue(L, lua_upvalueindex(3));
+  lua_pushvalue(L, lua_upvalueindex(2));
+  lua_rotate(L, 1, 2);
+  pallene_tracer_cputime_switch(L, fnstack, co);
+#ifdef PT_LUA_SAMPLER
+  sampler_switch(L, co);
+#endif // PT_LUA_SAMPLER
+#ifdef PT_LUA_FORKS
+  forks_switch(co);
+#endif // PT_LUA_FORKS
+  int base = fnstack->count;
+  wrap_unpark(L, fnstack, lua_upvalueindex(2));
+  lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+#ifdef PT_LUA_SAMPLER
+  sampler_switch(L, L);
+#endif // PT_LUA_SAMPLER
+#ifdef PT_LUA_FORKS
+  forks_switch(L);
+#endif // PT_LUA_FORKS
+  pallene_tracer_cputime_switch(L, fnstack, L);
+  wrap_park(L, fnstack, lua_upvalueindex(2), base);
+  if (lua_toboolean(L, 1))
+    return lua_gettop(L) - 1;
+  else {  /* error object is at index 2 */
+    int stat = lua_status(co);
+    lua_settop(L, 2);
+    if (stat != LUA_OK && stat != LUA_YIELD) {  /* error in the coroutine? */
+#if LUA_VERSION_RELEASE_NUM >= 50406
+      stat = lua_closethread(co, L);  /* close its tbc variables */
+#else
+      stat = lua_resetthread(co);  /* close its tbc variables */
+#endif
+      lua_xmove(co, L, 1);  /* move error message to the caller */
     }
+    if (stat != LUA_ERRMEM &&  /* not a memory error and ... */
+        lua_type(L, -1) == LUA_TSTRING) {  /* ... error object is a string? */
+      luaL_where(L, 1);  /* get extra info, if available */
+      lua_insert(L, -2);
+      lua_concat(L, 2);
+    }
+    return lua_error(L);  /* propagate error */
+  }
+}
 
-    /* Pop the value. */
+
+/* 'coroutine.wrap' on top of 'cputime_resume'.
+   Upvalues: the call-stack and the original 'coroutine.resume'. */
+static int cputime_wrap (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  lua_State *co = lua_newthread(L);
+  lua_pushvalue(L, 1);  /* move function to the new coroutine */
+  lua_xmove(L, co, 1);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_insert(L, -2);
+  lua_pushvalue(L, lua_upvalueindex(2));
+  lua_pushcclosure(L, cputime_auxwrap, 3);
+  return 1;
+}
+
+
+/* Pushes a table with the seconds of 'times' of each Pallene function. */
+static void cputime_functions (lua_State *L, const uint64_t *times, int size) {
+  lua_newtable(L);
+  for (int id = 1; id < size; id++) {
+    const pt_fn_details_t *details = pallene_tracer_descriptor(id);
+    if (details == NULL || times[id] == 0)
+      continue;
+    lua_getfield(L, -1, details->fn_name);  /* same name, different file? */
+    lua_pushnumber(L, lua_tonumber(L, -1) + (lua_Number)times[id] / 1e9);
+    lua_setfield(L, -3, details->fn_name);
     lua_pop(L, 1);
   }
+}
 
-  return false;
+
+/* 'pallene_tracer_cputime([co])': CPU time charged to the coroutine so far, in
+   seconds, a table with the seconds charged to each Pallene function itself
+   and one with the seconds of the Lua functions each one called back.
+   Returns nil if the coroutine never ran. */
+static int cputime_get (lua_State *L) {
+  pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, lua_upvalueindex(1));
+  lua_State *co = lua_isnoneornil(L, 1) ? L : lua_tothread(L, 1);
+  luaL_argexpected(L, co, 1, "coroutine");
+  const pt_cputime_t *cputime = pallene_tracer_cputime(L, fnstack, co);
+  if (cputime == NULL) {
+    luaL_pushfail(L);
+    return 1;
+  }
+  lua_pushnumber(L, (lua_Number)cputime->total / 1e9);
+  cputime_functions(L, cputime->functions, cputime->size);
+  cputime_functions(L, cputime->callbacks, cputime->size);
+  return 3;
 }
 
 
-/* Pushes a function name if found in the global table and returns true.
-   Returns false otherwise. */
-/* Expects the function to be pushed in the stack. */
-static bool pushglobalfuncname(lua_State *L) {
-  int top = lua_gettop(L);
+/* Replaces 'coroutine.resume' and 'coroutine.wrap' so that CPU time follows
+   the running coroutine, and sets the 'pallene_tracer_cputime' global. */
+static void cputime_install (lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY);
+  pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, -1);
+  lua_pop(L, 1);
 
-  /* Start from the global table. */
-  lua_pushglobaltable(L);
+  lua_getglobal(L, "coroutine");
+  lua_pushlightuserdata(L, fnstack);
+  lua_getfield(L, -2, "resume");
+  lua_pushcclosure(L, cputime_resume, 2);
+  lua_setfield(L, -2, "resume");
+  lua_pushlightuserdata(L, fnstack);
+  lua_getfield(L, -2, "resume");
+  lua_pushcclosure(L, cputime_wrap, 2);
+  lua_setfield(L, -2, "wrap");
+  lua_pop(L, 1);
 
-  if(findfield(L, top, 2)) {
-    lua_remove(L, -2);
-    return true;
+  lua_pushlightuserdata(L, fnstack);
+  lua_pushcclosure(L, cputime_get, 1);
+  lua_setglobal(L, "pallene_tracer_cputime");
+}
+#endif
+
+
+#ifdef PT_STACKUSE
+/* 'pallene_tracer_stackuse()': a table with the bytes of native stack of the
+   frame of each Pallene function, and one with the most bytes used by a call
+   of each of them from Lua. Returns nil without the accounting. */
+static int stackuse_get (lua_State *L) {
+  pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, lua_upvalueindex(1));
+  const pt_stackuse_t *uses = pallene_tracer_stackuse(fnstack);
+  if (uses == NULL) {
+    luaL_pushfail(L);
+    return 1;
+  }
+  for (int peak = 0; peak <= 1; peak++) {
+    lua_newtable(L);
+    for (int id = 1; id < PALLENE_TRACER_MAX_DESCRIPTORS; id++) {
+      const pt_fn_details_t *details = pallene_tracer_descriptor(id);
+      lua_Integer bytes = (lua_Integer)(peak ? uses[id].peak : uses[id].frame);
+      if (details == NULL || bytes == 0)
+        continue;
+      lua_getfield(L, -1, details->fn_name);  /* same name, different file? */
+      if (lua_tointeger(L, -1) < bytes) {
+        lua_pushinteger(L, bytes);
+        lua_setfield(L, -3, details->fn_name);
+      }
+      lua_pop(L, 1);
+    }
   }
+  return 2;
+}
 
-  lua_pop(L, 1);
-  return false;
+
+/* Sets the 'pallene_tracer_stackuse' global. */
+static void stackuse_install (lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY);
+  lua_pushcclosure(L, stackuse_get, 1);
+  lua_setglobal(L, "pallene_tracer_stackuse");
 }
+#endif // PT_STACKUSE
 
 
-/* Returns the maximum number of levels in Lua stack. */
-static int countlevels(lua_State *L) {
-  lua_Debug ar;
-  int li = 1, le = 1;
+/* ---- WRAPPED C MODULES ---- */
 
-  /* Find an upper bound */
-  while (lua_getstack(L, le, &ar)) {
-    li = le, le *= 2;
-  }
+/* The C modules to wrap as they are required: names separated by commas, or
+   "*" for all of them (see 'PT_WRAP_MODULES'). */
+static const char *wrap_modules = NULL;
 
-  /* Do a binary search */
-  while (li < le) {
-    int m = (li + le) / 2;
 
-    if (lua_getstack(L, m, &ar)) li = m + 1;
-    else le = m;
-  }
+/* Details of a function of a wrapped C module, with its name. */
+typedef struct wrap_details {
+  pt_fn_details_t details;
+  char fn_name[];
+} wrap_details_t;
 
-  return le - 1;
+
+/* Pops the C interface frame once the wrapped function returned, right away or
+   after yielding. The finalizer removes the Lua interface frame, error or not. */
+static int wrap_finish (lua_State *L, int status, lua_KContext ctx) {
+  pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, lua_upvalueindex(3));
+  (void)status;
+  (void)ctx;
+  pallene_tracer_frameexit(fnstack);
+  return lua_gettop(L) - 1;
 }
 
 
-/* Counts the number of white and black frames in the Pallene call stack. */
-static void countframes(pt_fnstack_t *fnstack, int *mwhite, int *mblack) {
-  *mwhite = *mblack = 0;
+/* Trampoline of a function of a wrapped C module, calling it with the Lua
+   interface frame and C interface frame a traced module would push itself.
+   Upvalues: the function, its details, the call-stack and the finalizer. */
+static int wrap_call (lua_State *L) {
+  pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, lua_upvalueindex(3));
+  pt_fn_details_t *details = (pt_fn_details_t *) lua_touserdata(L, lua_upvalueindex(2));
+  int nargs = lua_gettop(L);
+
+  pt_frame_t lua_frame = PALLENE_TRACER_LUA_FRAME(wrap_call);
+  pallene_tracer_frameenter(fnstack, &lua_frame);
+  lua_pushvalue(L, lua_upvalueindex(4));  /* below the arguments, which go */
+  lua_insert(L, 1);
+  lua_toclose(L, 1);
+
+  pt_frame_t c_frame = PALLENE_TRACER_C_FRAME(*details);
+  pallene_tracer_frameenter(fnstack, &c_frame);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_insert(L, 2);
+  lua_callk(L, nargs, LUA_MULTRET, 0, wrap_finish);
+  return wrap_finish(L, LUA_OK, 0);
+}
 
-  for(int i = 0; i < fnstack->count; i++) {
-    *mwhite += (fnstack->stack[i].type == PALLENE_TRACER_FRAME_TYPE_C);
-    *mblack += (fnstack->stack[i].type == PALLENE_TRACER_FRAME_TYPE_LUA);
+
+/* Frames the coroutines left on the call-stack when they yielded, taken off
+   it by 'coroutine.resume' until they are resumed (see 'wrap_park'). */
+typedef struct wrap_parked {
+  pt_frame_t frame;
+  pt_frame_names_t names;
+} wrap_parked_t;
+
+/* Registry field of the parked frames, weak keyed by coroutine. */
+#define WRAP_PARKED             "__PT_LUA_WRAP_PARKED"
+
+
+/* The call-stack is shared by the coroutines, so the frames of a function
+   which yielded would be popped by whatever runs next. Takes the frames from
+   'base' up off it if the coroutine at index 'co' yielded. */
+static void wrap_park (lua_State *L, pt_fnstack_t *fnstack, int co, int base) {
+  int n = fnstack->count - base;
+  if (wrapped == 0 || n <= 0 || fnstack->count > fnstack->capacity
+      || lua_status(lua_tothread(L, co)) != LUA_YIELD)
+    return;
+
+  co = lua_absindex(L, co);
+  if (luaL_getsubtable(L, LUA_REGISTRYINDEX, WRAP_PARKED) == 0) {
+    lua_createtable(L, 0, 1);
+    lua_pushliteral(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
   }
+  lua_pushvalue(L, co);
+  wrap_parked_t *parked = (wrap_parked_t *)lua_newuserdatauv(L, n * sizeof(wrap_parked_t), 0);
+  for (int i = 0; i < n; i++) {
+    parked[i].frame = fnstack->stack[base + i];
+    parked[i].names = fnstack->names[base + i];
+  }
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+  fnstack->count = base;
 }
 
 
-/* This function is called by `debugtraceback` function decides whether to print the stack frame info string
-   pushed onto the Lua stack. The function is also responsible for printing ellipsis (skipped frames). If we
-   are skipping frames, the current frame pushed in stack is not printed. */
-/* Pops the frame string from the Lua stack. */
-/* pframes = Amount of printed frames; current count, nframes = Number of total frames to be printed. */
-static void render(lua_State *L, luaL_Buffer *buf, int pframes, int nframes) {
-  /* Should we print? Are we at any point in top or bottom printing threshold? */
-  bool should_print = (pframes <= PT_LUA_TRACEBACK_TOP_THRESHOLD)
-    || ((nframes - pframes) <= PT_LUA_TRACEBACK_BOTTOM_THRESHOLD);
-
-  if(should_print)
-    luaL_addvalue(buf);
-  else {
-    /* The frame string pushed onto the stack. We are not printing it, so just pop it out. */
+/* Puts the frames parked by the coroutine at index 'co' back on the call-stack,
+   right before it goes on. */
+static void wrap_unpark (lua_State *L, pt_fnstack_t *fnstack, int co) {
+  if (wrapped == 0)
+    return;
+  co = lua_absindex(L, co);
+  if (lua_getfield(L, LUA_REGISTRYINDEX, WRAP_PARKED) != LUA_TTABLE) {
     lua_pop(L, 1);
-
-    /* Have we escaped the threshold to skip frames? */
-    if(pframes == PT_LUA_TRACEBACK_TOP_THRESHOLD + 1) {
-      lua_pushfstring(L, "\n\n    ... (Skipped %d frames) ...\n",
-        nframes - (PT_LUA_TRACEBACK_TOP_THRESHOLD
-        + PT_LUA_TRACEBACK_BOTTOM_THRESHOLD));
-      luaL_addvalue(buf);
+    return;
+  }
+  lua_pushvalue(L, co);
+  if (lua_rawget(L, -2) == LUA_TUSERDATA) {
+    const wrap_parked_t *parked = (const wrap_parked_t *)lua_touserdata(L, -1);
+    int n = (int)(lua_rawlen(L, -1) / sizeof(wrap_parked_t));
+    for (int i = 0; i < n; i++, fnstack->count++) {
+      if (fnstack->count < fnstack->capacity) {
+        fnstack->stack[fnstack->count] = parked[i].frame;
+        fnstack->names[fnstack->count] = parked[i].names;
+      }
     }
+    lua_pushvalue(L, co);
+    lua_pushnil(L);
+    lua_rawset(L, -4);
   }
+  lua_pop(L, 2);
 }
 
 
-/* Pallene Tracer explicit traceback function to show Pallene call-stack
-   tracebacks. */
-int debugtraceback(lua_State *L, const char* msg) {
-  lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY);
-  pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, -1);
-  pt_frame_t *stack = fnstack->stack;
-  /* The point where we are in the Pallene stack. */
-  int index = fnstack->count - 1;
-  lua_pop(L, 1);
+/* 'coroutine.close', putting the parked frames of the coroutine back first, so
+   that the finalizer of its trampolines finds them.
+   Upvalues: the call-stack and the original 'coroutine.close'. */
+static int wrap_close (lua_State *L) {
+  pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, lua_upvalueindex(1));
+  luaL_argexpected(L, lua_tothread(L, 1), 1, "coroutine");
+  if (lua_status(lua_tothread(L, 1)) == LUA_YIELD)
+    wrap_unpark(L, fnstack, 1);
+  lua_pushvalue(L, lua_upvalueindex(2));
+  lua_insert(L, 1);
+  lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+  return lua_gettop(L);
+}
 
-  /* Max number of white and black frames. */
-  int mwhite, mblack;
-  countframes(fnstack, &mwhite, &mblack);
-  /* Max levels of Lua stack. */
-  int mlevel = countlevels(L);
 
-  /* Total frames we are going to print. */
-  /* Black frames are used for switching and we will start from
-     Lua stack level 1. */
-  int nframes = mlevel + mwhite - mblack - 1;
-  /* Amount of frames printed. */
-  int pframes = 0;
+/* Replaces the C function on top with a trampoline named 'name'. Its details
+   are never freed, as descriptors keep pointing to them. */
+static void wrap_function (lua_State *L, const char *name, const char *filename) {
+  size_t len = strlen(name) + 1;
+  wrap_details_t *wrap = (wrap_details_t *) malloc(sizeof(wrap_details_t) + len);
+  if (wrap == NULL)
+    luaL_error(L, "cannot wrap '%s': not enough memory", name);
+  memcpy(wrap->fn_name, name, len);
+  pt_fn_details_t details = PALLENE_TRACER_FN_DETAILS(wrap->fn_name, filename);
+  memcpy(&wrap->details, &details, sizeof(pt_fn_details_t));
 
-  luaL_Buffer buf;
-  luaL_buffinit(L, &buf);
-  lua_pushfstring(L, "%s\nstack traceback:", msg);
-  luaL_addvalue(&buf);
+  lua_pushlightuserdata(L, &wrap->details);
+  lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY);
+  lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_FINALIZER_ENTRY);
+  lua_pushcclosure(L, wrap_call, 4);
+  wrapped++;
+}
 
-  lua_Debug ar;
-  int level = 1;
-  const char *tname;
 
-  while(lua_getstack(L, level++, &ar)) {
-    /* Get information regarding the frame: name, source, linenumbers etc. */
-    lua_getinfo(L, "Slnf", &ar);
+/* Wraps the C module 'name' on top, loaded from 'filename': its C functions
+   named by strings, or the module itself if it is a C function. Functions in
+   nested tables and metatables are left alone. */
+static void wrap_module (lua_State *L, const char *name, const char *filename) {
+  size_t len = strlen(filename) + 1;
+  char *file = (char *) malloc(len);  /* never freed, same as the details */
+  if (file == NULL)
+    luaL_error(L, "cannot wrap '%s': not enough memory", name);
+  memcpy(file, filename, len);
 
-    /* If the frame is a C frame. */
-    if(lua_iscfunction(L, -1)) {
-      if(index >= 0) {
-        /* Check whether this frame is tracked (C interface frames). */
-        int check = index;
-        while(stack[check].type != PALLENE_TRACER_FRAME_TYPE_LUA)
-          check--;
+  if (lua_iscfunction(L, -1) && lua_tocfunction(L, -1) != wrap_call) {
+    wrap_function(L, name, file);
+    return;
+  }
+  if (!lua_istable(L, -1))
+    return;
+
+  int t = lua_gettop(L);
+  lua_pushnil(L);
+  while (lua_next(L, t)) {
+    if (lua_type(L, -2) == LUA_TSTRING && lua_iscfunction(L, -1)
+        && lua_tocfunction(L, -1) != wrap_call) {
+      const char *fn_name = lua_pushfstring(L, "%s.%s", name, lua_tostring(L, -2));
+      lua_insert(L, -2);
+      wrap_function(L, fn_name, file);
+      lua_pushvalue(L, -3);  /* the key */
+      lua_insert(L, -2);
+      lua_rawset(L, t);  /* an existing field, so 'lua_next' goes on */
+    }
+    lua_pop(L, 1);
+  }
+}
 
-        /* If the frame matches, we switch to printing Pallene frames. */
-        if(lua_tocfunction(L, -1) == stack[check].shared.c_fnptr) {
-          lua_pop(L, 1);  /* the function */
 
-          /* Now print all the frames in Pallene stack. */
-          for(; index > check; index--) {
-            lua_pushfstring(L, "\n    %s:%d: in function '%s'",
-              stack[index].shared.details->filename,
-              stack[index].line, stack[index].shared.details->fn_name);
-            pframes++;  /* We are printing the frame regardless of frame visibility. */
-            render(L, &buf, pframes, nframes);
-          }
+/* Loader of a module to wrap, wrapping what the loader found by the searcher
+   returns. Upvalue: that loader. */
+static int wrap_loader (lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  const char *filename = luaL_optstring(L, 2, name);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_pushvalue(L, 1);
+  lua_pushvalue(L, 2);
+  lua_call(L, 2, 1);
+  wrap_module(L, name, filename);
+  return 1;
+}
 
-          /* 'check' idx is guaranteed to be a Lua interface frame.
-             Which is basically our 'stack' index at this point. So,
-             we simply ignore the Lua interface frame. */
-          index--;
 
-          /* We are done. */
-          continue;
-        }
-      }
+/* Whether the module 'name' is one of 'wrap_modules'. */
+static bool wrap_selected (const char *name) {
+  size_t len = strlen(name);
+  const char *p = wrap_modules;
+  for (;;) {
+    const char *end = strchr(p, ',');
+    size_t n = (end != NULL) ? (size_t)(end - p) : strlen(p);
+    if ((n == 1 && *p == '*') || (n == len && strncmp(p, name, n) == 0))
+      return true;
+    if (end == NULL)
+      return false;
+    p = end + 1;
+  }
+}
 
-      /* Then it's an untracked C frame. */
-      if(pushglobalfuncname(L)) {
-        tname = lua_tostring(L, -1);
-        lua_pop(L, 1);
-      } else tname = "<?>";
 
-      lua_pop(L, 1);  /* the function */
-      lua_pushfstring(L, "\n    C: in function '%s'", tname);
-      pframes++;
-      render(L, &buf, pframes, nframes);
-    } else {
-      /* It's a Lua frame. */
+/* A C searcher of 'package.searchers', handing out a wrapping loader for the
+   modules to wrap. Upvalue: the original searcher. */
+static int wrap_searcher (lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_pushvalue(L, 1);
+  lua_call(L, 1, 2);
+  if (lua_isfunction(L, -2) && wrap_selected(name)) {
+    lua_pushvalue(L, -2);
+    lua_pushcclosure(L, wrap_loader, 1);
+    lua_replace(L, -3);
+  }
+  return 2;
+}
 
-      /* Do we have a name? */
-      if(*ar.namewhat != '\0') {
-        lua_pushfstring(L, "function '%s'", ar.name);
-        tname = lua_tostring(L, -1);
-        lua_pop(L, 1);
-      }
-      /* Is it the main chunk? */
-      else if(*ar.what == 'm')
-        tname = "<main>";
-      /* Can we deduce the name from the global table? */
-      else if(pushglobalfuncname(L)) {
-        lua_pushfstring(L, "function '%s'", lua_tostring(L, -1));
-        tname = lua_tostring(L, -1);
-        lua_pop(L, 2);
-      } else tname = "function '<?>'";
 
-      lua_pop(L, 1);  /* the function */
-      lua_pushfstring(L, "\n    %s:%d: in %s", ar.short_src,
-        ar.currentline, tname);
-      pframes++;
-      render(L, &buf, pframes, nframes);
-    }
+/* Wraps the modules of 'wrap_modules' as they are required, through the C
+   searchers of 'package.searchers': the ones of C libraries and of all-in-one
+   C libraries. Lua modules and those already loaded are left alone. */
+static void wrap_install (lua_State *L) {
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "searchers");
+  for (int i = 3; i <= 4; i++) {
+    lua_rawgeti(L, -1, i);
+    lua_pushcclosure(L, wrap_searcher, 1);
+    lua_rawseti(L, -2, i);
   }
+  lua_pop(L, 2);
 
-  luaL_pushresult(&buf);
-  return 1;
+  lua_getglobal(L, "coroutine");
+  lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY);
+  lua_getfield(L, -2, "close");
+  lua_pushcclosure(L, wrap_close, 2);
+  lua_setfield(L, -2, "close");
+  lua_pop(L, 1);
 }
 
 /* ---------------- PALLENE TRACER CODE END ---------------- */
@@ -378,6 +3140,20 @@ static void laction (int i) {
 }
 
 
+#ifdef PT_LUA_SAMPLER
+#define PT_LUA_USAGE_TOP  "  --top     show the hottest functions on stderr every second\n" \
+                          "  --profile=file  write a sampled profile to 'file'\n"
+#else
+#define PT_LUA_USAGE_TOP  ""
+#endif // PT_LUA_SAMPLER
+
+#ifdef PT_LUA_CALLTREE
+#define PT_LUA_USAGE_CALLTREE  "  --calltree=file  write a profile of every call to 'file'\n" \
+                               "  --icount=file    same, counting instructions instead of time\n"
+#else
+#define PT_LUA_USAGE_CALLTREE  ""
+#endif // PT_LUA_CALLTREE
+
 static void print_usage (const char *badoption) {
   lua_writestringerror("%s: ", progname);
   if (badoption[1] == 'e' || badoption[1] == 'l')
@@ -394,6 +3170,8 @@ static void print_usage (const char *badoption) {
   "  -v        show version information\n"
   "  -E        ignore environment variables\n"
   "  -W        turn warnings on\n"
+  PT_LUA_USAGE_TOP
+  PT_LUA_USAGE_CALLTREE
   "  --        stop handling options\n"
   "  -         stop handling options and execute stdin\n"
   ,
@@ -444,6 +3222,12 @@ static int msghandler (lua_State *L) {
 
   /* -------- PALLENE TRACER CODE -------- */
   debugtraceback(L, msg);  /* Our custom debug traceback function */
+#ifdef PT_RECORDER
+  recorderhistory(L);  /* and what led to it */
+#endif // PT_RECORDER
+#ifdef PT_LUA_STATS
+  __atomic_add_fetch(&stats.tracebacks, 1, __ATOMIC_RELAXED);
+#endif // PT_LUA_STATS
   /* -------- PALLENE TRACER CODE END -------- */
 
   return 1;  /* return the traceback */
@@ -577,6 +3361,17 @@ static int handle_script (lua_State *L, char **argv) {
 #define has_v           4       /* -v */
 #define has_e           8       /* -e */
 #define has_E           16      /* -E */
+#define has_top         32      /* --top */
+#define has_profile     64      /* --profile=file */
+#define has_calltree    128     /* --calltree=file */
+#define has_icount      256     /* --icount=file */
+
+#ifdef PT_LUA_SAMPLER
+static const char *profile_path = NULL;  /* file of option '--profile' */
+#endif // PT_LUA_SAMPLER
+#ifdef PT_LUA_CALLTREE
+static const char *calltree_path = NULL;  /* file of option '--calltree' or '--icount' */
+#endif // PT_LUA_CALLTREE
 
 
 /*
@@ -603,8 +3398,32 @@ static int collectargs (char **argv, int *first) {
         return args;  /* stop handling options */
     switch (argv[i][1]) {  /* else check option */
       case '-':  /* '--' */
-        if (argv[i][2] != '\0')  /* extra characters after '--'? */
+        if (argv[i][2] != '\0') {  /* extra characters after '--'? */
+#ifdef PT_LUA_SAMPLER
+          if (strcmp(argv[i], "--top") == 0) {  /* -------- PALLENE TRACER CODE -------- */
+            args |= has_top;
+            break;
+          }
+          if (strncmp(argv[i], "--profile=", 10) == 0 && argv[i][10] != '\0') {
+            args |= has_profile;
+            profile_path = argv[i] + 10;
+            break;
+          }
+#endif // PT_LUA_SAMPLER
+#ifdef PT_LUA_CALLTREE
+          if (strncmp(argv[i], "--calltree=", 11) == 0 && argv[i][11] != '\0') {
+            args |= has_calltree;
+            calltree_path = argv[i] + 11;
+            break;
+          }
+          if (strncmp(argv[i], "--icount=", 9) == 0 && argv[i][9] != '\0') {
+            args |= has_icount;
+            calltree_path = argv[i] + 9;
+            break;
+          }
+#endif // PT_LUA_CALLTREE
           return has_error;  /* invalid option */
+        }
         *first = i + 1;
         return args;
       case '\0':  /* '-' */
@@ -674,6 +3493,47 @@ static int runargs (lua_State *L, char **argv, int n) {
 }
 
 
+/*
+** Reads an integer setting from the environment variable 'name', if it is
+** set. Returns false (after reporting it) if the variable holds anything
+** other than an integer between 'min' and 'max'.
+*/
+static bool getenvint (lua_State *L, const char *name, int min, int max, int *value) {
+  const char *s = getenv(name);
+  char *end;
+  long n;
+  if (s == NULL) return true;  /* not set; keep the default */
+  errno = 0;
+  n = strtol(s, &end, 10);
+  if (end == s || *end != '\0' || errno == ERANGE || n < min || n > max) {
+    l_message(progname, lua_pushfstring(L, "invalid value '%s' for %s", s, name));
+    lua_pop(L, 1);
+    return false;
+  }
+  *value = (int)n;
+  return true;
+}
+
+
+/*
+** Overrides the compile-time Pallene Tracer settings with the 'PT_*'
+** environment variables. Returns 0 if any of them holds an invalid value.
+*/
+static int handle_ptenv (lua_State *L) {
+  return getenvint(L, "PT_TRACEBACK_TOP", 0, INT_MAX, &ptconfig.traceback_top)
+      && getenvint(L, "PT_TRACEBACK_BOTTOM", 0, INT_MAX, &ptconfig.traceback_bottom)
+      && getenvint(L, "PT_STACK_CAPACITY", 1, PT_LUA_MAX_STACK_CAPACITY, &ptconfig.stack_capacity)
+      && getenvint(L, "PT_SAMPLE_PERIOD", 1, INT_MAX, &ptconfig.sample_period)
+      && getenvint(L, "PT_TOP_INTERVAL", 1, INT_MAX, &ptconfig.top_interval)
+      && getenvint(L, "PT_TOP_ROWS", 1, INT_MAX, &ptconfig.top_rows)
+      && getenvint(L, "PT_RECORDER_EVENTS", 1, INT_MAX, &ptconfig.recorder_events)
+      && getenvint(L, "PT_RECORDER_HISTORY", 0, INT_MAX, &ptconfig.recorder_history)
+      && getenvint(L, "PT_TRACE_LIMIT", 0, INT_MAX, &ptconfig.trace_limit)
+      && getenvint(L, "PT_STATS_INTERVAL", 1, INT_MAX, &ptconfig.stats_interval)
+      && getenvint(L, "PT_ICOUNT_PERIOD", 1, INT_MAX, &ptconfig.icount_period);
+}
+
+
 static int handle_luainit (lua_State *L) {
   const char *name = "=" LUA_INITVARVERSION;
   const char *init = getenv(name + 1);
@@ -943,7 +3803,109 @@ static int pmain (lua_State *L) {
     lua_pushboolean(L, 1);  /* signal for libraries to ignore env. vars. */
     lua_setfield(L, LUA_REGISTRYINDEX, "LUA_NOENV");
   }
+
+  /* -------- PALLENE TRACER CODE -------- */
+  if (!(args & has_E)) {  /* no option '-E'? */
+    if (!handle_ptenv(L))  /* read PT_* variables */
+      return 0;  /* invalid setting */
+  }
+#ifdef PT_LUA_CALLTREE
+  if ((args & (has_calltree | has_icount)) && (args & (has_top | has_profile))) {
+    l_message(progname, (args & has_calltree)
+      ? "'--calltree' does not go with '--top' or '--profile'"
+      : "'--icount' does not go with '--top' or '--profile'");
+    return 0;
+  }
+  if ((args & has_calltree) && (args & has_icount)) {
+    l_message(progname, "'--calltree' does not go with '--icount'");
+    return 0;
+  }
+#endif // PT_LUA_CALLTREE
+
+  /* initialize pallene tracer */
+  pt_fnstack_t *fnstack = pallene_tracer_init_capacity(L, ptconfig.stack_capacity);
+  lua_pop(L, 1);  /* We do not need the finalizer object here */
+
+#ifdef PT_RECORDER
+  /* start the flight recorder, if asked to */
+  const char *recorder = (args & has_E) ? NULL : getenv("PT_RECORDER_FILE");
+  if (recorder != NULL && *recorder != '\0') {
+    int error = pallene_tracer_recorder_open(fnstack, recorder, ptconfig.recorder_events);
+    if (error != 0) {
+      l_message(progname, lua_pushfstring(L, "cannot open flight recorder '%s': %s",
+        recorder, strerror(error)));
+      return 0;
+    }
+  }
+
+  /* and the call trace */
+  const char *trace = (args & has_E) ? NULL : getenv("PT_TRACE_FILE");
+  if (trace != NULL && *trace != '\0') {
+    int error = pallene_tracer_trace_open(fnstack, trace, (size_t)ptconfig.trace_limit);
+    if (error != 0) {
+      l_message(progname, lua_pushfstring(L, "cannot open call trace '%s': %s",
+        trace, strerror(error)));
+      return 0;
+    }
+  }
+  recorder_forks(fnstack, recorder != NULL && *recorder != '\0' ? recorder : NULL,
+                 trace != NULL && *trace != '\0' ? trace : NULL);
+#endif // PT_RECORDER
+
+#ifdef PT_LUA_STATS
+  /* publish the stats page, if asked to */
+  const char *stats_name = (args & has_E) ? NULL : getenv("PT_STATS_NAME");
+  if (stats_name != NULL && *stats_name != '\0') {
+    int error = stats_start(L, stats_name);
+    if (error != 0) {
+      l_message(progname, lua_pushfstring(L, "cannot open stats page '%s': %s",
+        stats_name, strerror(error)));
+      return 0;
+    }
+  }
+#endif // PT_LUA_STATS
+
+#ifdef PT_LUA_FORKS
+  /* set up forked children, once they run the script */
+  forks_start(L);
+#endif // PT_LUA_FORKS
+
+  /* wrap the C modules asked for, once the standard libraries are open */
+  wrap_modules = (args & has_E) ? NULL : getenv("PT_WRAP_MODULES");
+  if (wrap_modules != NULL && *wrap_modules == '\0')
+    wrap_modules = NULL;
+
+  /* supply the message handler function with custom tracebacks. */
+  /* it is safe to set globals at this point, because no code has been run yet. */
+  lua_pushcfunction(L, msghandler);
+  lua_setglobal(L, "pallene_tracer_errhandler");
+  /* -------- PALLENE TRACER CODE END -------- */
+
   luaL_openlibs(L);  /* open standard libraries */
+#ifdef PT_CPUTIME
+  cputime_install(L);  /* -------- PALLENE TRACER CODE -------- */
+#endif
+#ifdef PT_STACKUSE
+  stackuse_install(L);  /* -------- PALLENE TRACER CODE -------- */
+#endif // PT_STACKUSE
+  if (wrap_modules != NULL)
+    wrap_install(L);  /* -------- PALLENE TRACER CODE -------- */
+#ifdef PT_LUA_SAMPLER
+  if ((args & (has_top | has_profile))  /* option '--top' or '--profile'? */
+      && !sampler_start(L, fnstack, args & has_top, profile_path)) {
+    l_message(progname, "cannot start the sampler");
+    return 0;
+  }
+#else
+  (void) fnstack;
+#endif // PT_LUA_SAMPLER
+#ifdef PT_LUA_CALLTREE
+  if ((args & (has_calltree | has_icount))  /* option '--calltree' or '--icount'? */
+      && !calltree_start(L, fnstack, calltree_path, args & has_icount)) {
+    l_message(progname, "cannot start the call tree");
+    return 0;
+  }
+#endif // PT_LUA_CALLTREE
   createargtable(L, argv, argc, script);  /* create table 'arg' */
   lua_gc(L, LUA_GCRESTART);  /* start GC... */
   lua_gc(L, LUA_GCGEN, 0, 0);  /* ...in generational mode */
@@ -979,17 +3941,6 @@ int main (int argc, char **argv) {
     return EXIT_FAILURE;
   }
   lua_gc(L, LUA_GCSTOP);  /* stop GC while building state */
-
-  /* -------- PALLENE TRACER CODE -------- */
-  (void) pallene_tracer_init(L);  /* initialize pallene tracer */
-  lua_pop(L, 1);  /* We do not need the finalizer object here */
-
-  /* supply the message handler function with custom tracebacks. */
-  /* it is safe to set globals at this point, because no code has been run yet. */
-  lua_pushcfunction(L, msghandler);
-  lua_setglobal(L, "pallene_tracer_errhandler");
-  /* -------- PALLENE TRACER CODE END -------- */
-
   lua_pushcfunction(L, &pmain);  /* to call 'pmain' in protected mode */
   lua_pushinteger(L, argc);  /* 1st argument */
   lua_pushlightuserdata(L, argv); /* 2nd argument */
@@ -8,17 +8,71 @@
 #ifndef PALLENE_TRACER_H
 #define PALLENE_TRACER_H
 
+/* The CPU time accounting needs `clock_gettime()`, which is POSIX. Has no effect
+   if a system header is included before us. */
+#if (defined(PT_CPUTIME) || defined(PT_RECORDER)) && !defined(_POSIX_C_SOURCE) \
+    && !defined(_XOPEN_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include <lua.h>
 #include <lauxlib.h>
 
 #include <stdlib.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
+#ifdef PT_CPUTIME
+#include <time.h>
+#endif // PT_CPUTIME
+
 #if LUA_VERSION_RELEASE_NUM < 50400
 #error "Pallene Tracer needs atleast Lua 5.4 to work properly"
 #endif
 
+/* The CPU time is broken down by the descriptors of the counters. */
+#if defined(PT_CPUTIME) && !defined(PT_COUNTERS)
+#define PT_COUNTERS
+#endif
+
+/* The flight recorder names functions by their descriptors. */
+#if defined(PT_RECORDER) && !defined(PT_COUNTERS)
+#define PT_COUNTERS
+#endif
+
+/* So does the native stack accounting. */
+#if defined(PT_STACKUSE) && !defined(PT_COUNTERS)
+#define PT_COUNTERS
+#endif
+
+/* The counters are merged by walking the global registry. */
+#if defined(PT_COUNTERS) && !defined(PT_REGISTRY)
+#define PT_REGISTRY
+#endif
+
+/* Frame events doing more than keeping the call-stack, which requests that are
+   not sampled skip. */
+#if defined(PT_CPUTIME) || defined(PT_RECORDER) || defined(PT_STACKUSE) || defined(PT_OBSERVER)
+#define _PALLENE_TRACER_SAMPLING
+#endif
+
+/* Frame events copying the names of C interface frames to the call-stack (see
+   `pt_frame_names_t`). Without any feature, the hot path is left alone. */
+#if defined(PT_COUNTERS) || defined(_PALLENE_TRACER_SAMPLING)
+#define _PALLENE_TRACER_NAMES
+#endif
+
+#ifdef PT_REGISTRY
+#if !defined(__GNUC__)
+#error "The Pallene Tracer global registry needs GCC compatible atomic builtins"
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#endif // PT_REGISTRY
+
 /* ---------------- MACRO DEFINITIONS ---------------- */
 
 #ifdef PT_BUILD_AS_DLL
@@ -39,27 +93,78 @@
 /* DO NOT CHANGE EVEN BY MISTAKE. */
 #define PALLENE_TRACER_FINALIZER_ENTRY  "__PALLENE_TRACER_FINALIZER"
 
-/* The size of the Pallene call-stack. */
+/* Registry key of the CPU time of every coroutine. */
 /* DO NOT CHANGE EVEN BY MISTAKE. */
+#define PALLENE_TRACER_CPUTIME_ENTRY    "__PALLENE_TRACER_CPUTIME"
+
+/* The default size of the Pallene call-stack. The actual size is stored in the
+   call-stack itself, so modules sharing a Lua state always agree on it. */
+/* Hosts can choose another size with `pallene_tracer_init_capacity()`. */
 #define PALLENE_TRACER_MAX_CALLSTACK         100000
 
+/* How many Lua states the global registry can hold at once. States created
+   while the registry is full are simply not registered. */
+#ifndef PALLENE_TRACER_MAX_STATES
+#define PALLENE_TRACER_MAX_STATES            256
+#endif // PALLENE_TRACER_MAX_STATES
+
+/* How many function descriptors the counters can tell apart. Functions seen
+   after running out of descriptors are not counted. */
+#ifndef PALLENE_TRACER_MAX_DESCRIPTORS
+#define PALLENE_TRACER_MAX_DESCRIPTORS       1024
+#endif // PALLENE_TRACER_MAX_DESCRIPTORS
+
+/* Counter shards of different threads never share a cache line. */
+#ifndef PALLENE_TRACER_CACHE_LINE
+#define PALLENE_TRACER_CACHE_LINE            64
+#endif // PALLENE_TRACER_CACHE_LINE
+
+/* Bytes of a flight recorder file for the names of the functions it saw. */
+#ifndef PALLENE_TRACER_RECORDER_NAMES
+#define PALLENE_TRACER_RECORDER_NAMES        65536
+#endif // PALLENE_TRACER_RECORDER_NAMES
+
+/* Bytes a call trace buffers before writing them to its file. */
+#ifndef PALLENE_TRACER_TRACE_BUFFER
+#define PALLENE_TRACER_TRACE_BUFFER          65536
+#endif // PALLENE_TRACER_TRACE_BUFFER
+
+#if defined(PT_RECORDER) && PALLENE_TRACER_MAX_DESCRIPTORS > (1 << 20)
+#error "The flight recorder packs descriptors in 20 bits"
+#endif
+
 /* API wrapper macros. Using these wrappers instead is raw functions
  * are highly recommended. */
 #ifdef PT_DEBUG
 #define PALLENE_TRACER_FRAMEENTER(fnstack, frame)       pallene_tracer_frameenter(fnstack, frame)
 #define PALLENE_TRACER_SETLINE(fnstack, line)           pallene_tracer_setline(fnstack, line)
 #define PALLENE_TRACER_FRAMEEXIT(fnstack)               pallene_tracer_frameexit(fnstack)
+#define PALLENE_TRACER_LUA_CALL(L, fnstack, nargs, nresults)                          \
+    pallene_tracer_lua_call(L, fnstack, nargs, nresults)
+#define PALLENE_TRACER_LUA_PCALL(L, fnstack, nargs, nresults, msgh)                   \
+    pallene_tracer_lua_pcall(L, fnstack, nargs, nresults, msgh)
+#define PALLENE_TRACER_SAMPLE(fnstack, p)               pallene_tracer_sample(fnstack, p)
 
 #else
 #define PALLENE_TRACER_FRAMEENTER(fnstack, frame)
 #define PALLENE_TRACER_SETLINE(fnstack, line)
 #define PALLENE_TRACER_FRAMEEXIT(fnstack)
+#define PALLENE_TRACER_LUA_CALL(L, fnstack, nargs, nresults)                          \
+    lua_call(L, nargs, nresults)
+#define PALLENE_TRACER_LUA_PCALL(L, fnstack, nargs, nresults, msgh)                   \
+    lua_pcall(L, nargs, nresults, msgh)
+#define PALLENE_TRACER_SAMPLE(fnstack, p)               ((void) (p), false)
 #endif // PT_DEBUG
 
 /* Not part of the API. */
+/* The counters identify functions by their details structure, and a sampler
+   may read the details of frames an error has unwound before the finalizer
+   drops them (see `pt_frame_names_t`), so they have to outlive the call. */
+#define _PALLENE_TRACER_DETAILS_STORAGE      static
+
 #ifdef PT_DEBUG
 #define _PALLENE_TRACER_PREPARE_C_FRAME(fn_name, filename, var_name)                  \
-pt_fn_details_t var_name##_details =                                                  \
+_PALLENE_TRACER_DETAILS_STORAGE pt_fn_details_t var_name##_details =                  \
     PALLENE_TRACER_FN_DETAILS(fn_name, filename);                                     \
 pt_frame_t var_name = PALLENE_TRACER_C_FRAME(var_name##_details)
 
@@ -147,8 +252,25 @@ typedef enum frame_type {
 typedef struct pt_fn_details {
     const char *const fn_name;
     const char *const filename;
+
+    /* Descriptor of the function for the counters. Assigned on first use,
+       0 if not yet assigned and -1 if we ran out of descriptors. */
+    int id;
 } pt_fn_details_t;
 
+/* Per-function counters, indexed by descriptor. */
+typedef struct pt_counter {
+    uint64_t calls;
+    uint64_t callbacks;        /* Calls back into Lua with `pallene_tracer_lua_call()`
+                                  or `pallene_tracer_lua_pcall()`. */
+} pt_counter_t;
+
+/* What went wrong in the process so far, see `pallene_tracer_incidents()`. */
+typedef struct pt_incidents {
+    uint64_t errors;           /* Lua interface frames unwound by an error. */
+    uint64_t overflows;        /* Frames pushed beyond the capacity of a call-stack. */
+} pt_incidents_t;
+
 /* A single frame representation. */
 typedef struct pt_frame {
     frame_type_t type;
@@ -160,13 +282,216 @@ typedef struct pt_frame {
     } shared;
 } pt_frame_t;
 
+/* What a C interface frame tells of its function, copied when it is pushed. An
+   error unwinds the C stack before the finalizer drops the frames it went
+   through, so the details of their functions may be gone in between while
+   these are not. The names have to outlive the call, as `__func__` and
+   `__FILE__` do. Only modules compiled with a feature macro copy them: the
+   names of a frame are its own if `details` is the one of the frame. The
+   frameenter macros keep the details static anyway, so only frames with details
+   of their own in local variables need them. */
+typedef struct pt_frame_names {
+    const pt_fn_details_t *details;  /* Of the frame they were copied from. */
+    const char *fn_name;
+    const char *filename;
+    int id;                    /* Descriptor of the function, 0 if none (yet). */
+    bool recorded;             /* Its enter went to the flight recorder or the
+                                  call trace. */
+} pt_frame_names_t;
+
+/* CPU time charged to a coroutine, in nanoseconds. */
+typedef struct pt_cputime {
+    uint64_t total;
+    uint64_t *functions;       /* Indexed by descriptor, 0 is time outside any
+                                  Pallene function. */
+    uint64_t *callbacks;       /* Indexed by descriptor, time in the Lua functions
+                                  called back with `pallene_tracer_lua_call()` or
+                                  `pallene_tracer_lua_pcall()`. */
+    int size;                  /* Number of entries in `functions` and `callbacks`. */
+
+    /* Private. */
+    struct pt_cputime_clock *clock;
+    unsigned generation;
+} pt_cputime_t;
+
+/* Native C stack used by a Pallene function, in bytes. */
+typedef struct pt_stackuse {
+    uint64_t frame;            /* Largest distance from the frame structure of its
+                                  Pallene caller to its own: about the size of its
+                                  stack frame. */
+    uint64_t peak;             /* Most stack used by a call of it from Lua, down
+                                  to the frame structure of the deepest Pallene
+                                  function it called. */
+    uint64_t peak_total;       /* Sum of those of every call from Lua. */
+    uint64_t lua_calls;        /* Calls from Lua measured, those which returned. */
+} pt_stackuse_t;
+
+/* Private. */
+/* The C stack grows downwards, so lower addresses are deeper. */
+typedef struct pt_stackuse_meter {
+    uintptr_t *sp;             /* Address of the frame structure of every frame on
+                                  the call-stack. */
+    uintptr_t *low;            /* Lowest address seen since the frame was pushed. */
+    pt_stackuse_t *uses;       /* Indexed by descriptor. */
+} pt_stackuse_meter_t;
+
 /* Our stack is fully heap-allocated stack. We need some structure to hold
    the stack information. This structure will be an Userdatum. */
 typedef struct pt_fnstack {
     pt_frame_t *stack;
     int count;
+    int capacity;
+
+    /* Names of the functions of the C interface frames, indexed as `stack`.
+       What is to be read of a frame the function of which may be gone. */
+    pt_frame_names_t *names;
+
+    /* Counter shard of the Lua state, NULL unless built with `PT_COUNTERS`.
+       Only the thread running the Lua state writes to it. */
+    pt_counter_t *counters;
+    void *counters_block;
+
+    /* CPU time accounting of the Lua state, NULL unless built with `PT_CPUTIME`. */
+    struct pt_cputime_clock *cputime;
+
+    /* Flight recorder of the Lua state, NULL unless one was opened. */
+    struct pt_recorder *recorder;
+
+    /* Call trace of the Lua state, NULL unless one was opened. */
+    struct pt_trace *trace;
+
+    /* Native stack accounting of the Lua state, NULL unless built with `PT_STACKUSE`. */
+    pt_stackuse_meter_t *stackuse;
+
+    /* Calls of `pallene_tracer_setline()` so far, by modules built with `PT_COUNTERS`. */
+    uint64_t lines;
+
+    /* Hooks told of the frame events of the Lua state, NULL unless one was
+       installed with `pallene_tracer_observe()`. */
+    const struct pt_observer *observer;
+
+    /* Frames above this many belong to a request which is not sampled, INT_MAX
+       if none, see `pallene_tracer_sample()`. They are kept and counted only. */
+    int unsampled_depth;
+    /* Frames above this many belong to a request which was sampled or not,
+       INT_MAX if none. */
+    int sample_depth;
+    /* State of the generator deciding which requests are sampled. */
+    uint64_t sample_seed;
 } pt_fnstack_t;
 
+/* Told of every frame boundary of a Lua state, see `pallene_tracer_cputime_listen()`. */
+typedef void (*pt_cputime_listener_t)(pt_fnstack_t *fnstack, uint64_t now, bool alive, void *ud);
+
+/* Hooks on the frame events of a Lua state, see `pallene_tracer_observe()`. Any
+   of them may be NULL. */
+typedef struct pt_observer {
+    /* A frame was pushed, `frame` is the one of the function. */
+    void (*enter)(pt_fnstack_t *fnstack, pt_frame_t *frame, void *ud);
+    /* The frame on top of the stack is about to be popped. */
+    void (*exit)(pt_fnstack_t *fnstack, void *ud);
+    /* The frames from `count` up are about to be dropped by the finalizer: a Lua
+       interface frame returning, or the frames an error went through if `error`. */
+    void (*unwind)(pt_fnstack_t *fnstack, int count, bool error, void *ud);
+    /* The function on top of the stack is at `line`. */
+    void (*setline)(pt_fnstack_t *fnstack, int line, void *ud);
+    void *ud;
+} pt_observer_t;
+
+/* What the flight recorder records. */
+typedef enum pt_record_kind {
+    PALLENE_TRACER_RECORD_ENTER = 1,
+    PALLENE_TRACER_RECORD_EXIT,
+    PALLENE_TRACER_RECORD_ERROR
+} pt_record_kind_t;
+
+/* An event of the flight recorder. They are packed in 64 bits, from the top:
+   3 bits of kind, 20 bits of descriptor, 20 bits of depth and 21 bits of line.
+   Larger depths and lines are clamped. */
+typedef struct pt_record {
+    pt_record_kind_t kind;
+    int id;                    /* Descriptor of the function, 0 if it has none. */
+    int depth;                 /* Frames on the call-stack, the function's included. */
+    int line;                  /* Line of the function, 0 when entering it. */
+} pt_record_t;
+
+/* Start of a flight recorder file. It goes on with the name table at offset 64,
+   `descriptors` entries of 32 bits, then `names_size` bytes of names and then
+   the ring of `capacity` events at the next multiple of 64. An entry of the
+   name table is 0 if unknown, 0xffffffff if there is no room for the name, and
+   otherwise one past the offset of the function name and filename, each ending
+   in a NUL. Integers are in the byte order of the machine. */
+typedef struct pt_recorder_header {
+    char magic[8];             /* "PTRECORD" */
+    uint32_t version;          /* 1 */
+    uint32_t pid;
+    uint32_t capacity;         /* Events in the ring, a power of two. */
+    uint32_t descriptors;
+    uint32_t names_size;
+    uint32_t names_used;
+    uint32_t closed;           /* Set when the Lua state was closed. */
+    uint32_t reserved;
+    uint64_t head;             /* Events ever recorded. The newest one is at
+                                  `(head - 1) % capacity`. */
+} pt_recorder_header_t;
+
+/* Private. */
+typedef struct pt_recorder {
+    pt_recorder_header_t *header;
+    uint32_t *names;
+    char *strings;
+    uint64_t *events;
+    uint64_t mask;
+    size_t size;
+} pt_recorder_t;
+
+/* What a call trace records. A call trace file starts with "PTTRACE" and a
+   version byte, 1, then the pid. Every event after it starts with a tag: the
+   kind in the low 3 bits and above it the descriptor of the function, as the
+   difference to the one of the event before. An enter, exit or error goes on
+   with a line, as the difference to the line of the event before which had one:
+   the line of the caller for an enter, of the function otherwise. A name goes
+   on with the function name and filename, each ending in a NUL. Numbers are
+   varints (7 bits a byte, the low ones first, as in protobuf) and differences
+   are zigzag-encoded, so that small negative ones are small as well. */
+typedef enum pt_trace_kind {
+    PALLENE_TRACER_TRACE_ENTER,    /* Called by the Pallene function below it. */
+    PALLENE_TRACER_TRACE_CALL,     /* Called from Lua, through its Lua interface
+                                      frame. Has no line. */
+    PALLENE_TRACER_TRACE_EXIT,
+    PALLENE_TRACER_TRACE_ERROR,    /* Unwound by an error, innermost first. */
+    PALLENE_TRACER_TRACE_NAME      /* Names of a descriptor, before its first event. */
+} pt_trace_kind_t;
+
+/* Private. */
+typedef struct pt_trace {
+    int fd;
+    size_t used;               /* Bytes in the buffer. */
+    size_t written;            /* Bytes in the file. */
+    size_t limit;              /* Bytes to stop at, 0 for no limit. */
+    int last_id;
+    int last_line;
+    unsigned char named[PALLENE_TRACER_MAX_DESCRIPTORS];
+    unsigned char buffer[PALLENE_TRACER_TRACE_BUFFER];
+} pt_trace_t;
+
+#ifdef PT_REGISTRY
+/* An entry of the global registry, which lists the Pallene Tracer call-stacks of
+   every live Lua state in the process. Not to be confused with the Lua registry. */
+typedef struct pt_registry_entry {
+    pt_fnstack_t *fnstack;     /* NULL if the entry is free. */
+    lua_State *L;              /* Main thread of the Lua state. */
+    pthread_t thread;          /* Thread which created the call-stack. */
+
+    /* Private. */
+    int claimed;
+    int readers;
+} pt_registry_entry_t;
+
+/* Callback for `pallene_tracer_registry_foreach()`. */
+typedef int (*pt_registry_fn_t)(const pt_registry_entry_t *entry, void *ud);
+#endif // PT_REGISTRY
+
 /* ---------------- DATA STRUCTURES END ---------------- */
 
 /* ---------------- DECLARATIONS ---------------- */
@@ -178,28 +503,497 @@ extern "C" {
 /* Initializes the Pallene Tracer. The initialization refers to creating the stack
    if not created, preparing the traceback fn and finalizers. */
 /* This function must only be called from Lua module entry point. */
-/* NOTE: Pushes the finalizer object to the stack. The object has to be closed
-   everytime you are in a Lua C function using `lua_toclose(L, idx)`. */
+/* NOTE: Pushes the finalizer object to the stack, and nothing else. The object has
+   to be closed everytime you are in a Lua C function using `lua_toclose(L, idx)`. */
 PT_API pt_fnstack_t *pallene_tracer_init(lua_State *L);
 
+/* Same as `pallene_tracer_init()`, but the call-stack is created with room for
+   `capacity` frames instead of `PALLENE_TRACER_MAX_CALLSTACK`. */
+/* The capacity only matters to whoever creates the stack first. That is generally
+   the host (e.g. `pt-lua`) and not the modules. */
+PT_API pt_fnstack_t *pallene_tracer_init_capacity(lua_State *L, int capacity);
+
+/* Decides whether the request being served, the call from Lua of the topmost
+   Lua interface frame and everything it calls, is sampled, with probability `p`.
+   The frames of a request which is not sampled are kept for tracebacks and
+   counted, but are not timed, recorded, traced, measured or observed. Returns
+   whether it is sampled. A request decides once: calls from within it get the
+   same answer. */
+PT_API bool pallene_tracer_sample(pt_fnstack_t *fnstack, double p);
+
+#ifdef PT_REGISTRY
+/* Calls `fn` for every call-stack in the global registry, from any thread, until
+   `fn` returns non-zero. Returns the number of entries visited. */
+/* The call-stack of an entry is not freed while `fn` runs, but its owner keeps
+   using it. So only read from it and never touch the Lua state. */
+PT_API int pallene_tracer_registry_foreach(pt_registry_fn_t fn, void *ud);
+
+/* Returns the number of times the process was forked, counting in the child
+   only. Anything per-process (threads, timers, files) is stale once it changes. */
+/* In the child, the global registry keeps the Lua states created by the forking
+   thread and its counters and CPU times start over from zero. */
+PT_API unsigned pallene_tracer_generation(void);
+#endif // PT_REGISTRY
+
+#ifdef PT_COUNTERS
+/* Assigns a descriptor to `details` if it has none. Returns the descriptor, or
+   -1 if there are no descriptors left. */
+PT_API int pallene_tracer_descriptor_id(pt_fn_details_t *details);
+
+/* Returns the details of a descriptor, or NULL if it is not assigned. */
+PT_API const pt_fn_details_t *pallene_tracer_descriptor(int id);
+
+/* Sums up the counters of every Lua state, live or gone, into `totals`, which
+   must hold `PALLENE_TRACER_MAX_DESCRIPTORS` entries. Returns the number of
+   assigned descriptors, all of them below that number. */
+PT_API int pallene_tracer_counters_merge(pt_counter_t *totals);
+
+/* Copies the incidents of every Lua state so far, live or gone, into `incidents`. */
+/* They are only counted when they happen, so that they cost nothing otherwise. */
+PT_API void pallene_tracer_incidents(pt_incidents_t *incidents);
+
+/* Not part of the API. */
+PT_API void _pallene_tracer_count_overflow(void);
+
+/* Not part of the API. */
+static inline void _pallene_tracer_count_call(pt_fnstack_t *fnstack, pt_fn_details_t *details) {
+    int id = details->id;
+    if(luai_unlikely(id == 0))
+        id = pallene_tracer_descriptor_id(details);
+
+    /* Readers on other threads may look at it anytime, but we are the only
+       writer. So a plain store will do. */
+    if(luai_likely(id > 0)) {
+        pt_counter_t *counter = &fnstack->counters[id];
+        __atomic_store_n(&counter->calls, counter->calls + 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Not part of the API. */
+/* Counts a call back into Lua by the function on top of the stack. It got its
+   descriptor when it was entered. */
+static inline void _pallene_tracer_count_callback(pt_fnstack_t *fnstack) {
+    if(fnstack->count > 0 && fnstack->count <= fnstack->capacity) {
+        pt_frame_t *top = &fnstack->stack[fnstack->count - 1];
+        if(top->type == PALLENE_TRACER_FRAME_TYPE_C && top->shared.details->id > 0) {
+            pt_counter_t *counter = &fnstack->counters[top->shared.details->id];
+            __atomic_store_n(&counter->callbacks, counter->callbacks + 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+#endif // PT_COUNTERS
+
+#ifdef PT_CPUTIME
+/* Makes `co` the running coroutine as far as CPU time is concerned, charging the
+   time so far to the previous one. Hosts call it around `lua_resume()`: with the
+   coroutine before resuming it and with the resumer once it returns or yields. */
+PT_API void pallene_tracer_cputime_switch(lua_State *L, pt_fnstack_t *fnstack, lua_State *co);
+
+/* Returns the CPU time charged to `co` so far, or NULL if it never ran while
+   switched to. The result is valid until `co` is collected. */
+PT_API const pt_cputime_t *pallene_tracer_cputime(lua_State *L, pt_fnstack_t *fnstack, lua_State *co);
+
+/* Calls `listener` at every frame boundary of the Lua state from then on, once the
+   time so far is charged, or no more if NULL. It gets the CPU time of the thread
+   at that point, in nanoseconds, and whether the function on top of the stack is
+   `alive`: the details of the frames of a function unwound by an error may be
+   gone. Returns false if the Lua state has no CPU time accounting. */
+PT_API bool pallene_tracer_cputime_listen(pt_fnstack_t *fnstack, pt_cputime_listener_t listener, void *ud);
+
+/* Not part of the API. */
+/* Charges the time since the last frame boundary to the function which was on
+   top of the stack. Called right after the stack changes, `alive` tells whether
+   the function now on top is still running. */
+PT_API void _pallene_tracer_cputime_charge(pt_fnstack_t *fnstack, bool alive);
+
+/* Not part of the API. */
+/* Charges the time so far, and from then on the time of the function on top of
+   the stack at `depth` goes to its Lua callbacks. Returns the previous depth. */
+PT_API int _pallene_tracer_cputime_callback(pt_fnstack_t *fnstack, int depth);
+#endif // PT_CPUTIME
+
+#ifdef PT_OBSERVER
+/* Calls the hooks of `observer` on the frame events of the Lua state from then
+   on, or no more if NULL. The observer is not copied. */
+PT_API void pallene_tracer_observe(pt_fnstack_t *fnstack, const pt_observer_t *observer);
+#endif // PT_OBSERVER
+
+#ifdef PT_RECORDER
+/* Starts the flight recorder of the Lua state of `fnstack`: a ring of its last
+   `events` (rounded up to a power of two) Pallene function enters, exits and
+   errors, in the file at `path` mapped to memory. The file is created, or
+   truncated. Returns 0, or an `errno` value if it could not. */
+/* The events are in the file as soon as they happen, so they are there even
+   if the process gets killed. Only C interface frames are recorded. */
+PT_API int pallene_tracer_recorder_open(pt_fnstack_t *fnstack, const char *path, int events);
+
+/* Decodes the event recorded `back` events before the newest one. Returns false
+   if there is no such event (any longer). */
+PT_API bool pallene_tracer_recorder_event(pt_fnstack_t *fnstack, uint64_t back, pt_record_t *record);
+
+/* Not part of the API. */
+PT_API void _pallene_tracer_recorder_name(pt_recorder_t *recorder, int id);
+
+/* Not part of the API. */
+/* Descriptor of a function running, for the flight recorder and the call
+   trace: 0 if it has none. */
+static inline int _pallene_tracer_record_id(pt_fn_details_t *details) {
+    int id = details->id;
+    if(luai_unlikely(id == 0))
+        id = pallene_tracer_descriptor_id(details);
+    return id > 0 ? id : 0;
+}
+
+/* Not part of the API. */
+/* Appends an event to the ring: a plain store, the name of the function being
+   copied to the file the first time only. */
+static inline void _pallene_tracer_record(pt_fnstack_t *fnstack, pt_record_kind_t kind,
+    int id, int line) {
+    pt_recorder_t *recorder = fnstack->recorder;
+    if(luai_unlikely(recorder->names[id] == 0))
+        _pallene_tracer_recorder_name(recorder, id);
+
+    uint64_t depth = fnstack->count < 0xfffff ? (uint64_t) fnstack->count : 0xfffff;
+    uint64_t at = line < 0 ? 0 : line < 0x1fffff ? (uint64_t) line : 0x1fffff;
+    uint64_t head = recorder->header->head;
+    recorder->events[head & recorder->mask] =
+        (uint64_t) kind << 61 | (uint64_t) id << 41 | depth << 21 | at;
+
+    /* A reader of the file sees the event before it is counted. */
+    __atomic_store_n(&recorder->header->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Not part of the API. */
+/* Records an event of the function on top of the stack, if it is a Pallene one. */
+static inline void _pallene_tracer_record_top(pt_fnstack_t *fnstack, pt_record_kind_t kind) {
+    if(fnstack->count > 0 && fnstack->count <= fnstack->capacity) {
+        pt_frame_t *top = &fnstack->stack[fnstack->count - 1];
+        if(top->type == PALLENE_TRACER_FRAME_TYPE_C)
+            _pallene_tracer_record(fnstack, kind, _pallene_tracer_record_id(top->shared.details),
+                top->line);
+    }
+}
+
+/* Starts the call trace of the Lua state of `fnstack`: every Pallene function
+   enter, exit and error from then on, written to the file at `path` in the
+   compact format of `pt_trace_kind_t`. The file is created, or truncated, and
+   the trace stops once about `limit` bytes are written, 0 for no limit. Returns
+   0, or an `errno` value if it could not. */
+/* Events are buffered, they are all in the file once the trace is closed, or
+   the Lua state is. bench/replay.c plays a trace back. */
+PT_API int pallene_tracer_trace_open(pt_fnstack_t *fnstack, const char *path, size_t limit);
+
+/* Writes out what the call trace of `fnstack` buffered and stops it, if any. */
+PT_API void pallene_tracer_trace_close(pt_fnstack_t *fnstack);
+
+/* Not part of the API. */
+PT_API void _pallene_tracer_trace_flush(pt_fnstack_t *fnstack);
+
+/* Not part of the API. */
+PT_API void _pallene_tracer_trace_name(pt_fnstack_t *fnstack, int id);
+
+/* Not part of the API. */
+static inline unsigned char *_pallene_tracer_trace_varint(unsigned char *at, uint32_t v) {
+    while(v >= 0x80) {
+        *at++ = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    *at++ = (unsigned char) v;
+    return at;
+}
+
+/* Not part of the API. */
+static inline uint32_t _pallene_tracer_trace_zigzag(int v) {
+    return v < 0 ? ~((uint32_t) v << 1) : (uint32_t) v << 1;
+}
+
+/* Not part of the API. */
+/* Appends an event to the buffer of the call trace, at most 10 bytes. */
+static inline void _pallene_tracer_trace(pt_fnstack_t *fnstack, pt_trace_kind_t kind,
+    int id, int line) {
+    pt_trace_t *trace = fnstack->trace;
+    if(luai_unlikely(trace == NULL))
+        return;
+
+    if(luai_unlikely(trace->named[id] == 0))
+        _pallene_tracer_trace_name(fnstack, id);
+    if(luai_unlikely(fnstack->trace != NULL
+        && fnstack->trace->used > PALLENE_TRACER_TRACE_BUFFER - 10))
+        _pallene_tracer_trace_flush(fnstack);
+
+    /* Flushing stops the trace when it fails, or is over the limit. */
+    trace = fnstack->trace;
+    if(luai_unlikely(trace == NULL))
+        return;
+
+    unsigned char *at = trace->buffer + trace->used;
+    at = _pallene_tracer_trace_varint(at,
+        _pallene_tracer_trace_zigzag(id - trace->last_id) << 3 | (uint32_t) kind);
+    trace->last_id = id;
+    if(kind != PALLENE_TRACER_TRACE_CALL) {
+        at = _pallene_tracer_trace_varint(at, _pallene_tracer_trace_zigzag(line - trace->last_line));
+        trace->last_line = line;
+    }
+    trace->used = (size_t) (at - trace->buffer);
+}
+
+/* Not part of the API. */
+/* Traces the Pallene function just pushed to the stack, which is a C frame. */
+static inline void _pallene_tracer_trace_enter(pt_fnstack_t *fnstack, int id) {
+    /* Frames beyond the capacity are not traced, nor are their exits. */
+    if(fnstack->count > fnstack->capacity)
+        return;
+
+    pt_frame_t *top = &fnstack->stack[fnstack->count - 1];
+    pt_frame_t *caller = fnstack->count > 1 ? top - 1 : NULL;
+    if(caller != NULL && caller->type == PALLENE_TRACER_FRAME_TYPE_LUA)
+        _pallene_tracer_trace(fnstack, PALLENE_TRACER_TRACE_CALL, id, 0);
+    else
+        _pallene_tracer_trace(fnstack, PALLENE_TRACER_TRACE_ENTER, id,
+            caller != NULL ? caller->line : 0);
+}
+
+/* Not part of the API. */
+/* Traces an exit or error of the function on top of the stack, if it is a Pallene one. */
+static inline void _pallene_tracer_trace_top(pt_fnstack_t *fnstack, pt_trace_kind_t kind) {
+    if(fnstack->count > 0 && fnstack->count <= fnstack->capacity) {
+        pt_frame_t *top = &fnstack->stack[fnstack->count - 1];
+        if(top->type == PALLENE_TRACER_FRAME_TYPE_C)
+            _pallene_tracer_trace(fnstack, kind, _pallene_tracer_record_id(top->shared.details),
+                top->line);
+    }
+}
+
+/* Not part of the API. */
+/* Records and traces the enter of the Pallene function just pushed to the
+   stack, which is a C frame, and marks its frame so that an error unwinding
+   it is recorded and traced as well. */
+static inline void _pallene_tracer_record_enter(pt_fnstack_t *fnstack, pt_fn_details_t *details) {
+    int id = _pallene_tracer_record_id(details);
+    if(fnstack->count <= fnstack->capacity) {
+        pt_frame_names_t *names = &fnstack->names[fnstack->count - 1];
+        names->id = id;
+        names->recorded = true;
+    }
+    if(fnstack->recorder != NULL)
+        _pallene_tracer_record(fnstack, PALLENE_TRACER_RECORD_ENTER, id, 0);
+    if(fnstack->trace != NULL)
+        _pallene_tracer_trace_enter(fnstack, id);
+}
+#endif // PT_RECORDER
+
+#ifdef PT_STACKUSE
+/* Returns the native stack used by the Pallene functions of the Lua state so
+   far, `PALLENE_TRACER_MAX_DESCRIPTORS` entries indexed by descriptor, or NULL
+   if it has no accounting. Only to be read by the thread running it. */
+/* Frame structures are local variables of the functions pushing them, so their
+   addresses tell where the C stack was. */
+PT_API const pt_stackuse_t *pallene_tracer_stackuse(pt_fnstack_t *fnstack);
+
+/* Not part of the API. */
+/* Takes the address of the frame just pushed to the stack. */
+static inline void _pallene_tracer_stackuse_enter(pt_fnstack_t *fnstack, pt_frame_t *frame) {
+    pt_stackuse_meter_t *meter = fnstack->stackuse;
+    int top = fnstack->count - 1;
+    if(luai_unlikely(top >= fnstack->capacity))
+        return;
+
+    uintptr_t sp = (uintptr_t) frame;
+    meter->sp[top] = sp;
+    meter->low[top] = sp;
+
+    /* The Lua interface frame below a C frame is of the same function. */
+    if(top > 0 && frame->type == PALLENE_TRACER_FRAME_TYPE_C
+        && fnstack->stack[top - 1].type == PALLENE_TRACER_FRAME_TYPE_C) {
+        int id = frame->shared.details->id;
+        uintptr_t caller = meter->sp[top - 1];
+        if(id > 0 && caller > sp && caller - sp > meter->uses[id].frame)
+            meter->uses[id].frame = caller - sp;
+    }
+}
+
+/* Not part of the API. */
+PT_API void _pallene_tracer_stackuse_call(pt_fnstack_t *fnstack, int top);
+
+/* Not part of the API. */
+/* The frame on top of the stack goes, the one below it gets its deepest point. */
+static inline void _pallene_tracer_stackuse_exit(pt_fnstack_t *fnstack) {
+    pt_stackuse_meter_t *meter = fnstack->stackuse;
+    int top = fnstack->count - 1;
+    if(top <= 0 || top >= fnstack->capacity)
+        return;
+
+    if(meter->low[top] < meter->low[top - 1])
+        meter->low[top - 1] = meter->low[top];
+    /* Calls of requests which are not sampled were not followed all the way. */
+    if(fnstack->stack[top - 1].type == PALLENE_TRACER_FRAME_TYPE_LUA
+        && fnstack->stack[top].type == PALLENE_TRACER_FRAME_TYPE_C
+        && fnstack->unsampled_depth == INT_MAX)
+        _pallene_tracer_stackuse_call(fnstack, top);
+}
+#endif // PT_STACKUSE
+
 /* Pushes a frame to the stack. The frame structure is self-managed for every function. */
 static inline void pallene_tracer_frameenter(pt_fnstack_t *fnstack, pt_frame_t *restrict frame) {
     /* Have we ran out of stack entries? If we do, stop pushing frames. */
-    if(luai_likely(fnstack->count < PALLENE_TRACER_MAX_CALLSTACK))
+    if(luai_likely(fnstack->count < fnstack->capacity)) {
         fnstack->stack[fnstack->count] = *frame;
-
+#ifdef _PALLENE_TRACER_NAMES
+        if(frame->type == PALLENE_TRACER_FRAME_TYPE_C) {
+            pt_frame_names_t *names = &fnstack->names[fnstack->count];
+            names->details = frame->shared.details;
+            names->fn_name = frame->shared.details->fn_name;
+            names->filename = frame->shared.details->filename;
+            names->id = frame->shared.details->id;
+            names->recorded = false;
+        }
+#endif // _PALLENE_TRACER_NAMES
+    }
+#ifdef PT_COUNTERS
+    else
+        _pallene_tracer_count_overflow();
+#endif // PT_COUNTERS
+
+    /* A signal handler on this thread (e.g. the sampler of `pt-lua`) must never
+       see the frame counted before it is written. It costs no instructions. */
+#ifdef __GNUC__
+    __atomic_signal_fence(__ATOMIC_RELEASE);
+#endif // __GNUC__
     fnstack->count++;
+
+#ifdef PT_COUNTERS
+    if(frame->type == PALLENE_TRACER_FRAME_TYPE_C && fnstack->counters != NULL)
+        _pallene_tracer_count_call(fnstack, frame->shared.details);
+#endif // PT_COUNTERS
+
+#ifdef _PALLENE_TRACER_SAMPLING
+    /* A request which is not sampled gets no more than that. */
+    if(luai_unlikely(fnstack->count > fnstack->unsampled_depth))
+        return;
+#endif // _PALLENE_TRACER_SAMPLING
+
+#ifdef PT_STACKUSE
+    /* After the counters, which assign the descriptor. */
+    if(fnstack->stackuse != NULL)
+        _pallene_tracer_stackuse_enter(fnstack, frame);
+#endif // PT_STACKUSE
+
+#ifdef PT_RECORDER
+    if(frame->type == PALLENE_TRACER_FRAME_TYPE_C
+        && (fnstack->recorder != NULL || fnstack->trace != NULL))
+        _pallene_tracer_record_enter(fnstack, frame->shared.details);
+#endif // PT_RECORDER
+
+#ifdef PT_CPUTIME
+    if(fnstack->cputime != NULL)
+        _pallene_tracer_cputime_charge(fnstack, true);
+#endif // PT_CPUTIME
+
+#ifdef PT_OBSERVER
+    if(fnstack->observer != NULL && fnstack->observer->enter != NULL)
+        fnstack->observer->enter(fnstack, frame, fnstack->observer->ud);
+#endif // PT_OBSERVER
 }
 
 /* Sets line number to the topmost frame in the stack. */
 static inline void pallene_tracer_setline(pt_fnstack_t *fnstack, int line) {
-    if(luai_likely(fnstack->count != 0))
+    /* Frames pushed after running out of stack entries are not recorded. */
+    if(luai_likely(fnstack->count != 0 && fnstack->count <= fnstack->capacity))
         fnstack->stack[fnstack->count - 1].line = line;
+
+#ifdef PT_COUNTERS
+    fnstack->lines++;
+#endif // PT_COUNTERS
+
+#ifdef PT_OBSERVER
+    if(fnstack->observer != NULL && fnstack->observer->setline != NULL
+        && fnstack->count <= fnstack->unsampled_depth)
+        fnstack->observer->setline(fnstack, line, fnstack->observer->ud);
+#endif // PT_OBSERVER
 }
 
 /* Removes the last frame from the stack. */
 static inline void pallene_tracer_frameexit(pt_fnstack_t *fnstack) {
+#ifdef _PALLENE_TRACER_SAMPLING
+    /* The frame of a request which is not sampled, there is nothing else to do. */
+    if(luai_unlikely(fnstack->count > fnstack->unsampled_depth)) {
+        fnstack->count--;
+        return;
+    }
+#endif // _PALLENE_TRACER_SAMPLING
+
+#ifdef PT_OBSERVER
+    if(fnstack->observer != NULL && fnstack->observer->exit != NULL)
+        fnstack->observer->exit(fnstack, fnstack->observer->ud);
+#endif // PT_OBSERVER
+
+#ifdef PT_RECORDER
+    if(fnstack->recorder != NULL)
+        _pallene_tracer_record_top(fnstack, PALLENE_TRACER_RECORD_EXIT);
+    if(fnstack->trace != NULL)
+        _pallene_tracer_trace_top(fnstack, PALLENE_TRACER_TRACE_EXIT);
+#endif // PT_RECORDER
+
+#ifdef PT_STACKUSE
+    if(fnstack->stackuse != NULL)
+        _pallene_tracer_stackuse_exit(fnstack);
+#endif // PT_STACKUSE
+
     fnstack->count -= (fnstack->count > 0);
+
+#ifdef PT_CPUTIME
+    if(fnstack->cputime != NULL)
+        _pallene_tracer_cputime_charge(fnstack, true);
+#endif // PT_CPUTIME
+}
+
+/* Not part of the API. */
+/* A Pallene function calls back into Lua. Returns what to hand over to
+   `_pallene_tracer_callback_exit()` once it returns. */
+static inline int _pallene_tracer_callback_enter(pt_fnstack_t *fnstack) {
+    int saved = 0;
+    (void) fnstack;
+#ifdef PT_COUNTERS
+    if(fnstack->counters != NULL)
+        _pallene_tracer_count_callback(fnstack);
+#endif // PT_COUNTERS
+
+#ifdef PT_CPUTIME
+    if(fnstack->cputime != NULL && fnstack->count <= fnstack->unsampled_depth)
+        saved = _pallene_tracer_cputime_callback(fnstack, fnstack->count);
+#endif // PT_CPUTIME
+    return saved;
+}
+
+/* Not part of the API. */
+static inline void _pallene_tracer_callback_exit(pt_fnstack_t *fnstack, int saved) {
+#ifdef PT_CPUTIME
+    if(fnstack->cputime != NULL && fnstack->count <= fnstack->unsampled_depth)
+        _pallene_tracer_cputime_callback(fnstack, saved);
+#else
+    (void) fnstack;
+    (void) saved;
+#endif // PT_CPUTIME
+}
+
+/* Calls a Lua function from the Pallene function on top of the stack, just like
+   `lua_call()`. The call is counted as a callback of the function, and with
+   `PT_CPUTIME` the time until it returns is charged to its callbacks rather than
+   to the function itself. */
+static inline void pallene_tracer_lua_call(lua_State *L, pt_fnstack_t *fnstack,
+    int nargs, int nresults) {
+    int saved = _pallene_tracer_callback_enter(fnstack);
+    lua_call(L, nargs, nresults);
+    _pallene_tracer_callback_exit(fnstack, saved);
+}
+
+/* Same as `pallene_tracer_lua_call()`, but as `lua_pcall()`. */
+static inline int pallene_tracer_lua_pcall(lua_State *L, pt_fnstack_t *fnstack,
+    int nargs, int nresults, int msgh) {
+    int saved = _pallene_tracer_callback_enter(fnstack);
+    int status = lua_pcall(L, nargs, nresults, msgh);
+    _pallene_tracer_callback_exit(fnstack, saved);
+    return status;
 }
 
 #ifdef __cplusplus
@@ -214,34 +1008,485 @@ static inline void pallene_tracer_frameexit(pt_fnstack_t *fnstack) {
 /* This is implementation guard, making sure we include the implementation just one time. */
 #define PT_IMPLEMENTED
 
+#ifdef PT_RECORDER
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif // PT_RECORDER
+
 /* ---------------- PRIVATE ---------------- */
 
+#ifdef PT_COUNTERS
+/* Incidents of every Lua state. Not static, for the same reason as the global
+   registry. */
+pt_incidents_t _pallene_tracer_incidents;
+#endif // PT_COUNTERS
+
+#ifdef PT_STACKUSE
+/* Sets up the native stack accounting of a new call-stack. */
+static void _pallene_tracer_stackuse_new(pt_fnstack_t *fnstack) {
+    pt_stackuse_meter_t *meter = malloc(sizeof(pt_stackuse_meter_t));
+    if(meter == NULL)
+        return;
+
+    meter->sp = malloc(fnstack->capacity * sizeof(uintptr_t));
+    meter->low = malloc(fnstack->capacity * sizeof(uintptr_t));
+    meter->uses = calloc(PALLENE_TRACER_MAX_DESCRIPTORS, sizeof(pt_stackuse_t));
+    if(meter->sp == NULL || meter->low == NULL || meter->uses == NULL) {
+        free(meter->sp);
+        free(meter->low);
+        free(meter->uses);
+        free(meter);
+        return;
+    }
+    fnstack->stackuse = meter;
+}
+
+static void _pallene_tracer_stackuse_free(pt_fnstack_t *fnstack) {
+    pt_stackuse_meter_t *meter = fnstack->stackuse;
+    if(meter == NULL)
+        return;
+
+    free(meter->sp);
+    free(meter->low);
+    free(meter->uses);
+    free(meter);
+}
+#endif // PT_STACKUSE
+
 /* When we encounter a runtime error, `pallene_tracer_frameexit()` may not
    get called. Therefore, the stack will get corrupted if the previous
    call-frames are not removed. The finalizer function makes sure it
    does not happen. Its guardian angel. */
 /* The finalizer function will be called from a to-be-closed value (since
    Lua 5.4). If you are using Lua version prior 5.4, you are outta luck. */
+#ifdef PT_OBSERVER
+/* Tells the observer of the Lua state that the frames from `count` up go, unless
+   the Lua interface frame at `count` belongs to a request which is not sampled.
+   The second argument of the finalizer is the error object, if any. */
+static void _pallene_tracer_observe_unwind(lua_State *L, pt_fnstack_t *fnstack, int count) {
+    const pt_observer_t *observer = fnstack->observer;
+    if(observer != NULL && observer->unwind != NULL && count < fnstack->unsampled_depth)
+        observer->unwind(fnstack, count, !lua_isnil(L, 2), observer->ud);
+}
+#endif // PT_OBSERVER
+
 static int _pallene_tracer_finalizer(lua_State *L) {
     /* Get the userdata. */
     pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, lua_upvalueindex(1));
 
+#ifdef PT_COUNTERS
+    /* The second argument is the error object, if any. */
+    if(!lua_isnil(L, 2))
+        __atomic_add_fetch(&_pallene_tracer_incidents.errors, 1, __ATOMIC_RELAXED);
+#endif // PT_COUNTERS
+
+    /* Frames beyond the capacity were never recorded. We can not know how many
+       of them belong to this Lua frame, so just remove the Lua frame itself. */
+    if(luai_unlikely(fnstack->count > fnstack->capacity)) {
+#ifdef PT_OBSERVER
+        _pallene_tracer_observe_unwind(L, fnstack, fnstack->count - 1);
+#endif // PT_OBSERVER
+        fnstack->count--;
+        goto out;
+    }
+
     /* Remove all the frames until last Lua frame. */
+    /* After an overflow the Lua frame might be gone, never go below the bottom. */
     int idx = fnstack->count - 1;
-    while(fnstack->stack[idx].type != PALLENE_TRACER_FRAME_TYPE_LUA)
+    while(idx >= 0 && fnstack->stack[idx].type != PALLENE_TRACER_FRAME_TYPE_LUA)
         idx--;
 
+#ifdef PT_OBSERVER
+    _pallene_tracer_observe_unwind(L, fnstack, idx > 0 ? idx : 0);
+#endif // PT_OBSERVER
+
+#ifdef PT_RECORDER
+    /* Where the error went through, innermost first. The second argument is
+       the error object. The functions are gone, so are the details of those
+       which were local variables: only frames which were recorded or traced
+       entering are, with the descriptor they were then. */
+    if((fnstack->recorder != NULL || fnstack->trace != NULL) && !lua_isnil(L, 2)) {
+        while(fnstack->count > idx + 1) {
+            const pt_frame_t *top = &fnstack->stack[fnstack->count - 1];
+            const pt_frame_names_t *names = &fnstack->names[fnstack->count - 1];
+            if(top->type == PALLENE_TRACER_FRAME_TYPE_C && names->recorded
+                && names->details == top->shared.details) {
+                if(fnstack->recorder != NULL)
+                    _pallene_tracer_record(fnstack, PALLENE_TRACER_RECORD_ERROR, names->id,
+                        top->line);
+                if(fnstack->trace != NULL)
+                    _pallene_tracer_trace(fnstack, PALLENE_TRACER_TRACE_ERROR, names->id,
+                        top->line);
+            }
+            fnstack->count--;
+        }
+    }
+#endif // PT_RECORDER
+
     /* Remove the Lua frame as well. */
-    fnstack->count = idx;
+    fnstack->count = idx > 0 ? idx : 0;
+
+out:
+    /* The request which was sampled or not is over. */
+    if(fnstack->count < fnstack->sample_depth) {
+        fnstack->sample_depth = INT_MAX;
+        fnstack->unsampled_depth = INT_MAX;
+    }
+
+#ifdef PT_CPUTIME
+    /* When unwinding an error, the functions of the frames left on top are gone
+       as well. The second argument is the error object, if any. */
+    if(fnstack->cputime != NULL && fnstack->count <= fnstack->unsampled_depth)
+        _pallene_tracer_cputime_charge(fnstack, lua_isnil(L, 2));
+#endif // PT_CPUTIME
 
     return 0;
 }
 
+#ifdef PT_RECORDER
+/* Stops the flight recorder of a call-stack. The file stays, marked `closed` if
+   the Lua state is. */
+static void _pallene_tracer_recorder_close(pt_fnstack_t *fnstack, bool closed) {
+    pt_recorder_t *recorder = fnstack->recorder;
+    if(recorder == NULL)
+        return;
+
+    fnstack->recorder = NULL;
+    if(closed)
+        __atomic_store_n(&recorder->header->closed, 1, __ATOMIC_RELEASE);
+    munmap(recorder->header, recorder->size);
+    free(recorder);
+}
+
+/* Stops the call trace of a call-stack, writing out what it buffered if `flush`. */
+static void _pallene_tracer_trace_stop(pt_fnstack_t *fnstack, bool flush) {
+    pt_trace_t *trace = fnstack->trace;
+    if(trace == NULL)
+        return;
+
+    if(flush) {
+        const unsigned char *at = trace->buffer;
+        while(trace->used > 0) {
+            ssize_t n = write(trace->fd, at, trace->used);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                break;
+            at += n;
+            trace->used -= (size_t) n;
+        }
+    }
+
+    fnstack->trace = NULL;
+    close(trace->fd);
+    free(trace);
+}
+#endif // PT_RECORDER
+
+#ifdef PT_REGISTRY
+/* The global registry. It is not static, so that modules loaded by a host which
+   exports its symbols (e.g. `pt-lua`) share the host's registry. */
+pt_registry_entry_t _pallene_tracer_registry[PALLENE_TRACER_MAX_STATES];
+
+/* Bumped in the child after every fork. */
+unsigned _pallene_tracer_generation;
+
+static void _pallene_tracer_atfork_prepare(void);
+static void _pallene_tracer_atfork_parent(void);
+static void _pallene_tracer_atfork_child(void);
+
+static void _pallene_tracer_atfork_install(void) {
+    pthread_atfork(_pallene_tracer_atfork_prepare, _pallene_tracer_atfork_parent,
+        _pallene_tracer_atfork_child);
+}
+
+/* Adds a call-stack to the global registry. */
+static void _pallene_tracer_register(lua_State *L, pt_fnstack_t *fnstack) {
+    static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+    pthread_once(&atfork_once, _pallene_tracer_atfork_install);
+
+    for(int i = 0; i < PALLENE_TRACER_MAX_STATES; i++) {
+        pt_registry_entry_t *entry = &_pallene_tracer_registry[i];
+        int expected = 0;
+
+        if(!__atomic_compare_exchange_n(&entry->claimed, &expected, 1, false,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+
+        /* Fill in the entry before publishing the call-stack. */
+        lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+        entry->L = lua_tothread(L, -1);
+        lua_pop(L, 1);
+        entry->thread = pthread_self();
+        __atomic_store_n(&entry->fnstack, fnstack, __ATOMIC_SEQ_CST);
+        return;
+    }
+}
+
+/* Removes a call-stack from the global registry. The call-stack is a userdata the
+   Lua state frees right after, so this blocks until the readers still looking at
+   it are done, giving up the CPU meanwhile. Readers never block. */
+static void _pallene_tracer_unregister(pt_fnstack_t *fnstack) {
+    for(int i = 0; i < PALLENE_TRACER_MAX_STATES; i++) {
+        pt_registry_entry_t *entry = &_pallene_tracer_registry[i];
+        if(__atomic_load_n(&entry->fnstack, __ATOMIC_RELAXED) != fnstack)
+            continue;
+
+        __atomic_store_n(&entry->fnstack, NULL, __ATOMIC_SEQ_CST);
+        while(__atomic_load_n(&entry->readers, __ATOMIC_SEQ_CST) != 0)
+            sched_yield();
+        __atomic_store_n(&entry->claimed, 0, __ATOMIC_RELEASE);
+        return;
+    }
+}
+#endif // PT_REGISTRY
+
+#ifdef PT_COUNTERS
+/* Details of every assigned descriptor. Descriptor 0 is never assigned. Like the
+   registry, there is one table per implementation, while the counter shard of a
+   Lua state is shared by all of its modules. */
+pt_fn_details_t *_pallene_tracer_descriptors[PALLENE_TRACER_MAX_DESCRIPTORS];
+int _pallene_tracer_descriptor_count = 1;
+
+/* Counters of the Lua states which are gone. */
+pt_counter_t _pallene_tracer_retired[PALLENE_TRACER_MAX_DESCRIPTORS];
+
+/* Odd while the counters of a Lua state move to the retired ones, so that
+   readers don't count them twice or miss them. */
+unsigned _pallene_tracer_counters_seq;
+pthread_mutex_t _pallene_tracer_counters_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Allocates the counter shard of a call-stack, on a cache line of its own. */
+static void _pallene_tracer_counters_new(pt_fnstack_t *fnstack) {
+    size_t size = PALLENE_TRACER_MAX_DESCRIPTORS * sizeof(pt_counter_t);
+    size = (size + PALLENE_TRACER_CACHE_LINE - 1) & ~(size_t) (PALLENE_TRACER_CACHE_LINE - 1);
+
+    fnstack->counters_block = calloc(1, size + PALLENE_TRACER_CACHE_LINE);
+    if(fnstack->counters_block == NULL)
+        return;
+
+    uintptr_t addr = (uintptr_t) fnstack->counters_block + PALLENE_TRACER_CACHE_LINE - 1;
+    fnstack->counters = (pt_counter_t *) (addr & ~(uintptr_t) (PALLENE_TRACER_CACHE_LINE - 1));
+}
+
+/* Moves the counters of a call-stack to the retired ones and removes it from the
+   global registry. */
+static void _pallene_tracer_counters_retire(pt_fnstack_t *fnstack) {
+    pthread_mutex_lock(&_pallene_tracer_counters_lock);
+    __atomic_add_fetch(&_pallene_tracer_counters_seq, 1, __ATOMIC_SEQ_CST);
+
+    if(fnstack->counters != NULL) {
+        for(int id = 1; id < PALLENE_TRACER_MAX_DESCRIPTORS; id++) {
+            __atomic_add_fetch(&_pallene_tracer_retired[id].calls,
+                fnstack->counters[id].calls, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&_pallene_tracer_retired[id].callbacks,
+                fnstack->counters[id].callbacks, __ATOMIC_RELAXED);
+        }
+    }
+    _pallene_tracer_unregister(fnstack);
+
+    __atomic_add_fetch(&_pallene_tracer_counters_seq, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&_pallene_tracer_counters_lock);
+
+    free(fnstack->counters_block);
+}
+
+/* Adds the counter shard of a live Lua state to the totals. */
+static int _pallene_tracer_counters_add(const pt_registry_entry_t *entry, void *ud) {
+    pt_counter_t *totals = (pt_counter_t *) ud;
+    pt_counter_t *counters = entry->fnstack->counters;
+
+    if(counters != NULL) {
+        for(int id = 1; id < PALLENE_TRACER_MAX_DESCRIPTORS; id++) {
+            totals[id].calls += __atomic_load_n(&counters[id].calls, __ATOMIC_RELAXED);
+            totals[id].callbacks += __atomic_load_n(&counters[id].callbacks, __ATOMIC_RELAXED);
+        }
+    }
+
+    return 0;
+}
+#endif // PT_COUNTERS
+
+#ifdef PT_REGISTRY
+/* Nobody may be retiring counters while we fork. */
+static void _pallene_tracer_atfork_prepare(void) {
+#ifdef PT_COUNTERS
+    pthread_mutex_lock(&_pallene_tracer_counters_lock);
+#endif // PT_COUNTERS
+}
+
+static void _pallene_tracer_atfork_parent(void) {
+#ifdef PT_COUNTERS
+    pthread_mutex_unlock(&_pallene_tracer_counters_lock);
+#endif // PT_COUNTERS
+}
+
+/* Only the forking thread lives on in the child. The Lua states of the other
+   threads will never run again, and so they leave the global registry. The
+   rest starts over as a fresh process. */
+static void _pallene_tracer_atfork_child(void) {
+    pthread_t self = pthread_self();
+
+    for(int i = 0; i < PALLENE_TRACER_MAX_STATES; i++) {
+        pt_registry_entry_t *entry = &_pallene_tracer_registry[i];
+
+        /* Readers were other threads. */
+        entry->readers = 0;
+        if(entry->fnstack != NULL && !pthread_equal(entry->thread, self)) {
+            entry->fnstack = NULL;
+            entry->claimed = 0;
+        }
+
+#ifdef PT_COUNTERS
+        if(entry->fnstack != NULL && entry->fnstack->counters != NULL)
+            memset(entry->fnstack->counters, 0,
+                PALLENE_TRACER_MAX_DESCRIPTORS * sizeof(pt_counter_t));
+#endif // PT_COUNTERS
+
+#ifdef PT_STACKUSE
+        if(entry->fnstack != NULL && entry->fnstack->stackuse != NULL)
+            memset(entry->fnstack->stackuse->uses, 0,
+                PALLENE_TRACER_MAX_DESCRIPTORS * sizeof(pt_stackuse_t));
+#endif // PT_STACKUSE
+
+#ifdef PT_RECORDER
+        /* The files are the parent's, which goes on writing to them. */
+        if(entry->fnstack != NULL) {
+            _pallene_tracer_recorder_close(entry->fnstack, false);
+            _pallene_tracer_trace_stop(entry->fnstack, false);
+        }
+#endif // PT_RECORDER
+    }
+
+#ifdef PT_COUNTERS
+    memset(_pallene_tracer_retired, 0, sizeof(_pallene_tracer_retired));
+    memset(&_pallene_tracer_incidents, 0, sizeof(_pallene_tracer_incidents));
+    _pallene_tracer_counters_seq = 0;
+    pthread_mutex_init(&_pallene_tracer_counters_lock, NULL);
+#endif // PT_COUNTERS
+
+    /* The CPU time clocks notice this one by themselves. */
+    _pallene_tracer_generation++;
+}
+#endif // PT_REGISTRY
+
+#ifdef PT_CPUTIME
+/* The clock of a Lua state. */
+struct pt_cputime_clock {
+    pt_cputime_t *current;     /* Coroutine being charged, NULL if none. */
+    uint64_t last;             /* When we last charged. */
+    int id;                    /* Descriptor of the topmost function. */
+    bool callback;             /* Whether it is in a Lua callback of it. */
+    int callback_depth;        /* Stack depth of the innermost function calling
+                                  back into Lua, 0 if none. */
+    unsigned generation;       /* Process generation of `last`. */
+    pt_cputime_listener_t listener;  /* NULL if none. */
+    void *listener_ud;
+};
+
+static uint64_t _pallene_tracer_cputime_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/* Frees the per-function times of a coroutine. */
+/* This function will be used as `__gc` metamethod of the CPU time userdata. */
+static int _pallene_tracer_cputime_free(lua_State *L) {
+    pt_cputime_t *cputime = (pt_cputime_t *) lua_touserdata(L, 1);
+    if(cputime->clock->current == cputime)
+        cputime->clock->current = NULL;
+    free(cputime->functions);
+    free(cputime->callbacks);
+
+    return 0;
+}
+
+/* Finds the CPU time of `co`, creating it if `create` is set. */
+static pt_cputime_t *_pallene_tracer_cputime_get(lua_State *L, pt_fnstack_t *fnstack,
+    lua_State *co, bool create) {
+    pt_cputime_t *cputime = NULL;
+    int top = lua_gettop(L);
+
+    lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CPUTIME_ENTRY);
+    lua_pushthread(co);
+    lua_xmove(co, L, 1);
+    if(lua_rawget(L, -2) == LUA_TUSERDATA) {
+        cputime = (pt_cputime_t *) lua_touserdata(L, -1);
+    } else if(create) {
+        cputime = (pt_cputime_t *) lua_newuserdata(L, sizeof(pt_cputime_t));
+        cputime->total = 0;
+        cputime->functions = NULL;
+        cputime->callbacks = NULL;
+        cputime->size = 0;
+        cputime->clock = fnstack->cputime;
+        cputime->generation = _pallene_tracer_generation;
+
+        lua_newtable(L);
+        lua_pushcfunction(L, _pallene_tracer_cputime_free);
+        lua_setfield(L, -2, "__gc");
+        lua_setmetatable(L, -2);
+
+        /* The table has weak keys, so the userdata goes with its coroutine. */
+        lua_pushthread(co);
+        lua_xmove(co, L, 1);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, -5);
+    }
+    lua_settop(L, top);
+
+    return cputime;
+}
+
+/* Sets up the clock of a new call-stack, charging the main thread. */
+static void _pallene_tracer_cputime_new(lua_State *L, pt_fnstack_t *fnstack) {
+    fnstack->cputime = malloc(sizeof(struct pt_cputime_clock));
+    if(fnstack->cputime == NULL)
+        return;
+
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushliteral(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CPUTIME_ENTRY);
+
+    fnstack->cputime->current = NULL;
+    fnstack->cputime->last = _pallene_tracer_cputime_now();
+    fnstack->cputime->id = 0;
+    fnstack->cputime->callback = false;
+    fnstack->cputime->callback_depth = 0;
+    fnstack->cputime->generation = _pallene_tracer_generation;
+    fnstack->cputime->listener = NULL;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+    fnstack->cputime->current = _pallene_tracer_cputime_get(L, fnstack, lua_tothread(L, -1), true);
+    lua_pop(L, 1);
+}
+#endif // PT_CPUTIME
+
 /* Frees the heap-allocated resources. */
 /* This function will be used as `__gc` metamethod to free our stack. */
 static int _pallene_tracer_free_resources(lua_State *L) {
     pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, 1);
+#ifdef PT_RECORDER
+    _pallene_tracer_recorder_close(fnstack, true);
+    _pallene_tracer_trace_stop(fnstack, true);
+#endif // PT_RECORDER
+#if defined(PT_COUNTERS)
+    _pallene_tracer_counters_retire(fnstack);
+#elif defined(PT_REGISTRY)
+    _pallene_tracer_unregister(fnstack);
+#endif // PT_COUNTERS
+#ifdef PT_STACKUSE
+    _pallene_tracer_stackuse_free(fnstack);
+#endif // PT_STACKUSE
     free(fnstack->stack);
+    free(fnstack->names);
+    free(fnstack->cputime);
 
     return 0;
 }
@@ -253,11 +1498,18 @@ static int _pallene_tracer_free_resources(lua_State *L) {
 /* Initializes the Pallene Tracer. The initialization refers to creating the stack
    if not created, preparing the traceback fn and finalizers. */
 /* This function must only be called from Lua module entry point. */
-/* NOTE: Pushes the finalizer object to the stack. The object has to be closed
-   everytime you are in a Lua C function using `lua_toclose(L, idx)`. */
+/* NOTE: Pushes the finalizer object to the stack, and nothing else. The object has
+   to be closed everytime you are in a Lua C function using `lua_toclose(L, idx)`. */
 /* ALSO NOTE: The stack and finalizer object would be returned if and only if `PT_DEBUG`
    is set. Otherwise, a NULL pointer would be returned alongside a NIL value pushed onto the stack. */
 pt_fnstack_t *pallene_tracer_init(lua_State *L) {
+    return pallene_tracer_init_capacity(L, PALLENE_TRACER_MAX_CALLSTACK);
+}
+
+/* Same as `pallene_tracer_init()`, but the call-stack is created with room for
+   `capacity` frames instead of `PALLENE_TRACER_MAX_CALLSTACK`. */
+/* The capacity is ignored if the stack has already been created. */
+pt_fnstack_t *pallene_tracer_init_capacity(lua_State *L, int capacity) {
 #ifdef PT_DEBUG
     pt_fnstack_t *fnstack = NULL;
 
@@ -266,9 +1518,34 @@ pt_fnstack_t *pallene_tracer_init(lua_State *L) {
 
     /* If we don't find any userdata, initialize resources. */
     if(luai_unlikely(lua_isnil(L, -1) == 1)) {
+        lua_pop(L, 1);
         fnstack = (pt_fnstack_t *) lua_newuserdata(L, sizeof(pt_fnstack_t));
-        fnstack->stack = malloc(PALLENE_TRACER_MAX_CALLSTACK * sizeof(pt_frame_t));
+        fnstack->stack = malloc(capacity * sizeof(pt_frame_t));
+        fnstack->names = calloc(capacity, sizeof(pt_frame_names_t));
+        if(luai_unlikely(fnstack->stack == NULL || fnstack->names == NULL)) {
+            free(fnstack->stack);
+            free(fnstack->names);
+            luaL_error(L, "not enough memory for a call-stack of %d frames", capacity);
+        }
         fnstack->count = 0;
+        fnstack->capacity = capacity;
+        fnstack->counters = NULL;
+        fnstack->counters_block = NULL;
+        fnstack->cputime = NULL;
+        fnstack->recorder = NULL;
+        fnstack->trace = NULL;
+        fnstack->stackuse = NULL;
+        fnstack->lines = 0;
+        fnstack->observer = NULL;
+        fnstack->unsampled_depth = INT_MAX;
+        fnstack->sample_depth = INT_MAX;
+        fnstack->sample_seed = (uint64_t) (uintptr_t) fnstack * UINT64_C(0x9E3779B97F4A7C15) | 1;
+#ifdef PT_COUNTERS
+        _pallene_tracer_counters_new(fnstack);
+#endif // PT_COUNTERS
+#ifdef PT_STACKUSE
+        _pallene_tracer_stackuse_new(fnstack);
+#endif // PT_STACKUSE
 
         /* Prepare the `__gc` finalizer to free the stack. */
         lua_newtable(L);
@@ -276,6 +1553,16 @@ pt_fnstack_t *pallene_tracer_init(lua_State *L) {
         lua_setfield(L, -2, "__gc");
         lua_setmetatable(L, -2);
 
+#ifdef PT_CPUTIME
+        /* After the `__gc` metamethod of the call-stack, so that `lua_close()`
+           finalizes the CPU time of the coroutines before the clock goes. */
+        _pallene_tracer_cputime_new(L, fnstack);
+#endif // PT_CPUTIME
+
+#ifdef PT_REGISTRY
+        _pallene_tracer_register(L, fnstack);
+#endif // PT_REGISTRY
+
         /* This is our finalizer which will reside in the value stack. */
         lua_newtable(L);
         lua_newtable(L);
@@ -296,17 +1583,555 @@ pt_fnstack_t *pallene_tracer_init(lua_State *L) {
         lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_FINALIZER_ENTRY);
     } else {
         fnstack = lua_touserdata(L, -1);
+        lua_pop(L, 1);
         lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_FINALIZER_ENTRY);
     }
 
     return fnstack;
 #else
     /* No debug mode, no stack and finalizer object. Regardless we need to fill in the blanks. */
+    /* Nor any use for our private functions. */
+    (void) capacity;
+    (void) _pallene_tracer_finalizer;
+    (void) _pallene_tracer_free_resources;
+#ifdef PT_REGISTRY
+    (void) _pallene_tracer_register;
+#endif // PT_REGISTRY
+#ifdef PT_COUNTERS
+    (void) _pallene_tracer_counters_new;
+#endif // PT_COUNTERS
+#ifdef PT_CPUTIME
+    (void) _pallene_tracer_cputime_new;
+#endif // PT_CPUTIME
+#ifdef PT_STACKUSE
+    (void) _pallene_tracer_stackuse_new;
+#endif // PT_STACKUSE
+#ifdef PT_RECORDER
+    (void) _pallene_tracer_recorder_close;
+    (void) _pallene_tracer_trace_stop;
+#endif // PT_RECORDER
     lua_pushnil(L);
     return NULL;
 #endif // PT_DEBUG
 }
 
+/* Decides whether the request of the topmost Lua interface frame is sampled,
+   with probability `p`, unless it already did. */
+/* Frames from the current depth up are of the request. Those pushed before the
+   decision keep their events, so that every event recorded has its match. */
+bool pallene_tracer_sample(pt_fnstack_t *fnstack, double p) {
+    if(fnstack == NULL)
+        return false;
+
+    if(fnstack->sample_depth != INT_MAX)
+        return fnstack->unsampled_depth == INT_MAX;
+
+    /* Not serving a call from Lua, nothing would end the request. */
+    int idx = (fnstack->count < fnstack->capacity ? fnstack->count : fnstack->capacity) - 1;
+    while(idx >= 0 && fnstack->stack[idx].type != PALLENE_TRACER_FRAME_TYPE_LUA)
+        idx--;
+    if(idx < 0)
+        return true;
+
+    /* xorshift64*, the top 53 bits make a double in [0, 1). */
+    uint64_t x = fnstack->sample_seed;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    fnstack->sample_seed = x;
+    bool sampled = (double) ((x * UINT64_C(0x2545F4914F6CDD1D)) >> 11) * 0x1.0p-53 < p;
+
+    fnstack->sample_depth = fnstack->count;
+    if(!sampled)
+        fnstack->unsampled_depth = fnstack->count;
+    return sampled;
+}
+
+#ifdef PT_REGISTRY
+/* Calls `fn` for every call-stack in the global registry, from any thread, until
+   `fn` returns non-zero. Returns the number of entries visited. */
+int pallene_tracer_registry_foreach(pt_registry_fn_t fn, void *ud) {
+    int visited = 0;
+
+    for(int i = 0; i < PALLENE_TRACER_MAX_STATES; i++) {
+        pt_registry_entry_t *entry = &_pallene_tracer_registry[i];
+        int stop = 0;
+
+        /* Announce ourselves before looking, so that the owner waits for us
+           if it is removing the entry right now. */
+        __atomic_add_fetch(&entry->readers, 1, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&entry->fnstack, __ATOMIC_SEQ_CST) != NULL) {
+            visited++;
+            stop = fn(entry, ud);
+        }
+        __atomic_sub_fetch(&entry->readers, 1, __ATOMIC_SEQ_CST);
+
+        if(stop)
+            break;
+    }
+
+    return visited;
+}
+
+/* Returns the number of times the process was forked, counting in the child only. */
+unsigned pallene_tracer_generation(void) {
+    return _pallene_tracer_generation;
+}
+#endif // PT_REGISTRY
+
+#ifdef PT_COUNTERS
+/* Assigns a descriptor to `details` if it has none. Returns the descriptor, or
+   -1 if there are no descriptors left. */
+int pallene_tracer_descriptor_id(pt_fn_details_t *details) {
+    int id = __atomic_load_n(&details->id, __ATOMIC_ACQUIRE);
+    if(id != 0)
+        return id;
+
+    /* Several threads may race for the same details, only one of them wins. The
+       descriptors of the losers are wasted, which is fine as it happens once.
+       The count stops at the size of the table, so that it never wraps around. */
+    int new_id = __atomic_load_n(&_pallene_tracer_descriptor_count, __ATOMIC_RELAXED);
+    do {
+        if(new_id >= PALLENE_TRACER_MAX_DESCRIPTORS) {
+            new_id = -1;
+            break;
+        }
+    } while(!__atomic_compare_exchange_n(&_pallene_tracer_descriptor_count, &new_id, new_id + 1,
+        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    if(new_id > 0)
+        __atomic_store_n(&_pallene_tracer_descriptors[new_id], details, __ATOMIC_RELEASE);
+
+    if(__atomic_compare_exchange_n(&details->id, &id, new_id, false,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return new_id;
+
+    if(new_id > 0)
+        __atomic_store_n(&_pallene_tracer_descriptors[new_id], NULL, __ATOMIC_RELEASE);
+    return id;
+}
+
+/* Returns the details of a descriptor, or NULL if it is not assigned. */
+const pt_fn_details_t *pallene_tracer_descriptor(int id) {
+    if(id <= 0 || id >= PALLENE_TRACER_MAX_DESCRIPTORS)
+        return NULL;
+
+    return __atomic_load_n(&_pallene_tracer_descriptors[id], __ATOMIC_ACQUIRE);
+}
+
+/* Sums up the counters of every Lua state, live or gone, into `totals`. */
+/* Lua states are retired while we walk the registry. If that happens the walk
+   starts over, as their counters may have been counted twice or not at all. */
+int pallene_tracer_counters_merge(pt_counter_t *totals) {
+    unsigned seq;
+
+    do {
+        while((seq = __atomic_load_n(&_pallene_tracer_counters_seq, __ATOMIC_SEQ_CST)) & 1)
+            ;
+
+        for(int id = 0; id < PALLENE_TRACER_MAX_DESCRIPTORS; id++) {
+            totals[id].calls = __atomic_load_n(&_pallene_tracer_retired[id].calls, __ATOMIC_RELAXED);
+            totals[id].callbacks = __atomic_load_n(&_pallene_tracer_retired[id].callbacks,
+                __ATOMIC_RELAXED);
+        }
+        pallene_tracer_registry_foreach(_pallene_tracer_counters_add, totals);
+    } while(__atomic_load_n(&_pallene_tracer_counters_seq, __ATOMIC_SEQ_CST) != seq);
+
+    int count = __atomic_load_n(&_pallene_tracer_descriptor_count, __ATOMIC_RELAXED);
+    return count < PALLENE_TRACER_MAX_DESCRIPTORS ? count : PALLENE_TRACER_MAX_DESCRIPTORS;
+}
+
+/* Copies the incidents of every Lua state so far, live or gone, into `incidents`. */
+void pallene_tracer_incidents(pt_incidents_t *incidents) {
+    incidents->errors = __atomic_load_n(&_pallene_tracer_incidents.errors, __ATOMIC_RELAXED);
+    incidents->overflows = __atomic_load_n(&_pallene_tracer_incidents.overflows, __ATOMIC_RELAXED);
+}
+
+/* Counts a frame pushed beyond the capacity of a call-stack. Out of line, as it
+   is unlikely. */
+void _pallene_tracer_count_overflow(void) {
+    __atomic_add_fetch(&_pallene_tracer_incidents.overflows, 1, __ATOMIC_RELAXED);
+}
+#endif // PT_COUNTERS
+
+#ifdef PT_STACKUSE
+/* Returns the native stack used by the Pallene functions of the Lua state so far,
+   indexed by descriptor, or NULL if it has no accounting. */
+const pt_stackuse_t *pallene_tracer_stackuse(pt_fnstack_t *fnstack) {
+    if(fnstack == NULL || fnstack->stackuse == NULL)
+        return NULL;
+
+    return fnstack->stackuse->uses;
+}
+
+/* A call from Lua returns: the function at `top` goes, and then the finalizer
+   removes its Lua interface frame. Charges the stack used since the Lua
+   interface frame was pushed to the function. */
+void _pallene_tracer_stackuse_call(pt_fnstack_t *fnstack, int top) {
+    pt_stackuse_meter_t *meter = fnstack->stackuse;
+    uintptr_t low = meter->low[top];
+    int id = fnstack->stack[top].shared.details->id;
+
+    if(id > 0 && meter->sp[top - 1] >= low) {
+        pt_stackuse_t *use = &meter->uses[id];
+        uint64_t peak = meter->sp[top - 1] - low;
+        if(peak > use->peak)
+            use->peak = peak;
+        use->peak_total += peak;
+        use->lua_calls++;
+    }
+
+    /* The Pallene function below it called back into Lua, which called it. */
+    if(top > 1 && low < meter->low[top - 2])
+        meter->low[top - 2] = low;
+}
+#endif // PT_STACKUSE
+
+#ifdef PT_CPUTIME
+/* Time charged before a fork belongs to the parent. */
+static void _pallene_tracer_cputime_renew(pt_cputime_t *cputime) {
+    if(luai_likely(cputime->generation == _pallene_tracer_generation))
+        return;
+
+    cputime->total = 0;
+    if(cputime->size > 0) {
+        memset(cputime->functions, 0, cputime->size * sizeof(uint64_t));
+        memset(cputime->callbacks, 0, cputime->size * sizeof(uint64_t));
+    }
+    cputime->generation = _pallene_tracer_generation;
+}
+
+/* Charges the time since the last frame boundary to the function which was on
+   top of the stack. Called right after the stack changes. */
+/* Everything which runs above a Pallene function is charged to it, including
+   the Lua functions it calls. Those it calls with `pallene_tracer_lua_call()`
+   are charged to its callbacks instead. */
+/* The descriptor of the new topmost function is looked up right away, while it
+   is `alive`: the details of a C interface frame may live in its C stack frame.
+   Time after an error is charged outside of any Pallene function until the next
+   frame boundary. */
+void _pallene_tracer_cputime_charge(pt_fnstack_t *fnstack, bool alive) {
+    struct pt_cputime_clock *clock = fnstack->cputime;
+    uint64_t now = _pallene_tracer_cputime_now();
+    uint64_t elapsed = now - clock->last;
+    pt_cputime_t *cputime = clock->current;
+    int id = clock->id;
+    bool callback = clock->callback;
+
+    /* The thread CPU clock starts over in a forked child. */
+    if(luai_unlikely(clock->generation != _pallene_tracer_generation)) {
+        clock->generation = _pallene_tracer_generation;
+        elapsed = 0;
+    }
+
+    /* An error went through a callback, the function which made it is gone. */
+    if(luai_unlikely(clock->callback_depth > fnstack->count))
+        clock->callback_depth = 0;
+
+    clock->last = now;
+
+    /* Within a request which is not sampled, e.g. when switching coroutines,
+       the time keeps going to the function which decided so. */
+    if(luai_likely(fnstack->count <= fnstack->unsampled_depth)) {
+        clock->id = 0;
+        clock->callback = false;
+        if(alive && fnstack->count > 0 && fnstack->count <= fnstack->capacity) {
+            pt_frame_t *top = &fnstack->stack[fnstack->count - 1];
+            if(top->type == PALLENE_TRACER_FRAME_TYPE_C && top->shared.details->id > 0) {
+                clock->id = top->shared.details->id;
+                clock->callback = fnstack->count == clock->callback_depth;
+            }
+        }
+
+        if(clock->listener != NULL)
+            clock->listener(fnstack, now, alive, clock->listener_ud);
+    }
+
+    if(cputime == NULL)
+        return;
+
+    _pallene_tracer_cputime_renew(cputime);
+    if(luai_unlikely(id >= cputime->size)) {
+        int size = id < 16 ? 16 : 2 * id;
+        uint64_t *functions = realloc(cputime->functions, size * sizeof(uint64_t));
+        if(functions != NULL)
+            cputime->functions = functions;
+        uint64_t *callbacks = realloc(cputime->callbacks, size * sizeof(uint64_t));
+        if(callbacks != NULL)
+            cputime->callbacks = callbacks;
+        if(functions == NULL || callbacks == NULL) {
+            cputime->total += elapsed;
+            return;
+        }
+
+        memset(functions + cputime->size, 0, (size - cputime->size) * sizeof(uint64_t));
+        memset(callbacks + cputime->size, 0, (size - cputime->size) * sizeof(uint64_t));
+        cputime->size = size;
+    }
+
+    cputime->total += elapsed;
+    if(callback)
+        cputime->callbacks[id] += elapsed;
+    else
+        cputime->functions[id] += elapsed;
+}
+
+/* Charges the time so far, and from then on the time of the function on top of
+   the stack at `depth` goes to its Lua callbacks. */
+/* Called around a callback, with the depth of the function making it and then
+   with the previous depth, so callbacks nest. */
+int _pallene_tracer_cputime_callback(pt_fnstack_t *fnstack, int depth) {
+    struct pt_cputime_clock *clock = fnstack->cputime;
+    int saved = clock->callback_depth;
+
+    clock->callback_depth = depth;
+    _pallene_tracer_cputime_charge(fnstack, true);
+    return saved;
+}
+
+/* Makes `co` the running coroutine as far as CPU time is concerned, charging the
+   time so far to the previous one. */
+void pallene_tracer_cputime_switch(lua_State *L, pt_fnstack_t *fnstack, lua_State *co) {
+    if(fnstack == NULL || fnstack->cputime == NULL)
+        return;
+
+    _pallene_tracer_cputime_charge(fnstack, true);
+    fnstack->cputime->current = _pallene_tracer_cputime_get(L, fnstack, co, true);
+}
+
+/* Calls `listener` at every frame boundary from then on, or no more if NULL. */
+bool pallene_tracer_cputime_listen(pt_fnstack_t *fnstack, pt_cputime_listener_t listener, void *ud) {
+    if(fnstack == NULL || fnstack->cputime == NULL)
+        return false;
+
+    fnstack->cputime->listener = listener;
+    fnstack->cputime->listener_ud = ud;
+    return true;
+}
+
+/* Returns the CPU time charged to `co` so far, or NULL if it never ran while
+   switched to. */
+const pt_cputime_t *pallene_tracer_cputime(lua_State *L, pt_fnstack_t *fnstack, lua_State *co) {
+    if(fnstack == NULL || fnstack->cputime == NULL)
+        return NULL;
+
+    /* Bring the running coroutine up to date. */
+    _pallene_tracer_cputime_charge(fnstack, true);
+
+    pt_cputime_t *cputime = _pallene_tracer_cputime_get(L, fnstack, co, false);
+    if(cputime != NULL)
+        _pallene_tracer_cputime_renew(cputime);
+    return cputime;
+}
+#endif // PT_CPUTIME
+
+#ifdef PT_RECORDER
+/* Starts the flight recorder of the Lua state of `fnstack` in the file at `path`. */
+/* Opening another one stops the previous one. The parent of a fork keeps its
+   recorder, the child has none. */
+int pallene_tracer_recorder_open(pt_fnstack_t *fnstack, const char *path, int events) {
+    if(fnstack == NULL || events <= 0)
+        return EINVAL;
+
+    uint32_t capacity = 1;
+    while(capacity < (uint32_t) events && capacity < (1u << 30))
+        capacity <<= 1;
+
+    size_t strings_at = 64 + PALLENE_TRACER_MAX_DESCRIPTORS * sizeof(uint32_t);
+    size_t events_at = (strings_at + PALLENE_TRACER_RECORDER_NAMES + 63) & ~(size_t) 63;
+    size_t size = events_at + capacity * sizeof(uint64_t);
+
+    pt_recorder_t *recorder = malloc(sizeof(pt_recorder_t));
+    if(recorder == NULL)
+        return ENOMEM;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0 || ftruncate(fd, (off_t) size) != 0) {
+        int error = errno;
+        if(fd >= 0)
+            close(fd);
+        free(recorder);
+        return error;
+    }
+
+    /* The mapping lives on without the descriptor. */
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+    if(map == MAP_FAILED) {
+        free(recorder);
+        return error;
+    }
+
+    /* The file is all zeros to begin with. */
+    recorder->header = (pt_recorder_header_t *) map;
+    recorder->names = (uint32_t *) ((char *) map + 64);
+    recorder->strings = (char *) map + strings_at;
+    recorder->events = (uint64_t *) ((char *) map + events_at);
+    recorder->mask = capacity - 1;
+    recorder->size = size;
+
+    recorder->header->version = 1;
+    recorder->header->pid = (uint32_t) getpid();
+    recorder->header->capacity = capacity;
+    recorder->header->descriptors = PALLENE_TRACER_MAX_DESCRIPTORS;
+    recorder->header->names_size = PALLENE_TRACER_RECORDER_NAMES;
+    recorder->names[0] = 0xffffffff;
+    memcpy(recorder->header->magic, "PTRECORD", 8);
+
+    _pallene_tracer_recorder_close(fnstack, false);
+    fnstack->recorder = recorder;
+    return 0;
+}
+
+/* Decodes the event recorded `back` events before the newest one. */
+bool pallene_tracer_recorder_event(pt_fnstack_t *fnstack, uint64_t back, pt_record_t *record) {
+    pt_recorder_t *recorder = fnstack != NULL ? fnstack->recorder : NULL;
+    if(recorder == NULL)
+        return false;
+
+    uint64_t head = recorder->header->head;
+    if(back >= head || back > recorder->mask)
+        return false;
+
+    uint64_t event = recorder->events[(head - 1 - back) & recorder->mask];
+    record->kind = (pt_record_kind_t) (event >> 61);
+    record->id = (int) ((event >> 41) & 0xfffff);
+    record->depth = (int) ((event >> 21) & 0xfffff);
+    record->line = (int) (event & 0x1fffff);
+    return true;
+}
+
+/* Copies the names of a descriptor to the file, the first time it is recorded. */
+/* The name table entry is written last, so a reader never sees half a name. */
+void _pallene_tracer_recorder_name(pt_recorder_t *recorder, int id) {
+    const pt_fn_details_t *details = pallene_tracer_descriptor(id);
+    uint32_t used = recorder->header->names_used;
+    uint32_t entry = 0xffffffff;
+
+    if(details != NULL) {
+        size_t name = strlen(details->fn_name) + 1;
+        size_t file = strlen(details->filename) + 1;
+        if(name + file <= recorder->header->names_size - used) {
+            memcpy(recorder->strings + used, details->fn_name, name);
+            memcpy(recorder->strings + used + name, details->filename, file);
+            recorder->header->names_used = used + (uint32_t) (name + file);
+            entry = used + 1;
+        }
+    }
+
+    __atomic_store_n(&recorder->names[id], entry, __ATOMIC_RELEASE);
+}
+
+/* Starts the call trace of the Lua state of `fnstack` in the file at `path`. */
+/* Opening another one stops the previous one. The parent of a fork keeps its
+   trace, the child has none. */
+int pallene_tracer_trace_open(pt_fnstack_t *fnstack, const char *path, size_t limit) {
+    if(fnstack == NULL)
+        return EINVAL;
+
+    pt_trace_t *trace = malloc(sizeof(pt_trace_t));
+    if(trace == NULL)
+        return ENOMEM;
+
+    trace->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(trace->fd < 0) {
+        int error = errno;
+        free(trace);
+        return error;
+    }
+
+    memcpy(trace->buffer, "PTTRACE\1", 8);
+    trace->used = (size_t) (_pallene_tracer_trace_varint(trace->buffer + 8, (uint32_t) getpid())
+        - trace->buffer);
+    trace->written = 0;
+    trace->limit = limit;
+    trace->last_id = 0;
+    trace->last_line = 0;
+    memset(trace->named, 0, sizeof(trace->named));
+
+    _pallene_tracer_trace_stop(fnstack, true);
+    fnstack->trace = trace;
+    return 0;
+}
+
+/* Writes out what the call trace of `fnstack` buffered and stops it, if any. */
+void pallene_tracer_trace_close(pt_fnstack_t *fnstack) {
+    if(fnstack != NULL)
+        _pallene_tracer_trace_stop(fnstack, true);
+}
+
+/* Writes out the buffer of the call trace. The trace stops if it can not, or
+   went over its limit. */
+void _pallene_tracer_trace_flush(pt_fnstack_t *fnstack) {
+    pt_trace_t *trace = fnstack->trace;
+    const unsigned char *at = trace->buffer;
+    size_t left = trace->used;
+
+    while(left > 0) {
+        ssize_t n = write(trace->fd, at, left);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0) {
+            trace->used = 0;
+            _pallene_tracer_trace_stop(fnstack, false);
+            return;
+        }
+        at += n;
+        left -= (size_t) n;
+    }
+
+    trace->written += trace->used;
+    trace->used = 0;
+    if(trace->limit > 0 && trace->written >= trace->limit)
+        _pallene_tracer_trace_stop(fnstack, false);
+}
+
+/* Appends the names of a descriptor to the call trace, the first time it is
+   traced. Names too long for the buffer are cut short. */
+void _pallene_tracer_trace_name(pt_fnstack_t *fnstack, int id) {
+    const pt_fn_details_t *details = pallene_tracer_descriptor(id);
+    const char *names[2] = { "<?>", "?" };
+    if(details != NULL) {
+        names[0] = details->fn_name;
+        names[1] = details->filename;
+    }
+
+    size_t sizes[2];
+    for(int i = 0; i < 2; i++) {
+        sizes[i] = strlen(names[i]);
+        if(sizes[i] > PALLENE_TRACER_TRACE_BUFFER / 4)
+            sizes[i] = PALLENE_TRACER_TRACE_BUFFER / 4;
+    }
+
+    if(fnstack->trace->used + 10 + sizes[0] + sizes[1] + 2 > PALLENE_TRACER_TRACE_BUFFER) {
+        _pallene_tracer_trace_flush(fnstack);
+        if(fnstack->trace == NULL)
+            return;
+    }
+
+    pt_trace_t *trace = fnstack->trace;
+    unsigned char *at = trace->buffer + trace->used;
+    at = _pallene_tracer_trace_varint(at,
+        _pallene_tracer_trace_zigzag(id - trace->last_id) << 3 | PALLENE_TRACER_TRACE_NAME);
+    for(int i = 0; i < 2; i++) {
+        memcpy(at, names[i], sizes[i]);
+        at += sizes[i];
+        *at++ = '\0';
+    }
+    trace->last_id = id;
+    trace->named[id] = 1;
+    trace->used = (size_t) (at - trace->buffer);
+}
+#endif // PT_RECORDER
+
+#ifdef PT_OBSERVER
+/* Calls the hooks of `observer` on the frame events from then on, or no more if NULL. */
+void pallene_tracer_observe(pt_fnstack_t *fnstack, const pt_observer_t *observer) {
+    if(fnstack != NULL)
+        fnstack->observer = observer;
+}
+#endif // PT_OBSERVER
+
 /* ---------------- DEFINITIONS END ---------------- */
 
 #endif
@@ -0,0 +1,33 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+it("Annotated source of the hottest functions", function()
+    assert(util.execute("make --quiet tests"))
+
+    local path = os.tmpname()
+    local ok, _, _, err_content =
+        util.outputs_of_execute("./pt-lua --profile=" .. path .. ".pb.gz spec/top/main.lua")
+    assert(ok, err_content)
+
+    local output_content
+    ok, _, output_content, err_content =
+        util.outputs_of_execute("./pt-lua tools/annotate.lua " .. path .. ".pb.gz value=samples context=0")
+    os.remove(path)
+    os.remove(path .. ".pb.gz")
+    assert(ok, err_content)
+    assert.are.same("", err_content)
+
+    -- The Lua callback and the C frame took the samples on top, in no particular order.
+    assert(string.find(output_content, "\n# %d+%. %? %(spec/top/main.lua:8%)  self %d+"), output_content)
+    assert(string.find(output_content, "\n# %d+%. spin_c %(spec/top/module.c%)  self %d+"), output_content)
+
+    -- The lines the samples were taken at, with their source.
+    assert(string.find(output_content, "\n +%d+ +%d+ +11          sum = sum %+ i\n"), output_content)
+    assert(string.find(output_content, "\n +%. +%d+ +57          lua_call%(L, 0, 0%);\n"), output_content)
+    -- The main chunk may be caught on the call itself now and then.
+    assert(string.find(output_content, "\n +[%d.]+ +%d+ +20      module%.hot_fn%(100000, lua_spin%)\n"), output_content)
+end)
@@ -0,0 +1,27 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.calltree.module"
+
+local function callback()
+end
+
+local function run(n)
+    for _ = 1, n do
+        module.outer_fn(callback)
+    end
+    module.leaf_fn()
+end
+
+run(3)
+
+-- Unwound by an error, then resumed.
+local co = coroutine.wrap(function()
+    pcall(module.outer_fn, function() error("oops") end)
+    coroutine.yield()
+    run(1)
+end)
+co()
+co()
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_FRAMEEXIT(fnstack)
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* A C function of the module, which calls `f` back twice. */
+void inner_fn(lua_State *L) {
+    MODULE_C_FRAMEENTER();
+
+    for(int i = 0; i < 2; i++) {
+        lua_pushvalue(L, 1);
+        PALLENE_TRACER_LUA_CALL(L, fnstack, 0, 0);
+    }
+
+    MODULE_C_FRAMEEXIT();
+}
+
+int outer_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(outer_fn);
+
+    inner_fn(L);
+
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+int leaf_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(leaf_fn);
+
+    lua_pushboolean(L, 1);
+
+    MODULE_C_FRAMEEXIT();
+    return 1;
+}
+
+int luaopen_spec_calltree_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, outer_fn, 2);
+    lua_setfield(L, -2, "outer_fn");
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, leaf_fn, 2);
+    lua_setfield(L, -2, "leaf_fn");
+
+    return 1;
+}
@@ -0,0 +1,90 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+it("Every call of Lua and Pallene functions", function()
+    assert(util.execute("make --quiet tests"))
+    local pprof = require "tools.pprof"
+
+    local path = os.tmpname()
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("./pt-lua --calltree=" .. path .. ".pb spec/calltree/main.lua")
+    local profile = pprof.read(path .. ".pb")
+    os.remove(path)
+    os.remove(path .. ".pb")
+    assert(ok, err_content)
+    assert.are.same("", output_content)
+
+    -- The calls of every stack, leaving out what `require` does.
+    local calls = pprof.value_index(profile, "calls")
+    local cpu = pprof.value_index(profile, "cpu")
+    local stacks = {}
+    local total = 0
+    for _, sample in ipairs(profile.samples) do
+        local names = {}
+        for i = #sample.frames, 1, -1 do
+            table.insert(names, sample.frames[i].fn.name)
+        end
+        local stack = table.concat(names, ";")
+        if not string.find(stack, "require") then
+            stacks[stack] = sample.values[calls]
+        end
+        total = total + sample.values[cpu]
+    end
+    assert(total > 0)
+    local co = "? (spec/calltree/main.lua:21)"
+    local callback = "? (spec/calltree/main.lua:8)"
+    assert.are.same({
+        ["main chunk"] = 1,
+        ["main chunk;run"] = 1,
+        ["main chunk;run;outer_fn"] = 3,
+        ["main chunk;run;outer_fn;inner_fn"] = 3,
+        ["main chunk;run;outer_fn;inner_fn;" .. callback] = 6,
+        ["main chunk;run;leaf_fn"] = 1,
+        ["main chunk;wrap"] = 1,
+        ["main chunk;co"] = 2,
+        ["main chunk;co;?"] = 2,
+        ["main chunk;co;?;?"] = 2,
+
+        -- The coroutine, unwound by an error through Pallene frames first.
+        [co] = 1,
+        [co .. ";pcall"] = 1,
+        [co .. ";pcall;outer_fn"] = 1,
+        [co .. ";pcall;outer_fn;inner_fn"] = 1,
+        [co .. ";pcall;outer_fn;inner_fn;? (spec/calltree/main.lua:22)"] = 1,
+        [co .. ";pcall;outer_fn;inner_fn;? (spec/calltree/main.lua:22);error"] = 1,
+        [co .. ";yield"] = 1,
+        [co .. ";run"] = 1,
+        [co .. ";run;outer_fn"] = 1,
+        [co .. ";run;outer_fn;inner_fn"] = 1,
+        [co .. ";run;outer_fn;inner_fn;" .. callback] = 2,
+        [co .. ";run;leaf_fn"] = 1,
+    }, stacks)
+end)
+
+it("Call tree in folded stacks", function()
+    local path = os.tmpname()
+    local ok, _, _, err_content =
+        util.outputs_of_execute("./pt-lua --calltree=" .. path .. " spec/calltree/main.lua")
+    local folded = util.get_file_contents(path)
+    os.remove(path)
+    assert(ok, err_content)
+
+    -- Microseconds of CPU time, what is less left out.
+    for line in string.gmatch(folded, "[^\n]+") do
+        local stack, us = string.match(line, "^(.-) (%d+)$")
+        assert(stack and tonumber(us) > 0, line)
+    end
+    assert(string.find(folded, "\nmain chunk %(spec/calltree/main.lua:0%) %d+\n"), folded)
+end)
+
+it("Call tree with a sampled profile", function()
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("./pt-lua --calltree=a --profile=b -e ''")
+    assert(not ok)
+    assert.are.same("", output_content)
+    assert.are.same("./pt-lua: '--calltree' does not go with '--top' or '--profile'\n", err_content)
+end)
@@ -0,0 +1,15 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.counters.module"
+
+module.call_leaf(10)
+module.call_leaf(5)
+print(module.calls("call_leaf"), module.calls("leaf_fn"))
+
+print(module.run_state(7))
+
+module.run_threads(8, 1000)
+print(module.calls("worker_fn"))
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include <lualib.h>
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_FRAMEEXIT(fnstack)
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+void leaf_fn(lua_State *L) {
+    MODULE_C_FRAMEENTER();
+    MODULE_C_FRAMEEXIT();
+}
+
+/* Calls `leaf_fn` as many times as asked. */
+int call_leaf(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(call_leaf);
+
+    lua_Integer n = luaL_checkinteger(L, 1);
+    for(lua_Integer i = 0; i < n; i++)
+        leaf_fn(L);
+
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+/* Stands for the work of a thread with a Lua state of its own. */
+void worker_fn(pt_fnstack_t *fnstack) {
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame);
+    PALLENE_TRACER_FRAMEEXIT(fnstack);
+}
+
+static void *worker_thread(void *ud) {
+    int n = *(int *) ud;
+    lua_State *L = luaL_newstate();
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    for(int i = 0; i < n; i++)
+        worker_fn(fnstack);
+
+    lua_close(L);
+    return NULL;
+}
+
+/* Returns the merged number of calls of the function with the given name. */
+static lua_Integer calls_of(const char *name) {
+    static pt_counter_t totals[PALLENE_TRACER_MAX_DESCRIPTORS];
+    int count = pallene_tracer_counters_merge(totals);
+
+    for(int id = 1; id < count; id++) {
+        const pt_fn_details_t *details = pallene_tracer_descriptor(id);
+        if(details != NULL && strcmp(details->fn_name, name) == 0)
+            return totals[id].calls;
+    }
+
+    return 0;
+}
+
+int calls(lua_State *L) {
+    lua_pushinteger(L, calls_of(luaL_checkstring(L, 1)));
+    return 1;
+}
+
+/* Runs `n` calls of `worker_fn` in each of `threads` threads, every one with
+   a Lua state of its own which is closed before the thread ends. */
+int run_threads(lua_State *L) {
+    int threads = (int) luaL_checkinteger(L, 1);
+    int n = (int) luaL_checkinteger(L, 2);
+
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    for(int i = 0; i < threads; i++)
+        pthread_create(&ids[i], NULL, worker_thread, &n);
+    for(int i = 0; i < threads; i++)
+        pthread_join(ids[i], NULL);
+    free(ids);
+
+    return 0;
+}
+
+/* Runs `n` calls of `worker_fn` in a new Lua state, returning the merged calls
+   while the state is alive and after it is closed. */
+int run_state_fn(lua_State *L) {
+    int n = (int) luaL_checkinteger(L, 1);
+
+    lua_State *NL = luaL_newstate();
+    pt_fnstack_t *fnstack = pallene_tracer_init(NL);
+    for(int i = 0; i < n; i++)
+        worker_fn(fnstack);
+
+    lua_pushinteger(L, calls_of("worker_fn"));
+    lua_close(NL);
+    lua_pushinteger(L, calls_of("worker_fn"));
+    return 2;
+}
+
+int luaopen_spec_counters_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, call_leaf, 2);
+    lua_setfield(L, -2, "call_leaf");
+
+    lua_pushcfunction(L, calls);
+    lua_setfield(L, -2, "calls");
+
+    lua_pushcfunction(L, run_threads);
+    lua_setfield(L, -2, "run_threads");
+
+    lua_pushcfunction(L, run_state_fn);
+    lua_setfield(L, -2, "run_state");
+
+    return 1;
+}
@@ -0,0 +1,57 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.cputime.module"
+
+local busy = coroutine.create(function()
+    module.spin_fn(20000000)
+    coroutine.yield()
+    module.spin_fn(20000000)
+end)
+local idle = coroutine.create(function()
+    coroutine.yield()
+end)
+local never = coroutine.create(function() end)
+
+coroutine.resume(busy)
+coroutine.resume(idle)
+local first = pallene_tracer_cputime(busy)
+coroutine.resume(busy)
+
+local total, functions = pallene_tracer_cputime(busy)
+print(total > first, functions.spin_fn > 0, functions.spin_fn <= total)
+
+total, functions = pallene_tracer_cputime(idle)
+print(total < first, next(functions))
+print(pallene_tracer_cputime(never))
+
+-- The main thread did not spin.
+total, functions = pallene_tracer_cputime()
+print(functions.spin_fn)
+
+-- Wrapped functions behave as usual.
+local wrapped = coroutine.wrap(function(a)
+    module.spin_fn(1000)
+    return a + coroutine.yield(a)
+end)
+print(wrapped(1), wrapped(2))
+print(pcall(coroutine.wrap(function() error("oops") end)))
+print(pcall(wrapped))
+
+-- What it calls back is charged apart, along with the Pallene functions that
+-- calls in turn.
+local function lua_spin()
+    local sum = 0
+    for i = 1, 2000000 do
+        sum = sum + i
+    end
+    module.spin_fn(1000)
+end
+for _ = 1, 3 do
+    module.callback_fn(1000, lua_spin)
+end
+local callbacks
+total, functions, callbacks = pallene_tracer_cputime()
+print(callbacks.callback_fn > 10 * (functions.callback_fn or 0), functions.spin_fn > 0, callbacks.spin_fn)
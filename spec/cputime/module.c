@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_FRAMEEXIT(fnstack)
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* Burns some CPU time. */
+int spin_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(spin_fn);
+
+    volatile lua_Integer sum = 0;
+    lua_Integer n = luaL_checkinteger(L, 1);
+    for(lua_Integer i = 0; i < n; i++)
+        sum += i;
+
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+/* Burns a little CPU time, then calls `f` back. */
+int callback_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(callback_fn);
+
+    volatile lua_Integer sum = 0;
+    lua_Integer n = luaL_checkinteger(L, 1);
+    for(lua_Integer i = 0; i < n; i++)
+        sum += i;
+
+    lua_pushvalue(L, 2);
+    PALLENE_TRACER_LUA_CALL(L, fnstack, 0, 0);
+
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+int luaopen_spec_cputime_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, spin_fn, 2);
+    lua_setfield(L, -2, "spin_fn");
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, callback_fn, 2);
+    lua_setfield(L, -2, "callback_fn");
+
+    return 1;
+}
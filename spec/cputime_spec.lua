@@ -0,0 +1,47 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+it("CPU time per coroutine", function()
+    assert(util.execute("make --quiet tests"))
+
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("./pt-lua spec/cputime/main.lua")
+    assert(ok, err_content)
+    assert.are.same([[
+true	true	true
+true	nil
+nil
+nil
+1	3
+false	spec/cputime/main.lua:40: oops
+false	cannot resume dead coroutine
+true	true	nil
+]], output_content)
+end)
+
+it("Calls back into Lua in the profile", function()
+    local pprof = require "tools.pprof"
+
+    local path = os.tmpname()
+    local ok, _, _, err_content =
+        util.outputs_of_execute("./pt-lua --profile=" .. path .. ".pb spec/cputime/main.lua")
+    local profile = pprof.read(path .. ".pb")
+    os.remove(path)
+    os.remove(path .. ".pb")
+    assert(ok, err_content)
+
+    -- Counted, alongside the calls.
+    local calls = pprof.value_index(profile, "calls")
+    local callbacks = pprof.value_index(profile, "callbacks")
+    local counted = {}
+    for _, sample in ipairs(profile.samples) do
+        if sample.values[calls] > 0 then
+            counted[sample.frames[1].fn.name] = { sample.values[calls], sample.values[callbacks] }
+        end
+    end
+    assert.are.same({ spin_fn = { 6, 0 }, callback_fn = { 3, 3 } }, counted)
+end)
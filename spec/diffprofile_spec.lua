@@ -0,0 +1,62 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+local diff = "./pt-lua tools/diffprofile.lua spec/diffprofile/base.folded spec/diffprofile/new.folded"
+
+it("Differential profile of functions and stacks", function()
+    local ok, _, output_content, err_content = util.outputs_of_execute(diff .. " normalize=no")
+    assert(ok, err_content)
+    assert.are.same("", err_content)
+    assert.are.same([[
+# base: spec/diffprofile/base.folded, 60 samples
+# new:  spec/diffprofile/new.folded, 100 samples
+
+functions
+   base self   new self      delta   change   base total  new total      delta   change  function
+          40         70        +30   +75.0%           40         70        +30   +75.0%  leaf
+           0         20        +20      new            0         20        +20      new  added
+          10          0        -10     gone           10          0        -10     gone  gone
+           0          0         +0        -           60        100        +40   +66.7%  main
+          10         10         +0    +0.0%           20         50        +30  +150.0%  slow
+           0          0         +0        -           30         30         +0    +0.0%  fast
+
+stacks
+        base        new      delta   change  stack
+          10         40        +30  +300.0%  main;slow;leaf
+           0         20        +20      new  main;added
+          10          0        -10     gone  main;gone
+          30         30         +0    +0.0%  main;fast;leaf
+          10         10         +0    +0.0%  main;slow
+]], output_content)
+end)
+
+it("Differential flame graph", function()
+    local folded, svg = os.tmpname(), os.tmpname()
+    local ok, _, _, err_content =
+        util.outputs_of_execute(diff .. " folded=" .. folded .. " svg=" .. svg)
+    local folded_content = util.get_file_contents(folded)
+    local svg_content = util.get_file_contents(svg)
+    os.remove(folded)
+    os.remove(svg)
+    assert(ok, err_content)
+
+    -- The base is normalized to the 100 samples of the new profile.
+    assert.are.same([[
+main;added 0 20
+main;fast;leaf 50 30
+main;gone 17 0
+main;slow 17 10
+main;slow;leaf 17 40
+]], folded_content)
+
+    -- Frames as wide as in the new profile, red for more and blue for less.
+    assert(string.find(svg_content, "<title>leaf: 16%.7 %-&gt; 40 %(%+23%.3, %+140%.0%%%)</title>"
+        .. "<rect [^>]* fill=\"rgb%(255,%d+,%d+%)\""), svg_content)
+    assert(string.find(svg_content, "<title>fast: 50 %-&gt; 30 %(%-20, %-40%.0%%%)</title>"
+        .. "<rect [^>]* width=\"354%.0\" [^>]* fill=\"rgb%(%d+,%d+,255%)\""), svg_content)
+    assert(not string.find(svg_content, "<title>gone"), svg_content)
+end)
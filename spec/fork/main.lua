@@ -0,0 +1,26 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.fork.module"
+
+module.spin_fn(30000000)
+module.spin_fn(10)
+module.hold()
+local parent_time = pallene_tracer_cputime()
+local parent_states = module.states()
+
+local pid = module.fork()
+if pid == 0 then
+    local time, functions = pallene_tracer_cputime()
+    print("child", module.generation(), module.states(), module.calls(),
+        time < parent_time, functions.spin_fn)
+    module.spin_fn(10)
+    print("child", module.calls())
+    os.exit(0)
+end
+
+print("parent", module.wait(pid))
+module.release()
+print("parent", module.generation(), parent_states, module.calls())
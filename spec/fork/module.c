@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* We need `fork()`. */
+#define _POSIX_C_SOURCE 200809L
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include <lualib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_FRAMEEXIT(fnstack)
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* Burns some CPU time. */
+int spin_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(spin_fn);
+
+    volatile lua_Integer sum = 0;
+    lua_Integer n = luaL_checkinteger(L, 1);
+    for(lua_Integer i = 0; i < n; i++)
+        sum += i;
+
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+/* Returns the merged number of calls of `spin_fn`. */
+int calls(lua_State *L) {
+    static pt_counter_t totals[PALLENE_TRACER_MAX_DESCRIPTORS];
+    int count = pallene_tracer_counters_merge(totals);
+    lua_Integer spins = 0;
+
+    for(int id = 1; id < count; id++) {
+        const pt_fn_details_t *details = pallene_tracer_descriptor(id);
+        if(details != NULL && strcmp(details->fn_name, "spin_fn") == 0)
+            spins = totals[id].calls;
+    }
+
+    lua_pushinteger(L, spins);
+    return 1;
+}
+
+static int count_entry(const pt_registry_entry_t *entry, void *ud) {
+    (void) entry;
+    (*(int *) ud)++;
+
+    return 0;
+}
+
+/* Returns the number of registered states. */
+int states(lua_State *L) {
+    int count = 0;
+    pallene_tracer_registry_foreach(count_entry, &count);
+
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+/* A thread with a Lua state of its own, which waits for `release`. */
+static int ready[2], go[2];
+static pthread_t holder;
+
+static void *hold_thread(void *ud) {
+    char c = 0;
+    lua_State *L = luaL_newstate();
+    (void) ud;
+    (void) pallene_tracer_init(L);
+
+    if(write(ready[1], &c, 1) == 1)
+        while(read(go[0], &c, 1) < 0)
+            ;
+
+    lua_close(L);
+    return NULL;
+}
+
+int hold(lua_State *L) {
+    char c;
+
+    if(pipe(ready) != 0 || pipe(go) != 0)
+        return luaL_error(L, "pipe failed");
+    pthread_create(&holder, NULL, hold_thread, NULL);
+    while(read(ready[0], &c, 1) < 0)
+        ;
+
+    return 0;
+}
+
+int release(lua_State *L) {
+    char c = 0;
+    if(write(go[1], &c, 1) != 1)
+        return luaL_error(L, "write failed");
+    pthread_join(holder, NULL);
+
+    return 0;
+}
+
+int fork_fn(lua_State *L) {
+    lua_pushinteger(L, fork());
+    return 1;
+}
+
+int wait_fn(lua_State *L) {
+    int status;
+    waitpid((pid_t) luaL_checkinteger(L, 1), &status, 0);
+
+    lua_pushboolean(L, WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    return 1;
+}
+
+int generation(lua_State *L) {
+    lua_pushinteger(L, pallene_tracer_generation());
+    return 1;
+}
+
+int luaopen_spec_fork_module(lua_State *L) {
+    static const luaL_Reg funcs[] = {
+        {"calls", calls}, {"states", states}, {"hold", hold}, {"release", release},
+        {"fork", fork_fn}, {"wait", wait_fn}, {"generation", generation}, {NULL, NULL}
+    };
+
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    luaL_newlib(L, funcs);
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, spin_fn, 2);
+    lua_setfield(L, -2, "spin_fn");
+
+    return 1;
+}
@@ -0,0 +1,26 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.fork.module"
+
+local page = "/dev/shm/" .. os.getenv("PT_STATS_NAME")
+
+local function exists(path)
+    local file = io.open(path)
+    if file then file:close() end
+    return file ~= nil
+end
+
+local pid = module.fork()
+if pid == 0 then
+    module.spin_fn(10)
+    local stat = io.open("/proc/self/stat")
+    local child = page .. "." .. stat:read("n")
+    stat:close()
+    print("child", exists(page), exists(child))
+    os.exit(0)
+end
+
+print("parent", module.wait(pid), exists(page), exists(page .. "." .. pid))
@@ -0,0 +1,62 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+it("Fork", function()
+    assert(util.execute("make --quiet tests"))
+
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("./pt-lua spec/fork/main.lua")
+    assert(ok, err_content)
+    assert.are.same([[
+child	1	1	0	true	nil
+child	1
+parent	true
+parent	0	2	2
+]], output_content)
+end)
+
+it("Flight recorder and call trace of a forked child", function()
+    local path = os.tmpname()
+    local ok, _, _, err_content = util.outputs_of_execute("PT_RECORDER_FILE=" .. path ..
+        " PT_TRACE_FILE=" .. path .. ".trace ./pt-lua spec/fork/main.lua")
+    assert(ok, err_content)
+
+    -- The parent goes on with its files, the child got files of its own.
+    local output_content
+    ok, _, output_content = util.outputs_of_execute("ls " .. path .. ".*")
+    local pid = string.match(output_content, "%.trace%.(%d+)\n")
+    assert(pid, output_content)
+    local child = path .. "." .. pid
+    assert(string.find(output_content, child .. "\n", 1, true), output_content)
+
+    ok, _, output_content, err_content =
+        util.outputs_of_execute("./pt-lua tools/recorder.lua " .. child)
+    os.remove(path)
+    os.remove(path .. ".trace")
+    os.remove(child)
+    os.remove(path .. ".trace." .. pid)
+    assert(ok, err_content)
+    assert(string.find(output_content, ": pid " .. pid .. ", 0 events of 0 recorded, not closed\n", 1, true),
+        output_content)
+end)
+
+it("Stats page of a forked child", function()
+    local tmpname = os.tmpname()
+    local name = "pt-lua-spec-" .. string.match(tmpname, "[^/]*$")
+    local ok, _, output_content, err_content = util.outputs_of_execute("PT_STATS_NAME=" ..
+        name .. " ./pt-lua spec/fork/stats.lua")
+    os.remove(tmpname)
+    assert(ok, err_content)
+    assert.are.same("", err_content)
+
+    -- The child publishes a page of its own, and leaves the one of the parent.
+    assert.are.same([[
+child	true	true
+parent	true	true	false
+]], output_content)
+    assert(not io.open("/dev/shm/" .. name))
+end)
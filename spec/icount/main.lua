@@ -0,0 +1,24 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.icount.module"
+
+local function callback()
+    local t = {}
+    for i = 1, 100 do
+        t[i] = i * i
+    end
+end
+
+for _ = 1, 10 do
+    module.work(1000, callback)
+end
+
+-- Errors through a module built with `PT_DEBUG` alone, the details of its
+-- functions are gone once an error unwinds them.
+local untraced = require "spec.tracebacks.singular.module"
+for _ = 1, 100 do
+    pcall(untraced.singular_fn)
+end
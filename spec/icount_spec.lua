@@ -0,0 +1,87 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+-- Runs spec/icount/main.lua with `--icount`, returns the profile written.
+local function icount(suffix)
+    assert(util.execute("make --quiet tests"))
+    local path = os.tmpname()
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("./pt-lua --icount=" .. path .. suffix .. " spec/icount/main.lua")
+    local profile = util.get_file_contents(path .. suffix)
+    os.remove(path)
+    os.remove(path .. suffix)
+    assert(ok, err_content)
+    assert.are.same("", output_content)
+    return profile
+end
+
+it("Same instruction counts run to run", function()
+    local folded = icount("")
+    assert.are.same(folded, icount(""))
+
+    -- 20 calls of `lines_fn` run 1000 lines each, and enter or leave the
+    -- stack 20 times. What the Lua callback runs depends on the Lua version.
+    local work = "main chunk (spec/icount/main.lua:0);work (spec/icount/module.c)"
+    local counts = {}
+    for line in string.gmatch(folded, "[^\n]+") do
+        local stack, count = string.match(line, "^(.-) (%d+)$")
+        counts[stack] = tonumber(count)
+    end
+    assert.are.same(20020, counts[work .. ";lines_fn (spec/icount/module.c)"])
+    assert.are.same(80, counts[work])
+    assert(counts[work .. ";? (spec/icount/main.lua:8)"] > 0, folded)
+end)
+
+it("Instruction counts of errors through a module", function()
+    -- The frames an error goes through are gone by the time their finalizer
+    -- is called, nothing is to be read of them then.
+    local pcall_stack = "main chunk (spec/icount/main.lua:0);pcall ([C])"
+    local found = false
+    for line in string.gmatch(icount(""), "[^\n]+") do
+        local stack = string.match(line, "^(.-) %d+$")
+        assert(stack, line)
+        if string.sub(stack, 1, #pcall_stack) == pcall_stack then
+            found = true
+            local rest = string.sub(stack, #pcall_stack + 1)
+            for fn in string.gmatch(rest, ";([^;]+)") do
+                assert(string.find(fn, "^[%w_]+ %(spec/tracebacks/singular/module%.c%)$"), line)
+            end
+        end
+    end
+    assert(found)
+end)
+
+it("Instruction counts in a pprof profile", function()
+    local pprof = require "tools.pprof"
+    local path = os.tmpname()
+    local file = assert(io.open(path, "wb"))
+    file:write(icount(".pb"))
+    file:close()
+    local profile = pprof.read(path)
+    os.remove(path)
+
+    local calls = pprof.value_index(profile, "calls")
+    local instructions = pprof.value_index(profile, "instructions")
+    local stacks = {}
+    for _, sample in ipairs(profile.samples) do
+        local names = {}
+        for i = #sample.frames, 1, -1 do
+            table.insert(names, sample.frames[i].fn.name)
+        end
+        stacks[table.concat(names, ";")] = { sample.values[calls], sample.values[instructions] }
+    end
+    assert.are.same({ 20, 20020 }, stacks["main chunk;work;lines_fn"])
+    assert.are.same({ 10, 80 }, stacks["main chunk;work"])
+end)
+
+it("Instruction counts with a call tree", function()
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("./pt-lua --calltree=a --icount=b -e ''")
+    assert(not ok)
+    assert.are.same("", output_content)
+    assert.are.same("./pt-lua: '--calltree' does not go with '--icount'\n", err_content)
+end)
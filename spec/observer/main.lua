@@ -0,0 +1,15 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.observer.module"
+
+-- A call returning and one ending in an error, then one nobody watches.
+module.watch(true)
+module.step(1)
+pcall(module.step, 0)
+io.write(module.watch(false))
+
+module.step(2)
+io.write(module.watch(false))
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include <stdio.h>
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_SETLINE()                                       \
+    PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_FRAMEEXIT(fnstack)
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* What the observer was told of, a line per event. */
+static char events[4096];
+static size_t used = 0;
+
+static void event(const char *what, const char *fn_name, int n) {
+    int size = snprintf(events + used, sizeof(events) - used, "%s %s %d\n", what, fn_name, n);
+    if(size > 0 && used + size < sizeof(events))
+        used += size;
+}
+
+static void on_enter(pt_fnstack_t *fnstack, pt_frame_t *frame, void *ud) {
+    (void) ud;
+    if(frame->type == PALLENE_TRACER_FRAME_TYPE_C)
+        event("enter", frame->shared.details->fn_name, fnstack->count);
+    else
+        event("call", "-", fnstack->count);
+}
+
+static void on_exit(pt_fnstack_t *fnstack, void *ud) {
+    (void) ud;
+    if(fnstack->count > fnstack->capacity)
+        return;
+    pt_frame_t *top = &fnstack->stack[fnstack->count - 1];
+    event("exit", top->shared.details->fn_name, top->line);
+}
+
+static void on_unwind(pt_fnstack_t *fnstack, int count, bool error, void *ud) {
+    (void) ud;
+    event(error ? "error" : "return", "-", fnstack->count - count);
+}
+
+static void on_setline(pt_fnstack_t *fnstack, int line, void *ud) {
+    (void) fnstack;
+    (void) ud;
+    event("line", "-", line);
+}
+
+static const pt_observer_t observer = {
+    .enter = on_enter,
+    .exit = on_exit,
+    .unwind = on_unwind,
+    .setline = on_setline
+};
+
+/* Raises an error when `n` is zero. */
+void check_fn(lua_State *L, lua_Integer n) {
+    MODULE_C_FRAMEENTER();
+
+    MODULE_C_SETLINE();
+    if(n == 0)
+        luaL_error(L, "n is zero");
+
+    MODULE_C_FRAMEEXIT();
+}
+
+/* step(n): checks `n`. */
+int step_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(step_fn);
+
+    lua_Integer n = luaL_checkinteger(L, 1);
+    MODULE_C_SETLINE();
+    check_fn(L, n);
+
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+/* watch(on): installs the observer, or removes it and returns what it was told
+   of since. */
+int watch(lua_State *L) {
+    pt_fnstack_t *fnstack = lua_touserdata(L, lua_upvalueindex(1));
+
+    if(lua_toboolean(L, 1)) {
+        pallene_tracer_observe(fnstack, &observer);
+        return 0;
+    }
+
+    pallene_tracer_observe(fnstack, NULL);
+    lua_pushlstring(L, events, used);
+    used = 0;
+    return 1;
+}
+
+int luaopen_spec_observer_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, step_fn, 2);
+    lua_setfield(L, -2, "step");
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushcclosure(L, watch, 1);
+    lua_setfield(L, -2, "watch");
+
+    return 1;
+}
@@ -0,0 +1,29 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+it("Observer of frame events", function()
+    assert(util.execute("make --quiet tests"))
+    local ok, _, output_content, err_content = util.outputs_of_execute("./pt-lua spec/observer/main.lua")
+    assert(ok, err_content)
+    assert.are.same("", err_content)
+    assert.are.same([[
+call - 1
+enter step_fn 2
+line - 100
+enter check_fn 3
+line - 88
+exit check_fn 88
+exit step_fn 100
+return - 1
+call - 1
+enter step_fn 2
+line - 100
+enter check_fn 3
+line - 88
+error - 3
+]], output_content)
+end)
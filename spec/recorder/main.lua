@@ -0,0 +1,26 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.recorder.module"
+
+-- A few calls, an error caught, then the end: an error or getting killed.
+module.step(1)
+module.step(2)
+pcall(module.step, 0)
+
+if arg[1] == "untraced" then
+    -- Errors going through a module built with `PT_DEBUG` alone, which does
+    -- not record its calls.
+    local untraced = require "spec.tracebacks.singular.module"
+    for _ = 1, 2000 do
+        pcall(untraced.singular_fn)
+    end
+end
+
+if arg[1] == "die" then
+    module.die()
+else
+    module.step(0)
+end
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include <signal.h>
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_SETLINE()                                       \
+    PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_FRAMEEXIT(fnstack)
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* Raises an error when `n` is zero. */
+void check_fn(lua_State *L, lua_Integer n) {
+    MODULE_C_FRAMEENTER();
+
+    MODULE_C_SETLINE();
+    if(n == 0)
+        luaL_error(L, "n is zero");
+
+    MODULE_C_FRAMEEXIT();
+}
+
+/* step(n): checks `n`. */
+int step_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(step_fn);
+
+    lua_Integer n = luaL_checkinteger(L, 1);
+    MODULE_C_SETLINE();
+    check_fn(L, n);
+
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+/* die(): the process is killed in the middle of a Pallene function. */
+int die(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(die);
+
+    MODULE_C_SETLINE();
+    raise(SIGKILL);
+
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+int luaopen_spec_recorder_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, step_fn, 2);
+    lua_setfield(L, -2, "step");
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, die, 2);
+    lua_setfield(L, -2, "die");
+
+    return 1;
+}
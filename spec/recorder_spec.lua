@@ -0,0 +1,90 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+it("Recent Pallene calls in the traceback", function()
+    assert(util.execute("make --quiet tests"))
+
+    local path = os.tmpname()
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("PT_RECORDER_FILE=" .. path ..
+            " PT_RECORDER_HISTORY=6 ./pt-lua spec/recorder/main.lua")
+    os.remove(path)
+    assert(not ok)
+    assert.are.same("", output_content)
+    assert.are.same([[
+./pt-lua: spec/recorder/main.lua:25: n is zero
+stack traceback:
+    spec/recorder/module.c:44: in function 'check_fn'
+    spec/recorder/module.c:56: in function 'step_fn'
+    spec/recorder/main.lua:25: in <main>
+    C: in function '<?>'
+recent Pallene calls (oldest first):
+    enter step_fn (spec/recorder/module.c)
+      enter check_fn (spec/recorder/module.c)
+      error check_fn (spec/recorder/module.c:44)
+    error step_fn (spec/recorder/module.c:56)
+    enter step_fn (spec/recorder/module.c)
+      enter check_fn (spec/recorder/module.c)
+]], err_content)
+end)
+
+it("Flight recorder of a killed process", function()
+    local path = os.tmpname()
+    local ok = util.outputs_of_execute("PT_RECORDER_FILE=" .. path ..
+        " ./pt-lua spec/recorder/main.lua die")
+    assert(not ok)
+
+    local output_content, err_content
+    ok, _, output_content, err_content =
+        util.outputs_of_execute("./pt-lua tools/recorder.lua " .. path .. " events=5")
+    os.remove(path)
+    assert(ok, err_content)
+    assert.are.same("", err_content)
+
+    -- It got killed in `die`, after the error caught by `pcall`.
+    local header, events = string.match(output_content, "^(.-)\n(.*)$")
+    assert(string.find(header, ": pid %d+, 5 events of 13 recorded, not closed$"), header)
+    assert.are.same([[
+  enter step_fn (spec/recorder/module.c)
+    enter check_fn (spec/recorder/module.c)
+    error check_fn (spec/recorder/module.c:44)
+  error step_fn (spec/recorder/module.c:56)
+  enter die (spec/recorder/module.c)
+]], events)
+end)
+
+it("Errors through a module which does not record", function()
+    local path = os.tmpname()
+    local ok = util.outputs_of_execute("PT_RECORDER_FILE=" .. path ..
+        " ./pt-lua spec/recorder/main.lua untraced")
+    assert(not ok)
+
+    local output_content, err_content
+    ok, _, output_content, err_content =
+        util.outputs_of_execute("./pt-lua tools/recorder.lua " .. path .. " events=4")
+    os.remove(path)
+    assert(ok, err_content)
+    assert.are.same("", err_content)
+
+    -- Its frames were not recorded entering, so neither are they when unwound.
+    local header, events = string.match(output_content, "^(.-)\n(.*)$")
+    assert(string.find(header, ": pid %d+, 4 events of 16 recorded, closed$"), header)
+    assert.are.same([[
+  enter step_fn (spec/recorder/module.c)
+    enter check_fn (spec/recorder/module.c)
+    error check_fn (spec/recorder/module.c:44)
+  error step_fn (spec/recorder/module.c:56)
+]], events)
+end)
+
+it("Invalid flight recorder setting", function()
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("PT_RECORDER_EVENTS=0 ./pt-lua -e ''")
+    assert(not ok)
+    assert.are.same("", output_content)
+    assert.are.same("./pt-lua: invalid value '0' for PT_RECORDER_EVENTS\n", err_content)
+end)
@@ -0,0 +1,9 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.registry.module"
+
+print(module.count(), module.has_self())
+print(module.new_state())
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include <lualib.h>
+
+static int count_entry(const pt_registry_entry_t *entry, void *ud) {
+    (void) entry;
+    (*(int *) ud)++;
+
+    return 0;
+}
+
+struct find { pt_fnstack_t *fnstack; int found; };
+
+static int find_entry(const pt_registry_entry_t *entry, void *ud) {
+    struct find *find = ud;
+    find->found = entry->fnstack == find->fnstack
+        && pthread_equal(entry->thread, pthread_self());
+
+    return find->found;
+}
+
+static int count_states(void) {
+    int count = 0;
+    pallene_tracer_registry_foreach(count_entry, &count);
+
+    return count;
+}
+
+/* Returns the number of registered states. */
+int count_fn(lua_State *L) {
+    lua_pushinteger(L, count_states());
+    return 1;
+}
+
+/* Checks whether the call-stack of this state is registered. */
+int has_self_fn(lua_State *L) {
+    struct find find = { lua_touserdata(L, lua_upvalueindex(1)), 0 };
+    pallene_tracer_registry_foreach(find_entry, &find);
+
+    lua_pushboolean(L, find.found);
+    return 1;
+}
+
+/* Creates and closes a brand new state, returning the number of registered
+   states before, during and after its lifetime. */
+int new_state_fn(lua_State *L) {
+    lua_Integer before = count_states();
+
+    lua_State *NL = luaL_newstate();
+    pallene_tracer_init(NL);
+    lua_Integer during = count_states();
+    lua_close(NL);
+
+    lua_pushinteger(L, before);
+    lua_pushinteger(L, during);
+    lua_pushinteger(L, count_states());
+    return 3;
+}
+
+int luaopen_spec_registry_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    lua_pushcfunction(L, count_fn);
+    lua_setfield(L, -2, "count");
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushcclosure(L, has_self_fn, 1);
+    lua_setfield(L, -2, "has_self");
+
+    lua_pushcfunction(L, new_state_fn);
+    lua_setfield(L, -2, "new_state");
+
+    return 1;
+}
@@ -0,0 +1,15 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+it("Global registry", function()
+    assert(util.execute("make --quiet tests"))
+
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("./pt-lua spec/registry/main.lua")
+    assert(ok, err_content)
+    assert.are.same("1\ttrue\n1\t2\t1\n", output_content)
+end)
@@ -0,0 +1,27 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.sampling.module"
+
+if arg[1] == "fraction" then
+    local sampled = 0
+    for _ = 1, 1000 do
+        if module.request(0.25, 1) then
+            sampled = sampled + 1
+        end
+    end
+    print("fraction", sampled > 150 and sampled < 350)
+    return
+end
+
+-- A request sampled and one which is not, then one which is not failing.
+print("request", module.request(1, 2))
+print("request", module.request(0, 2))
+print("error", pcall(module.request, 0, -1))
+
+-- A request decides once, whatever the calls within it ask.
+local inner
+print("outer", module.request(1, 1, function() inner = module.request(0, 1) end))
+print("inner", inner)
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_SETLINE()                                       \
+    PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_FRAMEEXIT(fnstack)
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* Raises an error when `n` is negative. */
+void work_fn(lua_State *L, lua_Integer n) {
+    MODULE_C_FRAMEENTER();
+
+    MODULE_C_SETLINE();
+    if(n < 0)
+        luaL_error(L, "n is negative");
+
+    MODULE_C_FRAMEEXIT();
+}
+
+/* request(p, n, [fn]): a request sampled with probability `p`, doing `n` calls
+   of `work_fn` (one failing if `n` is negative) and calling back `fn` if given.
+   Returns whether it is sampled. */
+int request_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(request_fn);
+
+    bool sampled = PALLENE_TRACER_SAMPLE(fnstack, luaL_checknumber(L, 1));
+
+    lua_Integer n = luaL_checkinteger(L, 2);
+    for(lua_Integer i = 0; i < (n < 0 ? 1 : n); i++) {
+        MODULE_C_SETLINE();
+        work_fn(L, n);
+    }
+
+    if(lua_isfunction(L, 3)) {
+        lua_pushvalue(L, 3);
+        PALLENE_TRACER_LUA_CALL(L, fnstack, 0, 0);
+    }
+
+    lua_pushboolean(L, sampled);
+
+    MODULE_C_FRAMEEXIT();
+    return 1;
+}
+
+int luaopen_spec_sampling_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, request_fn, 2);
+    lua_setfield(L, -2, "request");
+
+    return 1;
+}
@@ -0,0 +1,60 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+it("Requests decide once whether they are sampled", function()
+    assert(util.execute("make --quiet tests"))
+    local ok, _, output_content, err_content = util.outputs_of_execute("./pt-lua spec/sampling/main.lua")
+    assert(ok, err_content)
+    assert.are.same("", err_content)
+    assert.are.same([[
+request	true
+request	false
+error	false	n is negative
+outer	true
+inner	true
+]], output_content)
+end)
+
+it("Only sampled requests are traced in full", function()
+    local path = os.tmpname()
+    local ok = util.outputs_of_execute("PT_TRACE_FILE=" .. path .. " ./pt-lua spec/sampling/main.lua")
+    assert(ok)
+
+    local output_content, err_content
+    ok, _, output_content, err_content = util.outputs_of_execute("./pt-lua tools/trace.lua " .. path)
+    os.remove(path)
+    assert(ok, err_content)
+    assert.are.same("", err_content)
+
+    local _, events = string.match(output_content, "^(.-)\n(.*)$")
+    assert.are.same([[
+call request_fn (spec/sampling/module.c)
+  enter work_fn (spec/sampling/module.c), caller at line 59
+  exit work_fn (spec/sampling/module.c:42)
+  enter work_fn (spec/sampling/module.c), caller at line 59
+  exit work_fn (spec/sampling/module.c:42)
+exit request_fn (spec/sampling/module.c:59)
+call request_fn (spec/sampling/module.c)
+exit request_fn (spec/sampling/module.c:59)
+call request_fn (spec/sampling/module.c)
+error request_fn (spec/sampling/module.c:59)
+call request_fn (spec/sampling/module.c)
+  enter work_fn (spec/sampling/module.c), caller at line 59
+  exit work_fn (spec/sampling/module.c:42)
+  call request_fn (spec/sampling/module.c)
+    enter work_fn (spec/sampling/module.c), caller at line 59
+    exit work_fn (spec/sampling/module.c:42)
+  exit request_fn (spec/sampling/module.c:59)
+exit request_fn (spec/sampling/module.c:59)
+]], events)
+end)
+
+it("Fraction of requests sampled", function()
+    local ok, _, output_content, err_content = util.outputs_of_execute("./pt-lua spec/sampling/main.lua fraction")
+    assert(ok, err_content)
+    assert.are.same("fraction\ttrue\n", output_content)
+end)
@@ -0,0 +1,28 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.stackuse.module"
+
+-- Every call of `down_fn` takes 512 bytes at least, so a call going 20 deep
+-- uses 19 times that more than one going 1 deep.
+module.recurse(1)
+local _, peaks = pallene_tracer_stackuse()
+local one = peaks.recurse
+module.recurse(20)
+local frames
+frames, peaks = pallene_tracer_stackuse()
+print("frame", frames.down_fn >= 512, frames.down_fn < 4096, frames.recurse)
+local twenty = peaks.recurse
+print("peak", twenty >= one + 19 * 512, twenty <= one + 19 * frames.down_fn)
+
+-- Calls ending in an error are not measured.
+pcall(module.fail, 30)
+_, peaks = pallene_tracer_stackuse()
+print("error", peaks.fail, peaks.recurse == twenty)
+
+-- Calling back into Lua, the stack of the callback counts as well.
+module.outer(function() module.recurse(20) end)
+_, peaks = pallene_tracer_stackuse()
+print("callback", peaks.outer > peaks.recurse)
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_FRAMEEXIT(fnstack)
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* Goes `n` calls deeper, with a frame of at least 512 bytes each. Raises an
+   error at the bottom if asked. */
+void down_fn(lua_State *L, lua_Integer n, int fail) {
+    MODULE_C_FRAMEENTER();
+
+    volatile char pad[512];
+    pad[0] = (char) n;
+    if(n > 1)
+        down_fn(L, n - 1, fail);
+    else if(fail)
+        luaL_error(L, "bottom");
+    pad[1] = pad[0];
+
+    MODULE_C_FRAMEEXIT();
+}
+
+/* recurse(n): `n` calls of `down_fn`, one in another. */
+int recurse(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(recurse);
+
+    down_fn(L, luaL_checkinteger(L, 1), 0);
+
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+/* fail(n): same, raising an error at the bottom. */
+int fail(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(fail);
+
+    down_fn(L, luaL_checkinteger(L, 1), 1);
+
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+/* outer(fn): calls back `fn`. */
+int outer(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(outer);
+
+    lua_pushvalue(L, 1);
+    PALLENE_TRACER_LUA_CALL(L, fnstack, 0, 0);
+
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+int luaopen_spec_stackuse_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, recurse, 2);
+    lua_setfield(L, -2, "recurse");
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, fail, 2);
+    lua_setfield(L, -2, "fail");
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, outer, 2);
+    lua_setfield(L, -2, "outer");
+
+    return 1;
+}
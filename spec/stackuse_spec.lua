@@ -0,0 +1,19 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+it("Native stack usage", function()
+    assert(util.execute("make --quiet tests"))
+    local ok, _, output_content, err_content = util.outputs_of_execute("./pt-lua spec/stackuse/main.lua")
+    assert(ok, err_content)
+    assert.are.same("", err_content)
+    assert.are.same([[
+frame	true	true	nil
+peak	true	true
+error	nil	true
+callback	true
+]], output_content)
+end)
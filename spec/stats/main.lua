@@ -0,0 +1,32 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.recorder.module"
+
+-- A few calls and errors, one of them with a traceback. Then prints our stats
+-- page, once it is updated with all of them.
+module.step(1)
+module.step(2)
+if arg[1] ~= "overflow" then
+    pcall(module.step, 0)
+    xpcall(module.step, pallene_tracer_errhandler, 0)
+end
+
+local path = os.tmpname()
+local command = "./pt-lua -E tools/stats.lua " .. os.getenv("PT_STATS_NAME") .. " > " .. path
+local output
+for _ = 1, 100 do
+    assert(os.execute(command))
+    local f = assert(io.open(path))
+    output = f:read("a")
+    f:close()
+    if string.find(output, "\n +4 +0  step_fn") or
+        (arg[1] == "overflow" and string.find(output, "\n +2 +0  step_fn")) then
+        break
+    end
+    os.execute("sleep 0.05")
+end
+os.remove(path)
+io.write(output)
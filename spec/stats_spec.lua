@@ -0,0 +1,67 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+-- Runs the stats page spec with the `settings`, returns what it printed of its
+-- page without the first line.
+local function stats(settings, args)
+    assert(util.execute("make --quiet tests"))
+
+    local tmpname = os.tmpname()
+    local name = "pt-lua-spec-" .. string.match(tmpname, "[^/]*$")
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("PT_STATS_NAME=" .. name .. " PT_STATS_INTERVAL=10 " ..
+            settings .. " ./pt-lua spec/stats/main.lua " .. args)
+    os.remove(tmpname)
+    assert(ok, err_content)
+
+    -- The page goes with the process.
+    assert(not io.open("/dev/shm/" .. name))
+
+    local header, rest = string.match(output_content, "^(.-)\n(.*)$")
+    local prefix = "# /dev/shm/" .. name .. ": pid "
+    assert.are.same(prefix, string.sub(header, 1, #prefix))
+    assert(string.find(header, "^%d+, updated every 10ms, last at ", #prefix + 1), header)
+    return rest, err_content
+end
+
+it("Stats page of a running process", function()
+    local output_content, err_content = stats("", "")
+    assert.are.same([[
+errors 2, overflows 0, tracebacks 1
+
+       STATE        DEPTH     CAPACITY
+           1            0       100000
+
+       CALLS    CALLBACKS  FUNCTION
+           4            0  check_fn (spec/recorder/module.c)
+           4            0  step_fn (spec/recorder/module.c)
+]], output_content)
+    assert.are.same("", err_content)
+end)
+
+it("Stats page counts overflows", function()
+    -- `check_fn` is the third frame.
+    local output_content = stats("PT_STACK_CAPACITY=2", "overflow")
+    assert.are.same([[
+errors 0, overflows 2, tracebacks 0
+
+       STATE        DEPTH     CAPACITY
+           1            0            2
+
+       CALLS    CALLBACKS  FUNCTION
+           2            0  check_fn (spec/recorder/module.c)
+           2            0  step_fn (spec/recorder/module.c)
+]], output_content)
+end)
+
+it("Invalid stats page setting", function()
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("PT_STATS_INTERVAL=0 ./pt-lua -e ''")
+    assert(not ok)
+    assert.are.same("", output_content)
+    assert.are.same("./pt-lua: invalid value '0' for PT_STATS_INTERVAL\n", err_content)
+end)
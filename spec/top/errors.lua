@@ -0,0 +1,14 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- The module is built with `PT_DEBUG` only, so the details of its functions
+-- are local variables, gone once an error unwinds them.
+local module = require "spec.tracebacks.singular.module"
+
+-- Half a second of CPU time, mostly raising errors.
+local start = os.clock()
+while os.clock() - start < 0.5 do
+    pcall(module.singular_fn)
+end
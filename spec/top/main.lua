@@ -0,0 +1,21 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.top.module"
+
+local function lua_spin()
+    local sum = 0
+    for i = 1, 20000 do
+        sum = sum + i
+    end
+    return sum
+end
+
+-- Half a second of CPU time, half of it in Pallene code and half in Lua code
+-- called back from Pallene code.
+local start = os.clock()
+while os.clock() - start < 0.5 do
+    module.hot_fn(100000, lua_spin)
+end
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_SETLINE()                                       \
+    PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_FRAMEEXIT(fnstack)
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* Burns some CPU time. */
+void spin_c(lua_State *L, lua_Integer n) {
+    MODULE_C_FRAMEENTER();
+
+    volatile lua_Integer sum = 0;
+    for(lua_Integer i = 0; i < n; i++)
+        sum += i;
+
+    MODULE_C_FRAMEEXIT();
+}
+
+/* hot_fn(n, f): spins `n` times, then calls `f` if given. */
+int hot_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(hot_fn);
+
+    lua_Integer n = luaL_checkinteger(L, 1);
+    spin_c(L, n);
+    if(!lua_isnoneornil(L, 2)) {
+        lua_pushvalue(L, 2);
+        MODULE_C_SETLINE();
+        lua_call(L, 0, 0);
+    }
+
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+int luaopen_spec_top_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, hot_fn, 2);
+    lua_setfield(L, -2, "hot_fn");
+
+    return 1;
+}
@@ -0,0 +1,84 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+-- A row of the live view: self%, self ms, total%, total ms, calls/s and function.
+local function row(rate, fn)
+    return "\n +[%d.]+ +[%d.]+ +[%d.]+ +[%d.]+ +" .. rate .. "  " .. fn .. "\n"
+end
+
+it("Live view of the hottest functions", function()
+    assert(util.execute("make --quiet tests"))
+
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("PT_TOP_INTERVAL=100 ./pt-lua --top spec/top/main.lua")
+    assert(ok, err_content)
+    assert.are.same("", output_content)
+
+    -- A refresh every 100ms, and a last one at exit.
+    local _, refreshes = string.gsub(err_content, "pt%-lua %-%-top: pid %d+", "")
+    assert(refreshes >= 3, err_content)
+
+    -- The Pallene functions with their call rate, and the Lua function they call.
+    assert(string.find(err_content, row("%d+", "spin_c %(spec/top/module.c%)")), err_content)
+    assert(string.find(err_content, row("%d+", "hot_fn %(spec/top/module.c%)")), err_content)
+    assert(string.find(err_content, row("%-", "%? %(spec/top/main.lua:8%)")), err_content)
+end)
+
+it("Invalid live view setting", function()
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("PT_TOP_ROWS=0 ./pt-lua --top -e ''")
+    assert(not ok)
+    assert.are.same("", output_content)
+    assert.are.same("./pt-lua: invalid value '0' for PT_TOP_ROWS\n", err_content)
+end)
+
+it("Sampled profile as folded stacks", function()
+    local path = os.tmpname()
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("./pt-lua --profile=" .. path .. " spec/top/main.lua")
+    local profile = util.get_file_contents(path)
+    os.remove(path)
+    assert(ok, err_content)
+    assert.are.same("", output_content)
+    assert.are.same("", err_content)
+
+    -- The C frame under its Lua interface function, and the Lua callback too.
+    local stack = "main chunk %(spec/top/main.lua:0%);hot_fn %(spec/top/module.c%);"
+    assert(string.find(profile, stack .. "spin_c %(spec/top/module.c%) %d+\n"), profile)
+    assert(string.find(profile, stack .. "%? %(spec/top/main.lua:8%) %d+\n"), profile)
+end)
+
+it("Sampled profile as gzipped pprof", function()
+    local path = os.tmpname()
+    local ok, _, _, err_content =
+        util.outputs_of_execute("./pt-lua --profile=" .. path .. ".pb.gz spec/top/main.lua")
+    local profile = util.get_file_contents(path .. ".pb.gz")
+    os.remove(path)
+    os.remove(path .. ".pb.gz")
+    assert(ok, err_content)
+    assert.are.same("\x1f\x8b\x08", string.sub(profile, 1, 3))
+
+    -- It is not compressed, so the string table shows.
+    for _, s in ipairs({ "cpu", "wall", "alloc_space", "calls", "spin_c (spec/top/module.c)" }) do
+        assert(string.find(profile, s, 1, true), s)
+    end
+end)
+
+it("Sampled profile of functions unwound by errors", function()
+    for _, suffix in ipairs({ ".folded", ".pb.gz" }) do
+        local path = os.tmpname()
+        local ok, _, output_content, err_content =
+            util.outputs_of_execute("./pt-lua --profile=" .. path .. suffix .. " spec/top/errors.lua")
+        local profile = util.get_file_contents(path .. suffix)
+        os.remove(path)
+        os.remove(path .. suffix)
+        assert(ok, err_content)
+        assert.are.same("", output_content)
+        assert.are.same("", err_content)
+        assert(string.find(profile, "lifes_good_fn (spec/tracebacks/singular/module.c)", 1, true))
+    end
+end)
@@ -0,0 +1,73 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+-- Writes the call trace of the flight recorder spec, run with `mode` if any,
+-- returns what tools/trace.lua prints of it with `options`.
+local function trace(options, mode)
+    assert(util.execute("make --quiet tests"))
+
+    local path = os.tmpname()
+    local ok = util.outputs_of_execute("PT_TRACE_FILE=" .. path .. " ./pt-lua spec/recorder/main.lua " ..
+        (mode or ""))
+    assert(not ok)
+
+    local output_content, err_content
+    ok, _, output_content, err_content =
+        util.outputs_of_execute("./pt-lua tools/trace.lua " .. path .. " " .. options)
+    os.remove(path)
+    assert(ok, err_content)
+    assert.are.same("", err_content)
+
+    local header, rest = string.match(output_content, "^(.-)\n(.*)$")
+    assert(string.find(header, ": pid %d+, 16 events$"), header)
+    return rest
+end
+
+it("Call trace of Pallene calls", function()
+    assert.are.same([[
+call step_fn (spec/recorder/module.c)
+  enter check_fn (spec/recorder/module.c), caller at line 56
+  exit check_fn (spec/recorder/module.c:44)
+exit step_fn (spec/recorder/module.c:56)
+call step_fn (spec/recorder/module.c)
+  enter check_fn (spec/recorder/module.c), caller at line 56
+  exit check_fn (spec/recorder/module.c:44)
+exit step_fn (spec/recorder/module.c:56)
+call step_fn (spec/recorder/module.c)
+  enter check_fn (spec/recorder/module.c), caller at line 56
+  error check_fn (spec/recorder/module.c:44)
+error step_fn (spec/recorder/module.c:56)
+call step_fn (spec/recorder/module.c)
+  enter check_fn (spec/recorder/module.c), caller at line 56
+  error check_fn (spec/recorder/module.c:44)
+]], trace("events=15"))
+end)
+
+it("Call trace summary", function()
+    assert.are.same([[
+       CALLS       ENTERS       ERRORS  FUNCTION
+           0            4            2  check_fn (spec/recorder/module.c)
+           4            0            2  step_fn (spec/recorder/module.c)
+]], trace("summary=yes"))
+end)
+
+it("Errors through a module which is not traced", function()
+    -- Its frames were not traced entering, so neither are they when unwound.
+    assert.are.same([[
+       CALLS       ENTERS       ERRORS  FUNCTION
+           0            4            2  check_fn (spec/recorder/module.c)
+           4            0            2  step_fn (spec/recorder/module.c)
+]], trace("summary=yes", "untraced"))
+end)
+
+it("Invalid call trace setting", function()
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("PT_TRACE_LIMIT=-1 ./pt-lua -e ''")
+    assert(not ok)
+    assert.are.same("", output_content)
+    assert.are.same("./pt-lua: invalid value '-1' for PT_TRACE_LIMIT\n", err_content)
+end)
@@ -5,12 +5,13 @@
 
 local util = require "spec.util"
 
-local function assert_test(example, expected_content)
+-- `env` is an optional prefix of environment variable assignments.
+local function assert_test(example, expected_content, env)
     assert(util.execute("make --quiet tests"))
 
     local dir  = util.shell_quote("spec/tracebacks/"..example)
     local ok, _, output_content, err_content =
-        util.outputs_of_execute("./pt-lua "..dir.."/main.lua")
+        util.outputs_of_execute((env or "").."./pt-lua "..dir.."/main.lua")
     assert(not ok, output_content)
     assert.are.same(expected_content, err_content)
 end
@@ -116,3 +117,26 @@ stack traceback:
     C: in function '<?>'
 ]])
 end)
+
+it("Traceback Ellipsis thresholds from environment", function()
+    assert_test("ellipsis", [[
+./pt-lua: C stack overflow
+stack traceback:
+    spec/tracebacks/ellipsis/module.c:52: in function 'module_fn'
+    spec/tracebacks/ellipsis/main.lua:9: in function 'lua_fn'
+    spec/tracebacks/ellipsis/module.c:52: in function 'module_fn'
+
+    ... (Skipped 392 frames) ...
+
+    spec/tracebacks/ellipsis/module.c:52: in function 'module_fn'
+    spec/tracebacks/ellipsis/main.lua:9: in function 'lua_fn'
+    spec/tracebacks/ellipsis/main.lua:12: in <main>
+    C: in function '<?>'
+]], "PT_TRACEBACK_TOP=3 PT_TRACEBACK_BOTTOM=2 ")
+end)
+
+it("Invalid setting from environment", function()
+    assert_test("singular", [[
+./pt-lua: invalid value '-1' for PT_STACK_CAPACITY
+]], "PT_STACK_CAPACITY=-1 ")
+end)
@@ -0,0 +1,13 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.wrap.module"
+
+print(module.version, module.add(1, 2), module.apply(module.add, 3, 4))
+print(pcall(module.div, 1, 0))
+
+module.apply(function(n)
+    return module.div(n, 0)
+end, 1)
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* A plain C module knowing nothing of Pallene Tracer, traced by `pt-lua` with
+   `PT_WRAP_MODULES`. */
+
+#include "lua.h"
+#include "lauxlib.h"
+
+/* add(a, b) */
+static int add(lua_State *L) {
+    lua_pushinteger(L, luaL_checkinteger(L, 1) + luaL_checkinteger(L, 2));
+    return 1;
+}
+
+/* div(a, b): raises an error on division by zero. */
+static int divide(lua_State *L) {
+    lua_Integer b = luaL_checkinteger(L, 2);
+    if(b == 0)
+        luaL_error(L, "division by zero");
+    lua_pushinteger(L, luaL_checkinteger(L, 1) / b);
+    return 1;
+}
+
+/* apply(f, ...): calls back `f(...)`, returning what it returns. */
+static int apply(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+    return lua_gettop(L);
+}
+
+/* pause(...): yields `...`, returning what it is resumed with. */
+static int pause(lua_State *L) {
+    return lua_yield(L, lua_gettop(L));
+}
+
+int luaopen_spec_wrap_module(lua_State *L) {
+    luaL_Reg functions[] = {
+        { "add", add },
+        { "div", divide },
+        { "apply", apply },
+        { "pause", pause },
+        { NULL, NULL }
+    };
+    luaL_newlib(L, functions);
+
+    lua_pushliteral(L, "1.0");
+    lua_setfield(L, -2, "version");
+
+    return 1;
+}
@@ -0,0 +1,29 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.wrap.module"
+
+local co = coroutine.create(function(n)
+    return module.add(module.pause(n), 1)
+end)
+print(module.apply(coroutine.resume, co, 1))
+print(module.add(2, 3))
+print(coroutine.resume(co, 10))
+
+local gen = coroutine.wrap(function()
+    for i = 1, 2 do
+        module.pause(i)
+    end
+end)
+print(gen(), gen())
+
+local closed = coroutine.create(module.pause)
+coroutine.resume(closed)
+local suspended = coroutine.create(module.pause)
+module.apply(function(n)
+    coroutine.resume(suspended)
+    assert(coroutine.close(closed))
+    return module.div(n, 0)
+end, 1)
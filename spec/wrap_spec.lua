@@ -0,0 +1,78 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+-- Runs spec/wrap/main.lua wrapping `modules`, with `env` set as well.
+local function run(modules, env)
+    assert(util.execute("make --quiet tests"))
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("LUA_CPATH='./?.so' PT_WRAP_MODULES=" .. modules ..
+            " " .. (env or "") .. " ./pt-lua spec/wrap/main.lua")
+    assert(not ok)
+    assert.are.same("1.0\t3\t7\nfalse\tdivision by zero\n", output_content)
+    return err_content
+end
+
+it("Wrapped C module in the traceback", function()
+    assert.are.same([[
+./pt-lua: division by zero
+stack traceback:
+    ./spec/wrap/module.so:0: in function 'spec.wrap.module.div'
+    spec/wrap/main.lua:12: in function '<?>'
+    ./spec/wrap/module.so:0: in function 'spec.wrap.module.apply'
+    spec/wrap/main.lua:11: in <main>
+    C: in function '<?>'
+]], run("other,spec.wrap.module"))
+end)
+
+it("Wrapped C module in the call trace", function()
+    local path = os.tmpname()
+    run("'*'", "PT_TRACE_FILE=" .. path)
+
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("./pt-lua tools/trace.lua " .. path .. " summary=yes")
+    os.remove(path)
+    assert(ok, err_content)
+    assert.are.same("", err_content)
+
+    local _, rest = string.match(output_content, "^(.-)\n(.*)$")
+    assert.are.same([[
+       CALLS       ENTERS       ERRORS  FUNCTION
+           2            0            0  spec.wrap.module.add (./spec/wrap/module.so)
+           2            0            1  spec.wrap.module.apply (./spec/wrap/module.so)
+           2            0            2  spec.wrap.module.div (./spec/wrap/module.so)
+]], rest)
+end)
+
+it("C module not asked to be wrapped", function()
+    assert.are.same([[
+./pt-lua: spec/wrap/main.lua:12: division by zero
+stack traceback:
+    C: in function '<?>'
+    spec/wrap/main.lua:12: in function '<?>'
+    C: in function '<?>'
+    spec/wrap/main.lua:11: in <main>
+    C: in function '<?>'
+]], run("spec.wrap"))
+end)
+
+it("Wrapped C functions yielding", function()
+    assert(util.execute("make --quiet tests"))
+    local ok, _, output_content, err_content =
+        util.outputs_of_execute("LUA_CPATH='./?.so' PT_WRAP_MODULES=spec.wrap.module" ..
+            " ./pt-lua spec/wrap/yield.lua")
+    assert(not ok)
+    assert.are.same("true\t1\n5\ntrue\t11\n1\t2\n", output_content)
+    assert.are.same([[
+./pt-lua: division by zero
+stack traceback:
+    ./spec/wrap/module.so:0: in function 'spec.wrap.module.div'
+    spec/wrap/yield.lua:28: in function '<?>'
+    ./spec/wrap/module.so:0: in function 'spec.wrap.module.apply'
+    spec/wrap/yield.lua:25: in <main>
+    C: in function '<?>'
+]], err_content)
+end)
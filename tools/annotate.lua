@@ -0,0 +1,217 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Annotated source of the hottest functions of a pprof profile written with
+-- `pt-lua --profile=file.pb.gz`. Usage, from where the script was run:
+--     ./pt-lua tools/annotate.lua <profile> [value=cpu] [functions=10] [context=3] [source=dir]...
+--
+-- Functions come hottest first, by the value on top of the stack (self). Each
+-- one is shown with the lines of its source file which have samples, and some
+-- `context` around them: the value charged to the line on top of the stack,
+-- and anywhere on it (total). A Pallene function is at the lines of the
+-- `SETLINE`s it went through in its C file, so for generated code the hot lines
+-- point at the construct behind them. Source files are looked for as named in
+-- the profile, then under every `source` directory.
+
+local pprof = require "tools.pprof"
+
+local path
+local options = { value = "cpu", functions = 10, context = 3, sources = {} }
+for _, a in ipairs(arg) do
+    local k, v = string.match(a, "^(%w+)=(.*)$")
+    if k == "value" then
+        options.value = v
+    elseif k == "functions" or k == "context" then
+        options[k] = math.tointeger(tonumber(v))
+        if not options[k] or options[k] < 0 then
+            error("bad " .. a)
+        end
+    elseif k == "source" then
+        table.insert(options.sources, v)
+    elseif not path then
+        path = a
+    else
+        path = nil
+        break
+    end
+end
+if not path then
+    io.stderr:write("usage: ./pt-lua tools/annotate.lua <profile> [value=cpu] [functions=10] [context=3] [source=dir]...\n")
+    os.exit(2)
+end
+
+local profile = pprof.read(path)
+local vi = pprof.value_index(profile, options.value)
+if not vi then
+    local names = {}
+    for _, vt in ipairs(profile.sample_types) do
+        table.insert(names, vt.type)
+    end
+    error(string.format("no value '%s' in %s (there are %s)", options.value, path,
+        table.concat(names, ", ")))
+end
+local sample_type = profile.sample_types[vi]
+
+-- ---- Costs ----
+
+-- Per function: self and total, and per line of it the same.
+local costs = {}
+local grand = 0
+
+local function cost(fn)
+    local c = costs[fn]
+    if not c then
+        c = { fn = fn, self = 0, total = 0, lines = {} }
+        costs[fn] = c
+    end
+    return c
+end
+
+local function line_cost(c, line)
+    local l = c.lines[line]
+    if not l then
+        l = { self = 0, total = 0 }
+        c.lines[line] = l
+    end
+    return l
+end
+
+for _, sample in ipairs(profile.samples) do
+    local v = sample.values[vi] or 0
+    local frames = sample.frames
+    if v ~= 0 and #frames > 0 then
+        grand = grand + v
+        local leaf = cost(frames[1].fn)
+        leaf.self = leaf.self + v
+        local l = line_cost(leaf, frames[1].line)
+        l.self = l.self + v
+
+        -- Recursion charges a function, or a line, once per sample.
+        local seen = {}
+        for _, frame in ipairs(frames) do
+            local c = cost(frame.fn)
+            if not seen[c] then
+                seen[c] = {}
+                c.total = c.total + v
+            end
+            if not seen[c][frame.line] then
+                seen[c][frame.line] = true
+                l = line_cost(c, frame.line)
+                l.total = l.total + v
+            end
+        end
+    end
+end
+
+local hottest = {}
+for _, c in pairs(costs) do
+    table.insert(hottest, c)
+end
+table.sort(hottest, function(a, b)
+    if a.self ~= b.self then
+        return a.self > b.self
+    end
+    if a.total ~= b.total then
+        return a.total > b.total
+    end
+    return a.fn.system_name < b.fn.system_name
+end)
+
+-- ---- Report ----
+
+local files = {}
+
+-- The lines of the source file `name`, or nil.
+local function source(name)
+    if files[name] == nil then
+        files[name] = false
+        local candidates = { name }
+        for _, dir in ipairs(options.sources) do
+            table.insert(candidates, dir .. "/" .. name)
+        end
+        for _, candidate in ipairs(candidates) do
+            local file = io.open(candidate, "r")
+            if file then
+                local lines = {}
+                for line in file:lines() do
+                    table.insert(lines, line)
+                end
+                file:close()
+                files[name] = lines
+                break
+            end
+        end
+    end
+    return files[name] or nil
+end
+
+local function share(v)
+    return grand > 0 and v / grand * 100 or 0
+end
+
+local function column(v)
+    if v == 0 then
+        return "."
+    end
+    return pprof.format(sample_type, v)
+end
+
+print(string.format("# %s: %s, %s in total", path, sample_type.type, pprof.format(sample_type, grand)))
+
+for rank = 1, math.min(options.functions, #hottest) do
+    local c = hottest[rank]
+    local fn = c.fn
+    print()
+    print(string.format("# %d. %s  self %s (%.1f%%), total %s (%.1f%%)", rank, fn.system_name,
+        pprof.format(sample_type, c.self), share(c.self), pprof.format(sample_type, c.total),
+        share(c.total)))
+    print(string.format("%12s %12s  %s", "SELF", "TOTAL", "LINE"))
+
+    local lines = {}
+    for line in pairs(c.lines) do
+        if line > 0 then
+            table.insert(lines, line)
+        end
+    end
+    table.sort(lines)
+
+    -- What was charged to no line in particular.
+    local none = c.lines[0]
+    if none then
+        print(string.format("%12s %12s  %6s  (no line)", column(none.self), column(none.total), "-"))
+    end
+
+    local text = source(fn.filename)
+    if #lines > 0 and not text then
+        print(string.format("%27s(%s not found)", "", fn.filename))
+    end
+
+    -- Runs of lines, from the start of the function where it is known.
+    local shown = 0
+    for i, line in ipairs(lines) do
+        local first = math.max(line - options.context, shown + 1, 1)
+        if i == 1 and fn.start_line > 0 and fn.start_line < line then
+            first = math.max(math.min(first, fn.start_line), shown + 1)
+        end
+        local last = line + options.context
+        if lines[i + 1] and lines[i + 1] - options.context <= last + 1 then
+            last = lines[i + 1] - 1
+        end
+        if text then
+            last = math.min(last, #text)
+        else
+            first, last = line, line
+        end
+        if shown > 0 and first > shown + 1 then
+            print(string.format("%27s  %6s", "", "..."))
+        end
+        for n = first, last do
+            local l = c.lines[n] or { self = 0, total = 0 }
+            print(string.format("%12s %12s  %6d  %s", column(l.self), column(l.total), n,
+                text and text[n] or ""))
+        end
+        shown = math.max(shown, last)
+    end
+end
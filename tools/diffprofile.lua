@@ -0,0 +1,341 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Compares two profiles written with `pt-lua --profile`, folded or pprof, e.g.
+-- of two builds of the same script. Usage:
+--     ./pt-lua tools/diffprofile.lua <base> <new> [value=samples] [normalize=yes]
+--         [functions=20] [stacks=10] [svg=file] [folded=file]
+--
+-- Prints the change of every function, on top of the stack (self) and anywhere
+-- on it (total), and of every stack, in `value` units and relative to the base,
+-- the largest changes first. Stacks are of functions, lines merged, as in the
+-- folded format. `value` is a sample type of the pprof profiles; folded ones
+-- only have samples. With `normalize`, the base is scaled to the total of the
+-- new profile first, so that runs of different length compare.
+--
+-- `svg` writes a differential flame graph: the flame graph of the new profile
+-- with every frame colored by how it changed, red for more and blue for less.
+-- `folded` writes the stacks with both values, "stack base new", as taken by
+-- `flamegraph.pl` to draw the same.
+
+local pprof = require "tools.pprof"
+
+local paths = {}
+local options = { value = "samples", normalize = true, functions = 20, stacks = 10 }
+for _, a in ipairs(arg) do
+    local k, v = string.match(a, "^(%w+)=(.*)$")
+    if k == "value" or k == "svg" or k == "folded" then
+        options[k] = v
+    elseif k == "normalize" then
+        options.normalize = v == "yes" or v == "true" or v == "1"
+    elseif k == "functions" or k == "stacks" then
+        options[k] = math.tointeger(tonumber(v))
+        if not options[k] or options[k] < 0 then
+            error("bad " .. a)
+        end
+    else
+        table.insert(paths, a)
+    end
+end
+if #paths ~= 2 then
+    io.stderr:write("usage: ./pt-lua tools/diffprofile.lua <base> <new> [value=samples] [normalize=yes]\n" ..
+        "           [functions=20] [stacks=10] [svg=file] [folded=file]\n")
+    os.exit(2)
+end
+
+-- ---- Profiles ----
+
+-- The stacks of a profile: a map from the stack, its functions from the root
+-- joined by ';', to its value.
+local function read_folded(path, data)
+    local stacks = {}
+    local n = 0
+    for line in string.gmatch(data, "[^\n]+") do
+        n = n + 1
+        local stack, count = string.match(line, "^(.-)%s+(%d+)%s*$")
+        if not stack then
+            error(string.format("%s:%d: not a folded stack", path, n))
+        end
+        stacks[stack] = (stacks[stack] or 0) + tonumber(count)
+    end
+    return stacks
+end
+
+local function read_pprof(path)
+    local profile = pprof.read(path)
+    local vi = pprof.value_index(profile, options.value)
+    if not vi then
+        error(string.format("no value '%s' in %s", options.value, path))
+    end
+
+    local stacks = {}
+    for _, sample in ipairs(profile.samples) do
+        local v = sample.values[vi] or 0
+        if v ~= 0 and #sample.frames > 0 then
+            local names = {}
+            for i = #sample.frames, 1, -1 do
+                local name = string.gsub(sample.frames[i].fn.system_name, ";", ":")
+                table.insert(names, name)
+            end
+            local stack = table.concat(names, ";")
+            stacks[stack] = (stacks[stack] or 0) + v
+        end
+    end
+    return stacks, profile.sample_types[vi]
+end
+
+local function read(path)
+    local file = assert(io.open(path, "rb"))
+    local data = file:read("a")
+    file:close()
+
+    local text = string.sub(data, 1, 2) ~= "\x1f\x8b" and string.match(data, "^[^\n]-%s%d+\n")
+    if data == "" or text then
+        if options.value ~= "samples" then
+            error(string.format("%s is folded, it only has samples", path))
+        end
+        return read_folded(path, data), { type = "samples", unit = "count" }
+    end
+    return read_pprof(path)
+end
+
+local base, sample_type = read(paths[1])
+local new = read(paths[2])
+
+local base_total, new_total = 0, 0
+for _, v in pairs(base) do
+    base_total = base_total + v
+end
+for _, v in pairs(new) do
+    new_total = new_total + v
+end
+local scale = 1
+if options.normalize and base_total > 0 then
+    scale = new_total / base_total
+end
+
+-- ---- Deltas ----
+
+-- Functions of a stack, from the root.
+local function split(stack)
+    local names = {}
+    for name in string.gmatch(stack, "[^;]+") do
+        table.insert(names, name)
+    end
+    return names
+end
+
+local all = {}
+for stack in pairs(base) do
+    all[stack] = true
+end
+for stack in pairs(new) do
+    all[stack] = true
+end
+
+local functions, stacks = {}, {}
+local function fn_delta(name)
+    local f = functions[name]
+    if not f then
+        f = { name = name, base_self = 0, new_self = 0, base_total = 0, new_total = 0 }
+        functions[name] = f
+    end
+    return f
+end
+
+for stack in pairs(all) do
+    local b, n = (base[stack] or 0) * scale, new[stack] or 0
+    table.insert(stacks, { stack = stack, base = b, new = n })
+
+    local names = split(stack)
+    local leaf = fn_delta(names[#names])
+    leaf.base_self = leaf.base_self + b
+    leaf.new_self = leaf.new_self + n
+    local seen = {}
+    for _, name in ipairs(names) do
+        if not seen[name] then
+            seen[name] = true
+            local f = fn_delta(name)
+            f.base_total = f.base_total + b
+            f.new_total = f.new_total + n
+        end
+    end
+end
+
+local function format(v)
+    if sample_type.unit == "nanoseconds" then
+        return string.format("%.1fms", v / 1e6)
+    end
+    return string.format(math.abs(v - math.floor(v)) < 0.05 and "%.0f" or "%.1f", v)
+end
+
+local function delta(b, n)
+    local d = n - b
+    local size = format(math.abs(d))
+    local zero = tonumber(string.match(size, "[%d.]+")) == 0
+    return ((d >= 0 or zero) and "+" or "-") .. size
+end
+
+local function relative(b, n)
+    if b == 0 then
+        return n == 0 and "-" or "new"
+    elseif n == 0 then
+        return "gone"
+    end
+    return string.format("%+.1f%%", (n / b - 1) * 100)
+end
+
+-- Orders by the largest change of the first pair of keys, then of the next.
+local function by_change(...)
+    local keys = { ... }
+    return function(x, y)
+        for i = 1, #keys, 2 do
+            local b, n = keys[i], keys[i + 1]
+            local dx, dy = math.abs(x[n] - x[b]), math.abs(y[n] - y[b])
+            if dx ~= dy then
+                return dx > dy
+            end
+        end
+        return (x.name or x.stack) < (y.name or y.stack)
+    end
+end
+
+-- ---- Report ----
+
+print(string.format("# base: %s, %s %s", paths[1], format(base_total), sample_type.type))
+print(string.format("# new:  %s, %s %s", paths[2], format(new_total), sample_type.type))
+if scale ~= 1 then
+    print(string.format("# base normalized to the new total (x%.4f)", scale))
+end
+
+local list = {}
+for _, f in pairs(functions) do
+    table.insert(list, f)
+end
+table.sort(list, by_change("base_self", "new_self", "base_total", "new_total"))
+
+print()
+print("functions")
+print(string.format("  %10s %10s %10s %8s   %10s %10s %10s %8s  %s",
+    "base self", "new self", "delta", "change", "base total", "new total", "delta", "change",
+    "function"))
+for i = 1, math.min(options.functions, #list) do
+    local f = list[i]
+    print(string.format("  %10s %10s %10s %8s   %10s %10s %10s %8s  %s",
+        format(f.base_self), format(f.new_self), delta(f.base_self, f.new_self),
+        relative(f.base_self, f.new_self),
+        format(f.base_total), format(f.new_total), delta(f.base_total, f.new_total),
+        relative(f.base_total, f.new_total), f.name))
+end
+
+table.sort(stacks, by_change("base", "new"))
+print()
+print("stacks")
+print(string.format("  %10s %10s %10s %8s  %s", "base", "new", "delta", "change", "stack"))
+for i = 1, math.min(options.stacks, #stacks) do
+    local s = stacks[i]
+    print(string.format("  %10s %10s %10s %8s  %s", format(s.base), format(s.new),
+        delta(s.base, s.new), relative(s.base, s.new), s.stack))
+end
+
+-- ---- Flame graphs ----
+
+if options.folded then
+    table.sort(stacks, function(x, y) return x.stack < y.stack end)
+    local file = assert(io.open(options.folded, "w"))
+    for _, s in ipairs(stacks) do
+        file:write(string.format("%s %.0f %.0f\n", s.stack, s.base, s.new))
+    end
+    file:close()
+end
+
+local function escape(s)
+    return (string.gsub(s, "[<>&\"]", { ["<"] = "&lt;", [">"] = "&gt;", ["&"] = "&amp;", ['"'] = "&quot;" }))
+end
+
+-- A frame of the flame graph: the functions along one path, merged.
+local function node(name)
+    return { name = name, base = 0, new = 0, children = {}, order = {} }
+end
+
+if options.svg then
+    local root = node("all")
+    for _, s in ipairs(stacks) do
+        root.base, root.new = root.base + s.base, root.new + s.new
+        local at = root
+        for _, name in ipairs(split(s.stack)) do
+            local child = at.children[name]
+            if not child then
+                child = node(name)
+                at.children[name] = child
+                table.insert(at.order, child)
+            end
+            child.base, child.new = child.base + s.base, child.new + s.new
+            at = child
+        end
+    end
+
+    local width, height, margin = 1200, 16, 10
+    local depth = 0
+    local rects = {}
+    local biggest = 0
+    local function measure(n)
+        biggest = math.max(biggest, math.abs(n.new - n.base))
+        for _, child in ipairs(n.order) do
+            measure(child)
+        end
+    end
+    measure(root)
+
+    -- Frames as wide as their share of the new profile, the root at the bottom.
+    local function layout(n, x, level)
+        depth = math.max(depth, level + 1)
+        local w = root.new > 0 and n.new / root.new * (width - 2 * margin) or 0
+        if w < 0.1 then
+            return
+        end
+        table.insert(rects, { n = n, x = x, w = w, level = level })
+        table.sort(n.order, function(a, b) return a.name < b.name end)
+        for _, child in ipairs(n.order) do
+            layout(child, x, level + 1)
+            x = x + (root.new > 0 and child.new / root.new * (width - 2 * margin) or 0)
+        end
+    end
+    layout(root, margin, 0)
+
+    local total = depth * height + 3 * margin + 16
+    local file = assert(io.open(options.svg, "w"))
+    file:write(string.format('<?xml version="1.0" standalone="no"?>\n' ..
+        '<svg version="1.1" width="%d" height="%d" xmlns="http://www.w3.org/2000/svg">\n' ..
+        '<rect x="0" y="0" width="100%%" height="100%%" fill="#f8f8f8"/>\n' ..
+        '<text x="%d" y="%d" font-family="Verdana" font-size="12">%s</text>\n',
+        width, total, margin, margin + 12,
+        escape(string.format("Differential flame graph of %s against %s (%s): red is more, blue is less",
+            paths[2], paths[1], sample_type.type))))
+
+    for _, r in ipairs(rects) do
+        local n = r.n
+        local d = n.new - n.base
+        local strength = biggest > 0 and math.abs(d) / biggest or 0
+        local fade = math.floor(255 - 200 * strength + 0.5)
+        local fill = d > 0 and string.format("rgb(255,%d,%d)", fade, fade)
+            or d < 0 and string.format("rgb(%d,%d,255)", fade, fade)
+            or "rgb(255,255,255)"
+        local y = total - margin - (r.level + 1) * height
+        local title = string.format("%s: %s -> %s (%s, %s)", n.name, format(n.base), format(n.new),
+            delta(n.base, n.new), relative(n.base, n.new))
+        local label = ""
+        local fits = math.floor(r.w / 7)
+        if fits >= 3 then
+            label = #n.name <= fits and n.name or string.sub(n.name, 1, fits - 2) .. ".."
+        end
+        file:write(string.format('<g><title>%s</title><rect x="%.1f" y="%d" width="%.1f" height="%d" ' ..
+            'fill="%s" stroke="#ccc" stroke-width="0.5"/>' ..
+            '<text x="%.1f" y="%d" font-family="Verdana" font-size="11">%s</text></g>\n',
+            escape(title), r.x, y, r.w, height - 1, fill, r.x + 3, y + 11, escape(label)))
+    end
+    file:write("</svg>\n")
+    file:close()
+end
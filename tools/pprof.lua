@@ -0,0 +1,259 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Reads pprof profiles, such as the ones `pt-lua --profile=file.pb.gz` writes
+-- (see profile.proto of pprof). Gzipped files are fine: the stored blocks of
+-- pt-lua are taken as they are, anything else goes through `gzip -dc`.
+--
+--     local pprof = require "tools.pprof"
+--     local profile = pprof.read("file.pb.gz")
+--
+-- The profile has `sample_types`, a list of `{ type = ..., unit = ... }`, and
+-- `samples`, a list of `{ frames = ..., values = ... }`. The frames of a sample
+-- go from the leaf up to the root, each `{ fn = ..., line = ... }`, where `fn`
+-- is `{ name = ..., system_name = ..., filename = ..., start_line = ... }` and
+-- the same table for every frame of the same function. The values are in the
+-- order of the sample types. `period`, `period_type`, `time_nanos` and
+-- `duration_nanos` are there as well.
+
+local pprof = {}
+
+-- ---- Wire format ----
+
+local function varint(data, pos)
+    local v, shift = 0, 0
+    while true do
+        local b = string.byte(data, pos)
+        if not b then
+            error("truncated varint")
+        end
+        v = v | ((b & 0x7f) << shift)
+        pos = pos + 1
+        if b < 0x80 then
+            return v, pos
+        end
+        shift = shift + 7
+    end
+end
+
+-- Calls `f(field, value)` for every field of the message in `data`. Length
+-- delimited values are strings, the others integers.
+local function fields(data, f)
+    local pos = 1
+    while pos <= #data do
+        local key
+        key, pos = varint(data, pos)
+        local field, wire = key >> 3, key & 7
+        if wire == 0 then
+            local v
+            v, pos = varint(data, pos)
+            f(field, v)
+        elseif wire == 2 then
+            local len
+            len, pos = varint(data, pos)
+            f(field, string.sub(data, pos, pos + len - 1))
+            pos = pos + len
+        elseif wire == 1 then
+            f(field, (string.unpack("<i8", data, pos)))
+            pos = pos + 8
+        elseif wire == 5 then
+            f(field, (string.unpack("<i4", data, pos)))
+            pos = pos + 4
+        else
+            error("bad wire type " .. wire)
+        end
+    end
+end
+
+-- Appends to `list` a repeated integer, packed or not.
+local function integers(list, v)
+    if type(v) == "number" then
+        table.insert(list, v)
+    else
+        local pos = 1
+        while pos <= #v do
+            local n
+            n, pos = varint(v, pos)
+            table.insert(list, n)
+        end
+    end
+end
+
+-- ---- Gzip ----
+
+-- The data of a gzip file made of stored blocks only, or nil.
+local function stored(data)
+    local flags = string.byte(data, 4)
+    if string.byte(data, 3) ~= 8 or flags ~= 0 then
+        return nil
+    end
+
+    local out, pos = {}, 11
+    while true do
+        local header = string.byte(data, pos)
+        if not header or header & 6 ~= 0 then
+            return nil  -- compressed
+        end
+        local len = string.unpack("<I2", data, pos + 1)
+        table.insert(out, string.sub(data, pos + 5, pos + 4 + len))
+        pos = pos + 5 + len
+        if header & 1 == 1 then
+            return table.concat(out)
+        end
+    end
+end
+
+local function gunzip(path, data)
+    local plain = stored(data)
+    if plain then
+        return plain
+    end
+
+    local tmp = os.tmpname()
+    local quoted = "'" .. string.gsub(path, "'", "'\\''") .. "'"
+    local ok = os.execute("gzip -dc " .. quoted .. " > " .. tmp)
+    local file = io.open(tmp, "rb")
+    plain = file and file:read("a")
+    if file then
+        file:close()
+    end
+    os.remove(tmp)
+    if not ok or not plain then
+        error(path .. ": cannot decompress")
+    end
+    return plain
+end
+
+-- ---- Profiles ----
+
+-- Decodes a profile from the bytes in `data`.
+function pprof.decode(data)
+    local strings, raw_types, raw_samples = {}, {}, {}
+    local locations, functions = {}, {}
+    local period_type
+    local profile = { period = 0, time_nanos = 0, duration_nanos = 0 }
+
+    local function value_type(msg)
+        local vt = {}
+        fields(msg, function(field, v)
+            if field == 1 then vt.type = v elseif field == 2 then vt.unit = v end
+        end)
+        return vt
+    end
+
+    fields(data, function(field, v)
+        if field == 1 then
+            table.insert(raw_types, value_type(v))
+        elseif field == 2 then
+            local sample = { ids = {}, values = {} }
+            fields(v, function(f, x)
+                if f == 1 then integers(sample.ids, x) elseif f == 2 then integers(sample.values, x) end
+            end)
+            table.insert(raw_samples, sample)
+        elseif field == 4 then
+            local location = { lines = {} }
+            fields(v, function(f, x)
+                if f == 1 then
+                    location.id = x
+                elseif f == 4 then
+                    local line = { line = 0 }
+                    fields(x, function(g, y)
+                        if g == 1 then line.fn = y elseif g == 2 then line.line = y end
+                    end)
+                    table.insert(location.lines, line)
+                end
+            end)
+            locations[location.id] = location
+        elseif field == 5 then
+            local fn = { start_line = 0 }
+            fields(v, function(f, x)
+                if f == 1 then fn.id = x
+                elseif f == 2 then fn.name = x
+                elseif f == 3 then fn.system_name = x
+                elseif f == 4 then fn.filename = x
+                elseif f == 5 then fn.start_line = x
+                end
+            end)
+            functions[fn.id] = fn
+        elseif field == 6 then
+            table.insert(strings, v)
+        elseif field == 9 then
+            profile.time_nanos = v
+        elseif field == 10 then
+            profile.duration_nanos = v
+        elseif field == 11 then
+            period_type = value_type(v)
+        elseif field == 12 then
+            profile.period = v
+        end
+    end)
+
+    local function str(i)
+        return strings[(i or 0) + 1] or ""
+    end
+
+    for _, fn in pairs(functions) do
+        fn.name, fn.system_name, fn.filename = str(fn.name), str(fn.system_name), str(fn.filename)
+    end
+
+    profile.sample_types = {}
+    for i, vt in ipairs(raw_types) do
+        profile.sample_types[i] = { type = str(vt.type), unit = str(vt.unit) }
+    end
+    if period_type then
+        profile.period_type = { type = str(period_type.type), unit = str(period_type.unit) }
+    end
+
+    -- Lines of a location go from the inlined function to its caller.
+    local unknown = { name = "?", system_name = "?", filename = "", start_line = 0 }
+    profile.samples = {}
+    for _, raw in ipairs(raw_samples) do
+        local frames = {}
+        for _, id in ipairs(raw.ids) do
+            local location = locations[id]
+            for _, line in ipairs(location and location.lines or {}) do
+                table.insert(frames, { fn = functions[line.fn] or unknown, line = line.line })
+            end
+        end
+        table.insert(profile.samples, { frames = frames, values = raw.values })
+    end
+    return profile
+end
+
+-- Reads the profile in the file at `path`, gzipped or not.
+function pprof.read(path)
+    local file = assert(io.open(path, "rb"))
+    local data = file:read("a")
+    file:close()
+
+    if string.sub(data, 1, 2) == "\x1f\x8b" then
+        data = gunzip(path, data)
+    end
+    local ok, profile = pcall(pprof.decode, data)
+    if not ok then
+        error(path .. ": not a pprof profile: " .. tostring(profile))
+    end
+    return profile
+end
+
+-- Index of the sample type called `name`, or nil.
+function pprof.value_index(profile, name)
+    for i, vt in ipairs(profile.sample_types) do
+        if vt.type == name then
+            return i
+        end
+    end
+    return nil
+end
+
+-- Formats `v` of a sample type for people: milliseconds for nanoseconds.
+function pprof.format(sample_type, v)
+    if sample_type.unit == "nanoseconds" then
+        return string.format("%.1fms", v / 1e6)
+    end
+    return string.format("%d", v)
+end
+
+return pprof
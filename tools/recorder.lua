@@ -0,0 +1,92 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Prints the events of a flight recorder file, written by a Lua state with
+-- `pallene_tracer_recorder_open()`, e.g. `PT_RECORDER_FILE=file ./pt-lua`.
+-- Usage:
+--     ./pt-lua tools/recorder.lua <file> [events=N]
+--
+-- The file is read as it is, so it may be of a process which is still running,
+-- or was killed. Events come oldest first, the last `events` of them if given,
+-- indented by the depth of the call-stack. A process not marked as closed did
+-- not end its Lua state: it crashed, was killed or is running.
+
+local path, count
+for _, a in ipairs(arg) do
+    local k, v = string.match(a, "^(%w+)=(.*)$")
+    if k == "events" then
+        count = math.tointeger(tonumber(v))
+        if not count or count < 0 then
+            error("bad " .. a)
+        end
+    elseif not path then
+        path = a
+    else
+        path = nil
+        break
+    end
+end
+if not path then
+    io.stderr:write("usage: ./pt-lua tools/recorder.lua <file> [events=N]\n")
+    os.exit(2)
+end
+
+local file = assert(io.open(path, "rb"))
+local data = file:read("a")
+file:close()
+
+-- ---- Layout ----
+
+-- See `pt_recorder_header_t` in ptracer.h.
+if #data < 64 or string.sub(data, 1, 8) ~= "PTRECORD" then
+    error(path .. ": not a flight recorder file")
+end
+local version, pid, capacity, descriptors, names_size, _, closed, _, head =
+    string.unpack("=I4I4I4I4I4I4I4I4I8", data, 9)
+if version ~= 1 then
+    error(string.format("%s: version %d, only 1 is known", path, version))
+end
+
+local strings_at = 64 + descriptors * 4
+local events_at = (strings_at + names_size + 63) & ~63
+if #data < events_at + capacity * 8 then
+    error(path .. ": truncated")
+end
+
+-- Function name and filename of a descriptor.
+local names = {}
+local function name(id)
+    if names[id] == nil then
+        local entry = string.unpack("=I4", data, 64 + id * 4 + 1)
+        if entry == 0 or entry == 0xffffffff then
+            names[id] = { "<?>", "?" }
+        else
+            local fn, at = string.unpack("z", data, strings_at + entry)
+            names[id] = { fn, (string.unpack("z", data, at)) }
+        end
+    end
+    return names[id][1], names[id][2]
+end
+
+-- ---- Events ----
+
+local kinds = { "enter", "exit", "error" }
+
+local first = math.max(head - capacity, 0)
+if count then
+    first = math.max(first, head - count)
+end
+
+print(string.format("# %s: pid %d, %d events of %d recorded%s", path, pid, head - first, head,
+    closed ~= 0 and ", closed" or ", not closed"))
+for n = first, head - 1 do
+    local event = string.unpack("=I8", data, events_at + (n % capacity) * 8 + 1)
+    local kind = kinds[(event >> 61) & 7] or "?"
+    local fn, filename = name((event >> 41) & 0xfffff)
+    local depth = (event >> 21) & 0xfffff
+    local line = event & 0x1fffff
+    local where = line > 0 and string.format("%s:%d", filename, line) or filename
+    print(string.format("%s%s %s (%s)", string.rep("  ", math.max(depth - 1, 0)), kind, fn, where))
+end
@@ -0,0 +1,122 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Prints the stats page of a running process, published with
+-- `PT_STATS_NAME=name ./pt-lua`. Usage:
+--     ./pt-lua -E tools/stats.lua <name> [functions=N]
+--
+-- The page is read from /dev/shm, or from the file at `name` if it has a slash
+-- in it. It holds the totals of the process as of its last update: the
+-- incidents, the depth of the call-stack of every live Lua state and the calls
+-- of every Pallene function, the `functions` most called ones if given. Run it
+-- with -E, or it would publish a page of its own if PT_STATS_NAME is set.
+
+local name, count
+for _, a in ipairs(arg) do
+    local k, v = string.match(a, "^(%w+)=(.*)$")
+    if k == "functions" then
+        count = math.tointeger(tonumber(v))
+        if not count or count < 0 then
+            error("bad " .. a)
+        end
+    elseif not name then
+        name = a
+    else
+        name = nil
+        break
+    end
+end
+if not name then
+    io.stderr:write("usage: ./pt-lua -E tools/stats.lua <name> [functions=N]\n")
+    os.exit(2)
+end
+
+local path = name
+if not string.find(name, "/", 2, true) then
+    path = "/dev/shm/" .. string.gsub(name, "^/", "")
+end
+
+-- ---- Layout ----
+
+-- See `stats_header_t` in pt-lua.c. The page is a seqlock: copy it out until
+-- the sequence number is even and the same before and after.
+local HEADER = "=c8I4I4I8I8I4I4I4I4I4I4I8I8I8"
+
+local data, header
+for _ = 1, 1000 do
+    local file = assert(io.open(path, "rb"))
+    data = file:read("a")
+    file:seek("set", 0)
+    local again = file:read(24)
+    file:close()
+
+    if #data < 128 or string.sub(data, 1, 8) ~= "PTSTATS\0" then
+        error(path .. ": not a stats page")
+    end
+    header = table.pack(string.unpack(HEADER, data))
+    local seq = header[4]
+    if seq & 1 == 0 and again and #again == 24 and string.unpack("=I8", again, 17) == seq then
+        break
+    end
+    header = nil
+end
+if not header then
+    error(path .. ": always being written")
+end
+
+local _, version, pid, _, updated, interval, max_states, max_descriptors, names_size,
+    states, descriptors, errors, overflows, tracebacks = table.unpack(header)
+if version ~= 1 then
+    error(string.format("%s: version %d, only 1 is known", path, version))
+end
+
+local states_at = 128
+local descriptors_at = states_at + max_states * 8
+local names_at = descriptors_at + max_descriptors * 24
+if #data < names_at + names_size then
+    error(path .. ": truncated")
+end
+
+-- ---- Stats ----
+
+print(string.format("# %s: pid %d, updated every %dms, %s", path, pid, interval,
+    updated == 0 and "never updated" or os.date("!last at %Y-%m-%d %H:%M:%S UTC", updated // 1000000000)))
+print(string.format("errors %d, overflows %d, tracebacks %d", errors, overflows, tracebacks))
+
+print()
+print(string.format("%12s %12s %12s", "STATE", "DEPTH", "CAPACITY"))
+for i = 1, states do
+    local depth, capacity = string.unpack("=I4I4", data, states_at + (i - 1) * 8 + 1)
+    print(string.format("%12d %12d %12d", i, depth, capacity))
+end
+
+local list = {}
+for id = 1, descriptors - 1 do
+    local calls, callbacks, entry = string.unpack("=I8I8I4", data, descriptors_at + id * 24 + 1)
+    if calls > 0 or callbacks > 0 then
+        local fn, filename = "<?>", "?"
+        if entry ~= 0 then
+            local at
+            fn, at = string.unpack("z", data, names_at + entry)
+            filename = string.unpack("z", data, at)
+        end
+        table.insert(list, { fn = fn, filename = filename, calls = calls, callbacks = callbacks })
+    end
+end
+table.sort(list, function(a, b)
+    if a.calls ~= b.calls then
+        return a.calls > b.calls
+    end
+    return a.fn < b.fn
+end)
+
+print()
+print(string.format("%12s %12s  %s", "CALLS", "CALLBACKS", "FUNCTION"))
+for i, total in ipairs(list) do
+    if count and i > count then
+        break
+    end
+    print(string.format("%12d %12d  %s (%s)", total.calls, total.callbacks, total.fn, total.filename))
+end
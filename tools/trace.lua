@@ -0,0 +1,160 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Prints the events of a call trace file, written by a Lua state with
+-- `pallene_tracer_trace_open()`, e.g. `PT_TRACE_FILE=file ./pt-lua`. Usage:
+--     ./pt-lua tools/trace.lua <file> [events=N] [summary=no]
+--
+-- Events come in the order they happened, the first `events` of them if given,
+-- indented by the depth of the call-stack since the trace started. An enter is
+-- followed by the line its caller was at, a call came from Lua. With `summary`,
+-- only the totals of every function are printed: calls from Lua, enters from
+-- other Pallene functions and errors going through it.
+
+local path, count
+local summary = false
+for _, a in ipairs(arg) do
+    local k, v = string.match(a, "^(%w+)=(.*)$")
+    if k == "events" then
+        count = math.tointeger(tonumber(v))
+        if not count or count < 0 then
+            error("bad " .. a)
+        end
+    elseif k == "summary" then
+        summary = v == "yes" or v == "true" or v == "1"
+    elseif not path then
+        path = a
+    else
+        path = nil
+        break
+    end
+end
+if not path then
+    io.stderr:write("usage: ./pt-lua tools/trace.lua <file> [events=N] [summary=no]\n")
+    os.exit(2)
+end
+
+local file = assert(io.open(path, "rb"))
+local data = file:read("a")
+file:close()
+
+-- ---- Layout ----
+
+-- See `pt_trace_kind_t` in ptracer.h.
+if string.sub(data, 1, 7) ~= "PTTRACE" then
+    error(path .. ": not a call trace file")
+end
+local version = string.byte(data, 8)
+if version ~= 1 then
+    error(string.format("%s: version %d, only 1 is known", path, version))
+end
+
+local pos = 9
+
+local function varint()
+    local v, shift = 0, 0
+    while true do
+        local b = string.byte(data, pos)
+        if not b then
+            error(path .. ": truncated")
+        end
+        v = v | ((b & 0x7f) << shift)
+        pos = pos + 1
+        if b < 0x80 then
+            return v
+        end
+        shift = shift + 7
+    end
+end
+
+local function zigzag(v)
+    return (v >> 1) ~ -(v & 1)
+end
+
+local pid = varint()
+
+-- ---- Events ----
+
+local ENTER, CALL, EXIT, ERROR, NAME = 0, 1, 2, 3, 4
+
+local names = {}
+local totals = {}
+local events = {}
+local id, line = 0, 0
+local depth = 0
+local n = 0
+
+while pos <= #data do
+    local tag = varint()
+    local kind = tag & 7
+    id = id + zigzag(tag >> 3)
+    if kind == NAME then
+        local fn, filename
+        fn, filename, pos = string.unpack("zz", data, pos)
+        names[id] = { fn, filename }
+    elseif kind <= ERROR then
+        if kind ~= CALL then
+            line = line + zigzag(varint())
+        end
+        n = n + 1
+        local names_of = names[id] or { "<?>", "?" }
+        local total = totals[id]
+        if not total then
+            total = { fn = names_of[1], filename = names_of[2], calls = 0, enters = 0, errors = 0 }
+            totals[id] = total
+        end
+
+        if kind == EXIT or kind == ERROR then
+            depth = math.max(depth - 1, 0)
+        end
+        if not summary and (not count or n <= count) then
+            local where
+            if kind == ENTER then
+                where = string.format("%s), caller at line %d", names_of[2], line)
+            elseif kind == CALL then
+                where = names_of[2] .. ")"
+            else
+                where = string.format("%s:%d)", names_of[2], line)
+            end
+            table.insert(events, string.format("%s%s %s (%s", string.rep("  ", depth),
+                ({ "enter", "call", "exit", "error" })[kind + 1], names_of[1], where))
+        end
+        if kind == CALL then
+            depth = depth + 1
+            total.calls = total.calls + 1
+        elseif kind == ENTER then
+            depth = depth + 1
+            total.enters = total.enters + 1
+        elseif kind == ERROR then
+            total.errors = total.errors + 1
+        end
+    else
+        error(string.format("%s: bad event kind %d", path, kind))
+    end
+end
+
+print(string.format("# %s: pid %d, %d events", path, pid, n))
+if not summary then
+    for _, event in ipairs(events) do
+        print(event)
+    end
+    return
+end
+
+local list = {}
+for _, total in pairs(totals) do
+    table.insert(list, total)
+end
+table.sort(list, function(a, b)
+    if a.calls + a.enters ~= b.calls + b.enters then
+        return a.calls + a.enters > b.calls + b.enters
+    end
+    return a.fn < b.fn
+end)
+print(string.format("%12s %12s %12s  %s", "CALLS", "ENTERS", "ERRORS", "FUNCTION"))
+for _, total in ipairs(list) do
+    print(string.format("%12d %12d %12d  %s (%s)", total.calls, total.enters, total.errors,
+        total.fn, total.filename))
+end